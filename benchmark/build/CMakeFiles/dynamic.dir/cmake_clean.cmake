@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/dynamic.dir/dynamic.cpp.o"
+  "CMakeFiles/dynamic.dir/dynamic.cpp.o.d"
+  "dynamic"
+  "dynamic.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/dynamic.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/fdbridge.dir/fdbridge.cpp.o"
+  "CMakeFiles/fdbridge.dir/fdbridge.cpp.o.d"
+  "fdbridge"
+  "fdbridge.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/fdbridge.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
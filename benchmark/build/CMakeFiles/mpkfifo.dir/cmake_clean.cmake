@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/mpkfifo.dir/mpkfifo.cpp.o"
+  "CMakeFiles/mpkfifo.dir/mpkfifo.cpp.o.d"
+  "mpkfifo"
+  "mpkfifo.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/mpkfifo.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/mpsc.dir/mpsc.cpp.o"
+  "CMakeFiles/mpsc.dir/mpsc.cpp.o.d"
+  "mpsc"
+  "mpsc.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/mpsc.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/notify.dir/notify.cpp.o"
+  "CMakeFiles/notify.dir/notify.cpp.o.d"
+  "notify"
+  "notify.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/notify.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/persist.dir/persist.cpp.o"
+  "CMakeFiles/persist.dir/persist.cpp.o.d"
+  "persist"
+  "persist.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/persist.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
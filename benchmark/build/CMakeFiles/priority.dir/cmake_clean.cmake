@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/priority.dir/priority.cpp.o"
+  "CMakeFiles/priority.dir/priority.cpp.o.d"
+  "priority"
+  "priority.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/priority.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/spsc_fence.dir/spsc_fence.cpp.o"
+  "CMakeFiles/spsc_fence.dir/spsc_fence.cpp.o.d"
+  "spsc_fence"
+  "spsc_fence.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/spsc_fence.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
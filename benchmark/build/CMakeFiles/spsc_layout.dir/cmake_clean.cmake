@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/spsc_layout.dir/spsc_layout.cpp.o"
+  "CMakeFiles/spsc_layout.dir/spsc_layout.cpp.o.d"
+  "spsc_layout"
+  "spsc_layout.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/spsc_layout.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
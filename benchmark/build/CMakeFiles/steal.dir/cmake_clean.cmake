@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/steal.dir/steal.cpp.o"
+  "CMakeFiles/steal.dir/steal.cpp.o.d"
+  "steal"
+  "steal.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/steal.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
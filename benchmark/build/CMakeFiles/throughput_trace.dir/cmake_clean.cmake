@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/throughput_trace.dir/throughput.cpp.o"
+  "CMakeFiles/throughput_trace.dir/throughput.cpp.o.d"
+  "throughput_trace"
+  "throughput_trace.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/throughput_trace.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
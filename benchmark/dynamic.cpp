@@ -0,0 +1,95 @@
+/*
+  Copyright (c) 2021 wujiaxu <void00@foxmail.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "queue62.hpp"
+
+static inline void backoff(int& spin)
+{
+    if (++spin > 64)
+    {
+        spin = 0;
+        std::this_thread::yield();
+    }
+}
+
+// every producer pushes total/producers items, values are never 0
+template <typename QUEUE>
+static double run(QUEUE& que, long total, int producers, int consumers)
+{
+    std::atomic<long> popped(0);
+    std::vector<std::thread> threads;
+    long per = total / producers;
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < producers; i++)
+    {
+        threads.emplace_back([&que, per]() {
+            int spin = 0;
+
+            for (long i = 1; i <= per; i++)
+            {
+                while (!que.push((void *)i))
+                    backoff(spin);
+            }
+        });
+    }
+
+    for (int i = 0; i < consumers; i++)
+    {
+        threads.emplace_back([&que, &popped, per, producers]() {
+            int spin = 0;
+            void *p;
+
+            while (popped < per * producers)
+            {
+                if (que.pop(p))
+                    ++popped;
+                else
+                    backoff(spin);
+            }
+        });
+    }
+
+    for (auto& th : threads)
+        th.join();
+
+    std::chrono::duration<double> sec = std::chrono::steady_clock::now() - start;
+    return per * producers / sec.count();
+}
+
+int main(int argc, char *argv[])
+{
+    long total = argc > 1 ? atol(argv[1]) : 10000000;
+
+    static spsc_queue<void *, 4096> spsc_fixed;
+    static mpmc_queue<void *, 4096> mpmc_fixed;
+    spsc_queue<void *> spsc_dynamic(4096);
+    mpmc_queue<void *> mpmc_dynamic(4096);
+    unbounded_spsc_queue<void *> spsc_segmented(4096);
+
+    printf("queue,storage,producers,consumers,ops_per_sec\n");
+    printf("spsc,fixed,1,1,%.0f\n", run(spsc_fixed, total, 1, 1));
+    printf("spsc,dynamic,1,1,%.0f\n", run(spsc_dynamic, total, 1, 1));
+    printf("spsc,segmented,1,1,%.0f\n", run(spsc_segmented, total, 1, 1));
+    printf("mpmc,fixed,2,2,%.0f\n", run(mpmc_fixed, total, 2, 2));
+    printf("mpmc,dynamic,2,2,%.0f\n", run(mpmc_dynamic, total, 2, 2));
+
+    return 0;
+}
@@ -0,0 +1,184 @@
+/*
+  Copyright (c) 2021 wujiaxu <void00@foxmail.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <vector>
+#include "executor62.hpp"
+
+using task = std::function<void ()>;
+
+// the worker loop written by hand around mpmc_queue, kept here to compare
+class yield_pool
+{
+public:
+    explicit yield_pool(int workers) : que_(65536), stop_(false)
+    {
+        for (int i = 0; i < workers; i++)
+        {
+            threads_.emplace_back([this]() {
+                task t;
+
+                while (!stop_.load(std::memory_order_relaxed) || !que_.empty())
+                {
+                    if (que_.pop(t))
+                        t();
+                    else
+                        std::this_thread::yield();
+                }
+            });
+        }
+    }
+
+    ~yield_pool()
+    {
+        stop_ = true;
+        for (auto& th : threads_)
+            th.join();
+    }
+
+    static const char *name() { return "yield_loop"; }
+    bool submit(task&& t) { return que_.push(std::move(t)); }
+    int submit(task *tasks, int n) { return que_.push(tasks, n); }
+
+private:
+    mpmc_queue<task> que_;
+    std::atomic<bool> stop_;
+    std::vector<std::thread> threads_;
+};
+
+class executor_pool
+{
+public:
+    explicit executor_pool(int workers) : ex_(workers, 256, 65536) { }
+
+    static const char *name() { return "executor"; }
+    bool submit(task&& t) { return ex_.submit(std::move(t)); }
+    int submit(task *tasks, int n) { return ex_.submit(tasks, n); }
+
+private:
+    executor<> ex_;
+};
+
+static inline long now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::atomic<long> g_done(0);
+
+// submit-to-start latency of every sample-th task
+static task make_task(long i, int sample, std::vector<long>& lat)
+{
+    long submitted = i % sample == 0 ? now_ns() : 0;
+
+    return [submitted, i, sample, &lat]() {
+        if (submitted)
+            lat[i / sample] = now_ns() - submitted;
+
+        g_done.fetch_add(1, std::memory_order_relaxed);
+    };
+}
+
+// interval_us == 0: submitters go as fast as they can, one sample every 64 tasks
+// interval_us > 0: one submitter, one task every interval, every task is a sample
+template <typename POOL>
+static void run(int workers, int submitters, int batch, long total, int interval_us)
+{
+    int sample = interval_us > 0 ? 1 : 64;
+    long per = total / submitters;
+    std::vector<long> lat(per * submitters / sample + 1, 0);
+    std::vector<std::thread> threads;
+
+    total = per * submitters;
+    g_done = 0;
+
+    POOL pool(workers);
+    auto start = std::chrono::steady_clock::now();
+
+    for (int s = 0; s < submitters; s++)
+    {
+        threads.emplace_back([&pool, &lat, s, per, batch, sample, interval_us]() {
+            std::vector<task> arr(batch);
+
+            for (long i = s * per; i < (s + 1) * per; )
+            {
+                int n = (int)std::min<long>(batch, (s + 1) * per - i);
+
+                for (int k = 0; k < n; k++)
+                    arr[k] = make_task(i + k, sample, lat);
+
+                for (int k = 0; k < n; )
+                {
+                    int cnt = n == 1 ? pool.submit(std::move(arr[0])) : pool.submit(arr.data() + k, n - k);
+
+                    if (cnt == 0)
+                        std::this_thread::yield();
+
+                    k += cnt;
+                }
+
+                i += n;
+                if (interval_us > 0)
+                    std::this_thread::sleep_for(std::chrono::microseconds(interval_us));
+            }
+        });
+    }
+
+    for (auto& th : threads)
+        th.join();
+
+    while (g_done.load(std::memory_order_relaxed) < total)
+        std::this_thread::yield();
+
+    std::chrono::duration<double> sec = std::chrono::steady_clock::now() - start;
+
+    lat.resize((total - 1) / sample + 1);
+    std::sort(lat.begin(), lat.end());
+    printf("%s,%d,%d,%d,%d,%.0f,%ld,%ld,%ld\n", POOL::name(), workers, submitters, batch,
+           interval_us, total / sec.count(), lat[lat.size() / 2], lat[lat.size() * 99 / 100],
+           lat[lat.size() * 999 / 1000]);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    long total = argc > 1 ? atol(argv[1]) : 2000000;
+    int workers = argc > 2 ? atoi(argv[2]) : (int)std::thread::hardware_concurrency();
+    const int submitters[] = {1, 4};
+    const int batches[] = {1, 32};
+
+    printf("pool,workers,submitters,batch,interval_us,tasks_per_sec,p50_ns,p99_ns,p999_ns\n");
+    for (int s : submitters)
+    {
+        for (int batch : batches)
+        {
+            run<yield_pool>(workers, s, batch, total, 0);
+            run<executor_pool>(workers, s, batch, total, 0);
+        }
+    }
+
+    // mostly idle, executor workers are sleeping when a task arrives
+    run<yield_pool>(workers, 1, 1, 10000, 50);
+    run<executor_pool>(workers, 1, 1, 10000, 50);
+
+    return 0;
+}
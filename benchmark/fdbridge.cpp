@@ -0,0 +1,175 @@
+/*
+  Copyright (c) 2021 wujiaxu <void00@foxmail.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+// kfifo.h first, its global _min is hidden by the one of queue62.hpp
+#include "../optional/kfifo.h"
+#include "fd_queue62.hpp"
+
+static const unsigned int RING = 1 << 20;
+
+// ingress of one fifo, copy: read() into a buffer then put into the ring,
+// direct: readv() straight into the ring
+struct spsc_ring
+{
+    spsc_queue<char> que;
+
+    spsc_ring() : que(RING) { }
+    static const char *name() { return "spsc_queue"; }
+
+    ssize_t copy(int fd, char *buf, int len)
+    {
+        ssize_t ret = que.reserve(len).size() == 0 ? -1 : read(fd, buf, len);
+
+        for (ssize_t k = 0; k < ret; )
+            k += que.push(buf + k, ret - k);
+
+        return ret;
+    }
+
+    ssize_t direct(int fd, int len) { return ring_read_fd(que, fd, len); }
+
+    // the consumer uses the bytes in place
+    long drain()
+    {
+        ring_span<char> span = que.peek(RING);
+
+        que.consume(span.size());
+        return span.size();
+    }
+};
+
+struct kfifo_ring
+{
+    struct kfifo *fifo;
+    std::vector<char> out;
+
+    kfifo_ring() : fifo(kfifo_alloc(RING)), out(65536) { }
+    ~kfifo_ring() { kfifo_free(fifo); }
+    static const char *name() { return "kfifo"; }
+
+    ssize_t copy(int fd, char *buf, int len)
+    {
+        ssize_t ret = __kfifo_len(fifo) == fifo->size ? -1 : read(fd, buf, len);
+
+        for (ssize_t k = 0; k < ret; )
+            k += __kfifo_put(fifo, buf + k, ret - k);
+
+        return ret;
+    }
+
+    ssize_t direct(int fd, int len) { return __kfifo_read_fd(fifo, fd, len); }
+
+    long drain() { return __kfifo_get(fifo, out.data(), out.size()); }
+};
+
+// a sender writes total bytes to a socketpair in chunks, the ingress thread
+// moves them into the ring, the consumer drains the ring
+template <typename RING>
+static double run(long total, int chunk, bool direct)
+{
+    RING ring;
+    std::atomic<bool> eof(false);
+    int sv[2];
+    auto start = std::chrono::steady_clock::now();
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+        abort();
+
+    std::thread sender([&sv, total, chunk]() {
+        std::vector<char> data(chunk, 'x');
+
+        for (long done = 0; done < total; )
+        {
+            ssize_t ret = write(sv[0], data.data(), std::min<long>(chunk, total - done));
+
+            if (ret < 0)
+                abort();
+
+            done += ret;
+        }
+
+        shutdown(sv[0], SHUT_WR);
+    });
+
+    std::thread ingress([&ring, &sv, &eof, chunk, direct]() {
+        std::vector<char> buf(chunk);
+
+        for (;;)
+        {
+            ssize_t ret = direct ? ring.direct(sv[1], chunk) : ring.copy(sv[1], buf.data(), chunk);
+
+            if (ret == 0)
+                break;
+
+            if (ret < 0)
+                std::this_thread::yield();
+        }
+
+        eof = true;
+    });
+
+    long got = 0;
+
+    for (;;)
+    {
+        bool done = eof.load();
+        long n = ring.drain();
+
+        got += n;
+        if (n == 0 && done)
+            break;
+
+        if (n == 0)
+            std::this_thread::yield();
+    }
+
+    sender.join();
+    ingress.join();
+    close(sv[0]);
+    close(sv[1]);
+
+    if (got != total)
+        abort();
+
+    std::chrono::duration<double> sec = std::chrono::steady_clock::now() - start;
+    return got / sec.count() / (1 << 20);
+}
+
+int main(int argc, char *argv[])
+{
+    long total = argc > 1 ? atol(argv[1]) : 1L << 30;
+    const int chunks[] = {1024, 16384, 65536};
+
+    printf("fifo,path,chunk,mb_per_sec\n");
+    for (int chunk : chunks)
+    {
+        printf("%s,copy,%d,%.0f\n", spsc_ring::name(), chunk, run<spsc_ring>(total, chunk, false));
+        printf("%s,readv,%d,%.0f\n", spsc_ring::name(), chunk, run<spsc_ring>(total, chunk, true));
+        printf("%s,copy,%d,%.0f\n", kfifo_ring::name(), chunk, run<kfifo_ring>(total, chunk, false));
+        printf("%s,readv,%d,%.0f\n", kfifo_ring::name(), chunk, run<kfifo_ring>(total, chunk, true));
+        fflush(stdout);
+    }
+
+    return 0;
+}
@@ -0,0 +1,130 @@
+/*
+  Copyright (c) 2021 wujiaxu <void00@foxmail.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "../optional/kfifo.h"
+#include "../optional/mpkfifo.h"
+
+// the spinlock kfifo_put/kfifo_get, a short put is retried with the rest
+struct locked_fifo
+{
+    struct kfifo *fifo;
+
+    explicit locked_fifo(unsigned int size) : fifo(kfifo_alloc(size)) { }
+    ~locked_fifo() { kfifo_free(fifo); }
+    static const char *name() { return "kfifo_locked"; }
+    unsigned int put(const char *p, unsigned int len) { return kfifo_put(fifo, p, len); }
+    unsigned int get(char *p, unsigned int len) { return kfifo_get(fifo, p, len); }
+};
+
+struct mp_fifo
+{
+    struct mpkfifo *fifo;
+
+    explicit mp_fifo(unsigned int size) : fifo(mpkfifo_alloc(size)) { }
+    ~mp_fifo() { mpkfifo_free(fifo); }
+    static const char *name() { return "mpkfifo"; }
+    unsigned int put(const char *p, unsigned int len) { return mpkfifo_put(fifo, p, len); }
+    unsigned int get(char *p, unsigned int len) { return mpkfifo_get(fifo, p, len); }
+};
+
+static inline void backoff(int& spin)
+{
+    if (++spin > 64)
+    {
+        spin = 0;
+        std::this_thread::yield();
+    }
+}
+
+// writers put chunk bytes each call, one reader gets up to 4096 bytes each call
+template <typename FIFO>
+static double run(long total, int writers, unsigned int chunk)
+{
+    FIFO fifo(65536);
+    std::vector<std::thread> threads;
+    long per = total / writers / chunk * chunk;
+    auto start = std::chrono::steady_clock::now();
+
+    for (int w = 0; w < writers; w++)
+    {
+        threads.emplace_back([&fifo, per, chunk]() {
+            char buf[256] = {0};
+            int spin = 0;
+
+            for (long done = 0; done < per; )
+            {
+                unsigned int off = 0;
+
+                while (off < chunk)
+                {
+                    unsigned int n = fifo.put(buf + off, chunk - off);
+
+                    if (n == 0)
+                        backoff(spin);
+
+                    off += n;
+                }
+
+                done += chunk;
+            }
+        });
+    }
+
+    char buf[4096];
+    long got = 0;
+    int spin = 0;
+
+    while (got < per * writers)
+    {
+        unsigned int n = fifo.get(buf, sizeof (buf));
+
+        if (n == 0)
+            backoff(spin);
+
+        got += n;
+    }
+
+    for (auto& th : threads)
+        th.join();
+
+    std::chrono::duration<double> sec = std::chrono::steady_clock::now() - start;
+    return got / sec.count() / (1 << 20);
+}
+
+int main(int argc, char *argv[])
+{
+    long total = argc > 1 ? atol(argv[1]) : 1L << 26;
+    const int writers[] = {1, 2, 4, 8, 16};
+    const unsigned int chunks[] = {16, 256};
+
+    printf("fifo,writers,chunk,mb_per_sec\n");
+    for (unsigned int chunk : chunks)
+    {
+        for (int w : writers)
+        {
+            printf("%s,%d,%u,%.0f\n", locked_fifo::name(), w, chunk, run<locked_fifo>(total, w, chunk));
+            printf("%s,%d,%u,%.0f\n", mp_fifo::name(), w, chunk, run<mp_fifo>(total, w, chunk));
+            fflush(stdout);
+        }
+    }
+
+    return 0;
+}
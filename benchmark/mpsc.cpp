@@ -0,0 +1,105 @@
+/*
+  Copyright (c) 2021 wujiaxu <void00@foxmail.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "queue62.hpp"
+
+static inline void backoff(int& spin)
+{
+    if (++spin > 64)
+    {
+        spin = 0;
+        std::this_thread::yield();
+    }
+}
+
+// many producers, one consumer popping batch elements each call
+template <typename T, typename QUEUE>
+static double run(QUEUE& que, long total, int producers, int batch)
+{
+    std::vector<std::thread> threads;
+    long per = total / producers;
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < producers; i++)
+    {
+        threads.emplace_back([&que, per]() {
+            int spin = 0;
+
+            for (long i = 1; i <= per; i++)
+            {
+                while (!que.push((T)i))
+                    backoff(spin);
+            }
+        });
+    }
+
+    std::vector<T> arr(batch);
+    long popped = 0;
+    int spin = 0;
+
+    while (popped < per * producers)
+    {
+        int cnt = batch == 1 ? que.pop(arr[0]) : que.pop(arr.data(), batch);
+
+        if (cnt == 0)
+            backoff(spin);
+
+        popped += cnt;
+    }
+
+    for (auto& th : threads)
+        th.join();
+
+    std::chrono::duration<double> sec = std::chrono::steady_clock::now() - start;
+    return per * producers / sec.count();
+}
+
+template <typename T>
+static void sweep(const char *type, long total)
+{
+    const int producers[] = {2, 4, 8, 16};
+    const int batches[] = {1, 32};
+
+    for (int p : producers)
+    {
+        for (int batch : batches)
+        {
+            mpsc_queue<T> mpsc(4096);
+            mpmc_queue<T> mpmc(4096);
+
+            printf("mpsc_queue,%s,%d,%d,%.0f\n", type, p, batch, run<T>(mpsc, total, p, batch));
+            printf("mpmc_queue,%s,%d,%d,%.0f\n", type, p, batch, run<T>(mpmc, total, p, batch));
+            fflush(stdout);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    long total = argc > 1 ? atol(argv[1]) : 10000000;
+
+    printf("queue,type,producers,batch,ops_per_sec\n");
+    sweep<long>("long", total);
+    sweep<void *>("pointer", total);
+
+    return 0;
+}
@@ -0,0 +1,105 @@
+/*
+  Copyright (c) 2021 wujiaxu <void00@foxmail.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "eventfd_queue62.hpp"
+
+using clk = std::chrono::steady_clock;
+using queue = eventfd_queue<spsc_queue<long>>;
+
+static long now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(clk::now().time_since_epoch()).count();
+}
+
+// the producer pushes a burst of timestamps every interval_us.
+// timer: the consumer wakes up from epoll_wait every timer_ms and polls
+// read_available, as an event loop does without a notification.
+// eventfd: the consumer waits for the eventfd in epoll_wait, drains, rearms
+static void run(bool notify, int burst, int interval_us, int timer_ms, long total)
+{
+    queue que(65536);
+    std::vector<long> lat;
+    struct epoll_event ev;
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    long wakeups = 0;
+
+    ev.events = EPOLLIN;
+    ev.data.fd = que.fd();
+    if (notify)
+        epoll_ctl(epfd, EPOLL_CTL_ADD, que.fd(), &ev);
+
+    lat.reserve(total);
+    std::thread producer([&que, notify, burst, interval_us, total]() {
+        for (long i = 0; i < total; )
+        {
+            long ts = now_ns();
+
+            for (int k = 0; k < burst && i < total; k++, i++)
+            {
+                while (!(notify ? que.push(ts) : que.queue().push(ts)))
+                    std::this_thread::yield();
+            }
+
+            std::this_thread::sleep_for(std::chrono::microseconds(interval_us));
+        }
+    });
+
+    while ((long)lat.size() < total)
+    {
+        long ts;
+
+        epoll_wait(epfd, &ev, 1, notify ? -1 : timer_ms);
+        wakeups++;
+
+        do
+        {
+            while (que.pop(ts))
+                lat.push_back(now_ns() - ts);
+        } while (notify && !que.rearm());
+    }
+
+    producer.join();
+    close(epfd);
+
+    std::sort(lat.begin(), lat.end());
+    printf("%s,%d,%d,%d,%ld,%ld,%.3f\n", notify ? "eventfd" : "timer", burst, interval_us,
+           notify ? 0 : timer_ms, lat[lat.size() / 2], lat[lat.size() * 99 / 100],
+           (double)wakeups / total);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    long total = argc > 1 ? atol(argv[1]) : 20000;
+    const int bursts[] = {1, 16};
+
+    printf("mode,burst,interval_us,timer_ms,p50_ns,p99_ns,wakeups_per_msg\n");
+    for (int burst : bursts)
+    {
+        run(false, burst, 100, 1, total);
+        run(true, burst, 100, 0, total);
+    }
+
+    return 0;
+}
@@ -0,0 +1,113 @@
+/*
+  Copyright (c) 2021 wujiaxu <void00@foxmail.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include "mmap_queue62.hpp"
+
+static const unsigned int SIZE = 65536;
+
+static inline void backoff(int& spin)
+{
+    if (++spin > 64)
+    {
+        spin = 0;
+        std::this_thread::yield();
+    }
+}
+
+// one producer, one consumer, batch 1 or 32
+template <typename QUEUE>
+static double run(QUEUE& que, long total, int batch)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    std::thread producer([&que, total, batch]() {
+        long arr[32];
+        int spin = 0;
+
+        for (long i = 0; i < total; )
+        {
+            int n = (int)std::min<long>(batch, total - i);
+
+            for (int k = 0; k < n; k++)
+                arr[k] = i + k;
+
+            int cnt = n == 1 ? que.push(arr[0]) : que.push(arr, n);
+
+            if (cnt == 0)
+                backoff(spin);
+
+            i += cnt;
+        }
+    });
+
+    long arr[32];
+    int spin = 0;
+
+    for (long i = 0; i < total; )
+    {
+        int cnt = batch == 1 ? que.pop(arr[0]) : que.pop(arr, batch);
+
+        if (cnt == 0)
+            backoff(spin);
+
+        i += cnt;
+    }
+
+    producer.join();
+
+    std::chrono::duration<double> sec = std::chrono::steady_clock::now() - start;
+    return total / sec.count();
+}
+
+int main(int argc, char *argv[])
+{
+    long total = argc > 1 ? atol(argv[1]) : 1L << 24;
+    std::string path = argc > 2 ? argv[2] : "queue62_persist.bench";
+    const unsigned int syncs[] = {0, 1 << 20, 1 << 16};
+    const int batches[] = {1, 32};
+
+    printf("queue,sync_every,batch,ops_per_sec\n");
+    for (int batch : batches)
+    {
+        spsc_queue<long> mem(SIZE);
+
+        printf("spsc_queue,-,%d,%.0f\n", batch, run(mem, total, batch));
+        fflush(stdout);
+
+        for (unsigned int sync : syncs)
+        {
+            mmap_spsc_queue<long> que;
+
+            unlink(path.c_str());
+            if (!que.open(path.c_str(), SIZE, sync))
+            {
+                perror(path.c_str());
+                return 1;
+            }
+
+            printf("mmap_spsc_queue,%u,%d,%.0f\n", sync, batch, run(que, total, batch));
+            fflush(stdout);
+        }
+    }
+
+    unlink(path.c_str());
+    return 0;
+}
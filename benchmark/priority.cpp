@@ -0,0 +1,91 @@
+/*
+  Copyright (c) 2021 wujiaxu <void00@foxmail.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include "queue62.hpp"
+
+// the lanes juggled by hand, polled from the highest one on every pop
+template <unsigned int lanes>
+class manual_lanes
+{
+public:
+    bool push(unsigned int lane, long v) { return que_[lane].push(v); }
+
+    bool pop(long& v)
+    {
+        for (unsigned int i = 0; i < lanes; i++)
+        {
+            if (que_[i].pop(v))
+                return true;
+        }
+
+        return false;
+    }
+
+private:
+    mpmc_queue<long, 1024> que_[lanes];
+};
+
+static volatile long g_sink = 0;
+
+// ns of a push and a pop when lane is the only non-empty lane,
+// or ns of a failed pop when lane is -1 and every lane is empty
+template <typename QUEUE>
+static double run(QUEUE& que, long total, int lane)
+{
+    auto start = std::chrono::steady_clock::now();
+    long v = 0;
+
+    for (long i = 0; i < total; i++)
+    {
+        if (lane >= 0)
+            que.push(lane, i);
+
+        if (que.pop(v))
+            g_sink = v;
+    }
+
+    std::chrono::duration<double, std::nano> ns = std::chrono::steady_clock::now() - start;
+    return ns.count() / total;
+}
+
+template <unsigned int lanes>
+static void sweep(long total)
+{
+    static manual_lanes<lanes> manual;
+    static priority_mpmc_queue<long, lanes> prio(1024);
+    const int which[] = {-1, 0, (int)lanes / 2, (int)lanes - 1};
+
+    for (int lane : which)
+    {
+        printf("manual,%u,%d,%.1f\n", lanes, lane, run(manual, total, lane));
+        printf("priority_mpmc_queue,%u,%d,%.1f\n", lanes, lane, run(prio, total, lane));
+        fflush(stdout);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    long total = argc > 1 ? atol(argv[1]) : 10000000;
+
+    printf("queue,lanes,busy_lane,ns_per_op\n");
+    sweep<4>(total);
+    sweep<16>(total);
+    sweep<64>(total);
+
+    return 0;
+}
@@ -0,0 +1,214 @@
+/*
+  Copyright (c) 2021 wujiaxu <void00@foxmail.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include "queue62.hpp"
+#include "blocking_queue62.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t cycles() { return __rdtsc(); }
+#else
+static inline uint64_t cycles() { return 0; }
+#endif
+
+// spsc_queue before indices became std::atomic, published by sfence,
+// kept here only to compare against
+template <typename T, unsigned int capacity>
+class sfence_spsc_queue
+{
+public:
+    bool push(const T& t)
+    {
+        if (writable(1) == 0)
+            return false;
+
+        arr_[in_ & (capacity - 1)] = t;
+        asm volatile("sfence" ::: "memory");
+        ++in_;
+        return true;
+    }
+
+    bool pop(T& t)
+    {
+        if (readable(1) == 0)
+            return false;
+
+        t = arr_[out_ & (capacity - 1)];
+        asm volatile("sfence" ::: "memory");
+        ++out_;
+        return true;
+    }
+
+    int push(const T *ret, int n)
+    {
+        unsigned int len = std::min<unsigned int>(n, writable(n));
+        unsigned int idx_in = in_ & (capacity - 1);
+        unsigned int l = std::min(len, capacity - idx_in);
+
+        memcpy(arr_ + idx_in, ret, l * sizeof (T));
+        memcpy(arr_, ret + l, (len - l) * sizeof (T));
+        asm volatile("sfence" ::: "memory");
+        in_ += len;
+        return len;
+    }
+
+    int pop(T *ret, int n)
+    {
+        unsigned int len = std::min<unsigned int>(n, readable(n));
+        unsigned int idx_out = out_ & (capacity - 1);
+        unsigned int l = std::min(len, capacity - idx_out);
+
+        memcpy(ret, arr_ + idx_out, l * sizeof (T));
+        memcpy(ret + l, arr_, (len - l) * sizeof (T));
+        asm volatile("sfence" ::: "memory");
+        out_ += len;
+        return len;
+    }
+
+private:
+    unsigned int writable(unsigned int n)
+    {
+        if (capacity - in_ + out_cache_ < n)
+            out_cache_ = out_;
+
+        return capacity - in_ + out_cache_;
+    }
+
+    unsigned int readable(unsigned int n)
+    {
+        if (in_cache_ - out_ < n)
+            in_cache_ = in_;
+
+        return in_cache_ - out_;
+    }
+
+    alignas(64) volatile unsigned int in_ = 0;
+    unsigned int out_cache_ = 0;
+    alignas(64) volatile unsigned int out_ = 0;
+    unsigned int in_cache_ = 0;
+    alignas(64) T arr_[capacity];
+};
+
+static inline void backoff(int& spin)
+{
+    if (++spin > 64)
+    {
+        spin = 0;
+        std::this_thread::yield();
+    }
+}
+
+struct result
+{
+    double ops_per_sec;
+    double cycles_per_op;
+};
+
+template <typename QUEUE>
+static result run(QUEUE& que, long total, int batch)
+{
+    auto start = std::chrono::steady_clock::now();
+    uint64_t c0 = cycles();
+
+    std::thread producer([&que, total, batch]() {
+        long buf[256];
+        long i = 0;
+        int spin = 0;
+
+        while (i < total)
+        {
+            int n = 0;
+
+            if (batch == 1)
+                n = que.push(i) ? 1 : 0;
+            else
+            {
+                for (int k = 0; k < batch; k++)
+                    buf[k] = i + k;
+
+                n = que.push(buf, (int)std::min<long>(batch, total - i));
+            }
+
+            if (n == 0)
+                backoff(spin);
+
+            i += n;
+        }
+    });
+
+    long buf[256];
+    long expect = 0;
+    int spin = 0;
+
+    while (expect < total)
+    {
+        int n = batch == 1 ? (que.pop(buf[0]) ? 1 : 0) : que.pop(buf, batch);
+
+        if (n == 0)
+            backoff(spin);
+
+        for (int k = 0; k < n; k++)
+        {
+            if (buf[k] != expect++)
+            {
+                fprintf(stderr, "out of order\n");
+                exit(1);
+            }
+        }
+    }
+
+    producer.join();
+
+    uint64_t c1 = cycles();
+    std::chrono::duration<double> sec = std::chrono::steady_clock::now() - start;
+    return result{total / sec.count(), (double)(c1 - c0) / total};
+}
+
+// cycles_per_op is wall clock TSC cycles per element, 0 if there is no TSC
+int main(int argc, char *argv[])
+{
+    long total = argc > 1 ? atol(argv[1]) : 20000000;
+    const int batches[] = {1, 16, 256};
+
+    // the engine alone, the public spsc_queue, and blocking_queue which
+    // also checks for sleeping push_wait/pop_wait callers after every call
+    static sfence_spsc_queue<long, 4096> sfence;
+    static __spsc_queue<long, 4096> atomic;
+    static spsc_queue<long, 4096> wrapper;
+    static blocking_queue<spsc_queue<long, 4096>> blocking;
+
+    printf("engine,batch,ops_per_sec,cycles_per_op\n");
+    for (int batch : batches)
+    {
+        result r1 = run(sfence, total, batch);
+        result r2 = run(atomic, total, batch);
+        result r3 = run(wrapper, total, batch);
+        result r4 = run(blocking, total, batch);
+
+        printf("sfence,%d,%.0f,%.2f\n", batch, r1.ops_per_sec, r1.cycles_per_op);
+        printf("acquire_release,%d,%.0f,%.2f\n", batch, r2.ops_per_sec, r2.cycles_per_op);
+        printf("spsc_queue,%d,%.0f,%.2f\n", batch, r3.ops_per_sec, r3.cycles_per_op);
+        printf("blocking_queue,%d,%.0f,%.2f\n", batch, r4.ops_per_sec, r4.cycles_per_op);
+        fflush(stdout);
+    }
+
+    return 0;
+}
@@ -0,0 +1,171 @@
+/*
+  Copyright (c) 2021 wujiaxu <void00@foxmail.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include "queue62.hpp"
+
+// spsc_queue layout before indices were split onto their own cache lines,
+// kept here only to compare against
+template <typename T, unsigned int capacity>
+class packed_spsc_queue
+{
+public:
+    bool push(const T& t)
+    {
+        if (capacity - in_ + out_ == 0)
+            return false;
+
+        arr_[in_ & (capacity - 1)] = t;
+        asm volatile("sfence" ::: "memory");
+        ++in_;
+        return true;
+    }
+
+    bool pop(T& t)
+    {
+        if (in_ - out_ == 0)
+            return false;
+
+        t = arr_[out_ & (capacity - 1)];
+        asm volatile("sfence" ::: "memory");
+        ++out_;
+        return true;
+    }
+
+    int push(const T *ret, int n)
+    {
+        unsigned int len = std::min<unsigned int>(n, capacity - in_ + out_);
+        unsigned int idx_in = in_ & (capacity - 1);
+        unsigned int l = std::min(len, capacity - idx_in);
+
+        memcpy(arr_ + idx_in, ret, l * sizeof (T));
+        memcpy(arr_, ret + l, (len - l) * sizeof (T));
+        asm volatile("sfence" ::: "memory");
+        in_ += len;
+        return len;
+    }
+
+    int pop(T *ret, int n)
+    {
+        unsigned int len = std::min<unsigned int>(n, in_ - out_);
+        unsigned int idx_out = out_ & (capacity - 1);
+        unsigned int l = std::min(len, capacity - idx_out);
+
+        memcpy(ret, arr_ + idx_out, l * sizeof (T));
+        memcpy(ret + l, arr_, (len - l) * sizeof (T));
+        asm volatile("sfence" ::: "memory");
+        out_ += len;
+        return len;
+    }
+
+private:
+    volatile unsigned int in_ = 0;
+    volatile unsigned int out_ = 0;
+    T arr_[capacity];
+};
+
+static inline void backoff(int& spin)
+{
+    if (++spin > 64)
+    {
+        spin = 0;
+        std::this_thread::yield();
+    }
+}
+
+template <typename QUEUE>
+static double run(QUEUE& que, long total, int batch)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    std::thread producer([&que, total, batch]() {
+        long buf[256];
+        long i = 0;
+        int spin = 0;
+
+        while (i < total)
+        {
+            int n = 0;
+
+            if (batch == 1)
+                n = que.push(i) ? 1 : 0;
+            else
+            {
+                for (int k = 0; k < batch; k++)
+                    buf[k] = i + k;
+
+                n = que.push(buf, (int)std::min<long>(batch, total - i));
+            }
+
+            if (n == 0)
+                backoff(spin);
+
+            i += n;
+        }
+    });
+
+    long buf[256];
+    long expect = 0;
+    int spin = 0;
+
+    while (expect < total)
+    {
+        int n = 0;
+
+        if (batch == 1)
+            n = que.pop(buf[0]) ? 1 : 0;
+        else
+            n = que.pop(buf, batch);
+
+        if (n == 0)
+            backoff(spin);
+
+        for (int k = 0; k < n; k++)
+        {
+            if (buf[k] != expect++)
+            {
+                fprintf(stderr, "out of order\n");
+                exit(1);
+            }
+        }
+    }
+
+    producer.join();
+
+    std::chrono::duration<double> sec = std::chrono::steady_clock::now() - start;
+    return total / sec.count();
+}
+
+int main(int argc, char *argv[])
+{
+    long total = argc > 1 ? atol(argv[1]) : 20000000;
+    const int batches[] = {1, 16, 256};
+
+    static packed_spsc_queue<long, 4096> packed;
+    static spsc_queue<long, 4096> split;
+
+    printf("layout,batch,ops_per_sec\n");
+    for (int batch : batches)
+    {
+        printf("packed,%d,%.0f\n", batch, run(packed, total, batch));
+        printf("split,%d,%.0f\n", batch, run(split, total, batch));
+    }
+
+    return 0;
+}
@@ -0,0 +1,180 @@
+/*
+  Copyright (c) 2021 wujiaxu <void00@foxmail.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "queue62.hpp"
+
+// fork-join: a binary tree of tasks, task i spawns 2 * i + 1 and 2 * i + 2
+struct task
+{
+    long id;
+};
+
+static std::vector<task> g_tasks;
+static const int MAX_WORKERS = 64;
+// a worker holds at most about 2 * depth tasks, pops its newest one first,
+// the deques are empty again after every run
+static ws_deque<task *, 4096> g_deques[MAX_WORKERS];
+static std::atomic<long> g_done(0);
+
+static inline void work(long id)
+{
+    volatile long x = id;
+
+    for (int i = 0; i < 64; i++)
+        x = x * 31 + i;
+}
+
+static inline void backoff(int& spin)
+{
+    if (++spin > 64)
+    {
+        spin = 0;
+        std::this_thread::yield();
+    }
+}
+
+// run task t, hand its children to push()
+template <typename PUSH>
+static inline void execute(task *t, PUSH&& push)
+{
+    long total = (long)g_tasks.size();
+
+    work(t->id);
+    for (long c = 2 * t->id + 1; c <= 2 * t->id + 2 && c < total; c++)
+        push(&g_tasks[c]);
+}
+
+// every worker pops and pushes the same mpmc_queue
+static double run_shared(int workers)
+{
+    mpmc_queue<task *> que(g_tasks.size());
+    std::vector<std::thread> threads;
+    long total = (long)g_tasks.size();
+    auto start = std::chrono::steady_clock::now();
+
+    g_done = 0;
+    que.push(&g_tasks[0]);
+    for (int w = 0; w < workers; w++)
+    {
+        threads.emplace_back([&que, total]() {
+            long local = 0;
+            int spin = 0;
+            task *t;
+
+            while (g_done.load(std::memory_order_relaxed) < total)
+            {
+                if (!que.pop(t))
+                {
+                    g_done += local;
+                    local = 0;
+                    backoff(spin);
+                    continue;
+                }
+
+                execute(t, [&que](task *c) { while (!que.push(c)) ; });
+                if (++local == 256)
+                {
+                    g_done += local;
+                    local = 0;
+                }
+            }
+        });
+    }
+
+    for (auto& th : threads)
+        th.join();
+
+    std::chrono::duration<double> sec = std::chrono::steady_clock::now() - start;
+    return total / sec.count();
+}
+
+// every worker owns a ws_deque, steals from the others when it is empty
+static double run_steal(int workers)
+{
+    ws_deque<task *, 4096> *deques = g_deques;
+    std::vector<std::thread> threads;
+    long total = (long)g_tasks.size();
+    auto start = std::chrono::steady_clock::now();
+
+    g_done = 0;
+    deques[0].push(&g_tasks[0]);
+    for (int w = 0; w < workers; w++)
+    {
+        threads.emplace_back([deques, total, workers, w]() {
+            ws_deque<task *, 4096> *own = &deques[w];
+            unsigned int victim = w;
+            long local = 0;
+            int spin = 0;
+            task *t;
+
+            while (g_done.load(std::memory_order_relaxed) < total)
+            {
+                if (!own->pop(t))
+                {
+                    victim = (victim * 1103515245 + 12345) % workers;
+                    if (victim == (unsigned int)w || !deques[victim].steal(t))
+                    {
+                        g_done += local;
+                        local = 0;
+                        backoff(spin);
+                        continue;
+                    }
+                }
+
+                execute(t, [own](task *c) { own->push(c); });
+                if (++local == 256)
+                {
+                    g_done += local;
+                    local = 0;
+                }
+            }
+        });
+    }
+
+    for (auto& th : threads)
+        th.join();
+
+    std::chrono::duration<double> sec = std::chrono::steady_clock::now() - start;
+    return total / sec.count();
+}
+
+int main(int argc, char *argv[])
+{
+    int depth = argc > 1 ? atoi(argv[1]) : 22;
+    int max_workers = argc > 2 ? atoi(argv[2]) : (int)std::thread::hardware_concurrency();
+
+    if (max_workers > MAX_WORKERS)
+        max_workers = MAX_WORKERS;
+
+    g_tasks.resize((size_t(1) << (depth + 1)) - 1);
+    for (size_t i = 0; i < g_tasks.size(); i++)
+        g_tasks[i].id = i;
+
+    printf("scheduler,workers,tasks_per_sec\n");
+    for (int w = 1; w <= max_workers; w *= 2)
+    {
+        printf("mpmc_queue,%d,%.0f\n", w, run_shared(w));
+        printf("ws_deque,%d,%.0f\n", w, run_steal(w));
+        fflush(stdout);
+    }
+
+    return 0;
+}
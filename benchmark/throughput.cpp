@@ -0,0 +1,330 @@
+/*
+  Copyright (c) 2021 wujiaxu <void00@foxmail.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+// kfifo.h first, its global _min is hidden by the one of queue62.hpp
+#include "../optional/kfifo.h"
+#include "queue62.hpp"
+
+#ifdef QUEUE62_HAVE_BOOST
+#include <boost/lockfree/queue.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+#endif
+
+struct pod64
+{
+    long v;
+    char pad[56];
+};
+
+template <typename T> struct payload;
+
+template <>
+struct payload<int>
+{
+    static const char *name() { return "int"; }
+    static int make(long i) { return (int)i; }
+};
+
+template <>
+struct payload<void *>
+{
+    static const char *name() { return "pointer"; }
+    static void *make(long i) { return (void *)(uintptr_t)(i + 1); }
+};
+
+template <>
+struct payload<pod64>
+{
+    static const char *name() { return "pod64"; }
+    static pod64 make(long i) { pod64 p; p.v = i; return p; }
+};
+
+template <>
+struct payload<std::string>
+{
+    static const char *name() { return "string"; }
+    static std::string make(long i) { return std::to_string(i); }
+};
+
+// every adapter: push/pop n elements, return how many were done
+template <typename T>
+struct spsc_adapter
+{
+    spsc_queue<T> que;
+
+    explicit spsc_adapter(unsigned int size) : que(size) { }
+    static const char *name() { return "spsc_queue"; }
+    static bool multi() { return false; }
+    static bool batch() { return true; }
+    int push(const T *p, int n) { return n == 1 ? que.push(*p) : que.push(p, n); }
+    int pop(T *p, int n) { return n == 1 ? que.pop(*p) : que.pop(p, n); }
+};
+
+template <typename T>
+struct mpmc_adapter
+{
+    mpmc_queue<T> que;
+
+    explicit mpmc_adapter(unsigned int size) : que(size) { }
+    static const char *name() { return "mpmc_queue"; }
+    static bool multi() { return true; }
+    static bool batch() { return true; }
+    int push(const T *p, int n) { return n == 1 ? que.push(*p) : que.push(p, n); }
+    int pop(T *p, int n) { return n == 1 ? que.pop(*p) : que.pop(p, n); }
+};
+
+// 8 shards whatever the number of CPUs, the same total capacity as the others
+template <typename T>
+struct sharded_adapter
+{
+    sharded_mpmc_queue<T> que;
+
+    explicit sharded_adapter(unsigned int size) : que(size / 8, 8) { }
+    static const char *name() { return "sharded_mpmc_queue"; }
+    static bool multi() { return true; }
+    static bool batch() { return true; }
+    int push(const T *p, int n) { return n == 1 ? que.push(*p) : que.push(p, n); }
+    int pop(T *p, int n) { return n == 1 ? que.pop(*p) : que.pop(p, n); }
+};
+
+// ring size and every copy are multiple of sizeof (T), never split an element
+template <typename T, bool locked>
+struct kfifo_adapter
+{
+    struct kfifo *fifo;
+
+    explicit kfifo_adapter(unsigned int size) : fifo(kfifo_alloc(size * sizeof (T))) { }
+    ~kfifo_adapter() { kfifo_free(fifo); }
+    static const char *name() { return locked ? "kfifo_locked" : "kfifo"; }
+    static bool multi() { return locked; }
+    static bool batch() { return true; }
+
+    int push(const T *p, int n)
+    {
+        if (locked)
+            return kfifo_put(fifo, p, n * sizeof (T)) / sizeof (T);
+
+        return __kfifo_put(fifo, p, n * sizeof (T)) / sizeof (T);
+    }
+
+    int pop(T *p, int n)
+    {
+        if (locked)
+            return kfifo_get(fifo, p, n * sizeof (T)) / sizeof (T);
+
+        return __kfifo_get(fifo, p, n * sizeof (T)) / sizeof (T);
+    }
+};
+
+#ifdef QUEUE62_HAVE_BOOST
+template <typename T>
+struct boost_spsc_adapter
+{
+    boost::lockfree::spsc_queue<T> que;
+
+    explicit boost_spsc_adapter(unsigned int size) : que(size) { }
+    static const char *name() { return "boost_spsc_queue"; }
+    static bool multi() { return false; }
+    static bool batch() { return true; }
+    int push(const T *p, int n) { return n == 1 ? que.push(*p) : que.push(p, n); }
+    int pop(T *p, int n) { return n == 1 ? que.pop(*p) : que.pop(p, n); }
+};
+
+template <typename T>
+struct boost_queue_adapter
+{
+    boost::lockfree::queue<T> que;
+
+    explicit boost_queue_adapter(unsigned int size) : que(size) { }
+    static const char *name() { return "boost_queue"; }
+    static bool multi() { return true; }
+    static bool batch() { return false; }
+    int push(const T *p, int n) { return que.bounded_push(*p); }
+    int pop(T *p, int n) { return que.pop(*p); }
+};
+#endif
+
+static inline void backoff(int& spin)
+{
+    if (++spin > 64)
+    {
+        spin = 0;
+        std::this_thread::yield();
+    }
+}
+
+template <typename T, typename QUEUE>
+static double run(QUEUE& que, long total, int batch, int producers, int consumers)
+{
+    std::atomic<long> popped(0);
+    std::vector<std::thread> threads;
+    long per = total / producers;
+    auto start = std::chrono::steady_clock::now();
+
+    total = per * producers;
+    for (int i = 0; i < producers; i++)
+    {
+        threads.emplace_back([&que, per, batch]() {
+            std::vector<T> arr(batch);
+            int spin = 0;
+            long i = 0;
+
+            while (i < per)
+            {
+                int n = (int)std::min<long>(batch, per - i);
+
+                for (int k = 0; k < n; k++)
+                    arr[k] = payload<T>::make(i + k);
+
+                for (int k = 0; k < n; )
+                {
+                    int cnt = que.push(arr.data() + k, n - k);
+
+                    if (cnt == 0)
+                        backoff(spin);
+
+                    k += cnt;
+                }
+
+                i += n;
+            }
+        });
+    }
+
+    for (int i = 0; i < consumers; i++)
+    {
+        threads.emplace_back([&que, &popped, total, batch]() {
+            std::vector<T> arr(batch);
+            int spin = 0;
+            long local = 0;
+
+            while (popped.load(std::memory_order_relaxed) < total)
+            {
+                int cnt = que.pop(arr.data(), batch);
+
+                local += cnt;
+                if (cnt == 0 || local >= 256)
+                {
+                    popped += local;
+                    local = 0;
+                }
+
+                if (cnt == 0)
+                    backoff(spin);
+            }
+        });
+    }
+
+    for (auto& th : threads)
+        th.join();
+
+    std::chrono::duration<double> sec = std::chrono::steady_clock::now() - start;
+    return total / sec.count();
+}
+
+static long g_total = 1 << 20;
+static const char *g_filter = NULL;
+
+static const unsigned int CAPACITIES[] = {1024, 65536};
+static const int BATCHES[] = {1, 32};
+static const int THREADS[][2] = {{1, 1}, {2, 2}, {4, 4}, {8, 8}, {8, 2}};
+
+// csv, scaling is ops_per_sec divided by the 1:1 result of the same row group
+template <template <typename> class ADAPTER, typename T>
+static void sweep()
+{
+    const char *name = ADAPTER<T>::name();
+
+    if (g_filter && !strstr(name, g_filter))
+        return;
+
+    for (unsigned int capacity : CAPACITIES)
+    {
+        for (int batch : BATCHES)
+        {
+            double base = 0;
+
+            if (batch > 1 && !ADAPTER<T>::batch())
+                continue;
+
+            for (const auto& th : THREADS)
+            {
+                if (!ADAPTER<T>::multi() && (th[0] > 1 || th[1] > 1))
+                    continue;
+
+                ADAPTER<T> que(capacity);
+                double ops = run<T>(que, g_total, batch, th[0], th[1]);
+
+                if (base == 0)
+                    base = ops;
+
+                printf("%s,%s,%u,%d,%d,%d,%.0f,%.2f\n", name, payload<T>::name(),
+                       capacity, batch, th[0], th[1], ops, ops / base);
+                fflush(stdout);
+            }
+        }
+    }
+}
+
+template <typename T> using kfifo_lockless = kfifo_adapter<T, false>;
+template <typename T> using kfifo_locked = kfifo_adapter<T, true>;
+
+// for the types which are memcpy-able and trivially destructible
+template <typename T>
+static void sweep_trivial()
+{
+    sweep<spsc_adapter, T>();
+    sweep<mpmc_adapter, T>();
+    sweep<sharded_adapter, T>();
+    sweep<kfifo_lockless, T>();
+    sweep<kfifo_locked, T>();
+#ifdef QUEUE62_HAVE_BOOST
+    sweep<boost_spsc_adapter, T>();
+    sweep<boost_queue_adapter, T>();
+#endif
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1)
+        g_total = atol(argv[1]);
+
+    if (argc > 2)
+        g_filter = argv[2];
+
+    printf("queue,type,capacity,batch,producers,consumers,ops_per_sec,scaling\n");
+
+    sweep_trivial<int>();
+    sweep_trivial<void *>();
+    sweep_trivial<pod64>();
+
+    sweep<spsc_adapter, std::string>();
+    sweep<mpmc_adapter, std::string>();
+    sweep<sharded_adapter, std::string>();
+#ifdef QUEUE62_HAVE_BOOST
+    sweep<boost_spsc_adapter, std::string>();
+#endif
+
+    return 0;
+}
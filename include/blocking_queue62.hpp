@@ -0,0 +1,214 @@
+/*
+  Copyright (c) 2021 wujiaxu <void00@foxmail.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#pragma once
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <atomic>
+#include <chrono>
+#include <utility>
+#include "queue62.hpp"
+
+namespace { // not for user
+static constexpr int __SPIN_COUNT = 256;
+
+// the blocking side spins first, then registers itself in waiters and
+// sleeps on seq. the other side only reads waiters after each operation
+// and makes syscall only if somebody is sleeping
+struct __event
+{
+    std::atomic<unsigned int> seq;
+    std::atomic<unsigned int> waiters;
+
+    __event() : seq(0), waiters(0) { }
+};
+
+static inline void __event_notify(__event *ev)
+{
+    // pairs with waiters.fetch_add in __event_wait, or a wakeup may be lost
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (ev->waiters.load(std::memory_order_relaxed) != 0)
+    {
+        ev->seq.fetch_add(1, std::memory_order_release);
+        syscall(SYS_futex, &ev->seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+// deadline == NULL means wait forever, return false only when timeout
+template <typename F>
+static inline bool __event_wait(__event *ev, F&& try_op,
+                                const std::chrono::steady_clock::time_point *deadline)
+{
+    struct timespec ts;
+    struct timespec *pts = NULL;
+    unsigned int seq;
+
+    for (int i = 0; i < __SPIN_COUNT; i++)
+    {
+        if (try_op())
+            return true;
+
+        __cpu_relax();
+    }
+
+    for (;;)
+    {
+        if (deadline)
+        {
+            auto left = *deadline - std::chrono::steady_clock::now();
+            if (left <= std::chrono::steady_clock::duration::zero())
+                return try_op();
+
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+            ts.tv_sec = ns / 1000000000;
+            ts.tv_nsec = ns % 1000000000;
+            pts = &ts;
+        }
+
+        seq = ev->seq.load(std::memory_order_acquire);
+        ev->waiters.fetch_add(1, std::memory_order_seq_cst);
+
+        if (try_op())
+        {
+            ev->waiters.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        syscall(SYS_futex, &ev->seq, FUTEX_WAIT_PRIVATE, seq, pts, NULL, 0);
+        ev->waiters.fetch_sub(1, std::memory_order_relaxed);
+
+        if (try_op())
+            return true;
+    }
+}
+}
+
+// The blocking_queue class adds push_wait/pop_wait on top of a queue.
+// A blocked caller spins first, then sleeps on a futex. Every successful
+// push/pop through the wrapper pays one fence and one load of waiters to
+// find out whether somebody is sleeping, the queue itself stays fence-free,
+// so only the users of blocking_queue pay for it.
+// QUEUE is any queue of this library, such as spsc_queue or mpmc_queue
+template <typename QUEUE>
+class blocking_queue
+{
+public:
+    // args are passed to the constructor of QUEUE
+    template <typename... ARGS>
+    explicit blocking_queue(ARGS&&... args) : que_(std::forward<ARGS>(args)...) { }
+    blocking_queue(const blocking_queue&) = delete;
+    blocking_queue(blocking_queue&&) = delete;
+    blocking_queue& operator=(const blocking_queue&) = delete;
+    blocking_queue& operator=(blocking_queue&&) = delete;
+
+public:
+    // for the other calls, push/pop through it never wakes anybody up
+    QUEUE& queue() { return que_; }
+
+    // same as QUEUE::push, then wake up the consumers sleeping in pop_wait
+    template <typename... ARGS>
+    auto push(ARGS&&... args) -> decltype(std::declval<QUEUE&>().push(std::forward<ARGS>(args)...));
+    // same as QUEUE::pop, then wake up the producers sleeping in push_wait
+    template <typename... ARGS>
+    auto pop(ARGS&&... args) -> decltype(std::declval<QUEUE&>().pop(std::forward<ARGS>(args)...));
+
+    // same as QUEUE::commit/consume of spsc_queue, then wake up the other side
+    void commit(int n);
+    void consume(int n);
+
+    // blocking, spin a while then sleep until there is room (or data)
+    template <typename U>
+    void push_wait(U&& t);
+    template <typename U>
+    void pop_wait(U& ret);
+    template <typename U, typename Rep, typename Period>
+    bool pop_wait_for(U& ret, const std::chrono::duration<Rep, Period>& timeout);
+
+private:
+    QUEUE que_;
+    alignas(__CACHELINE_SIZE) __event not_empty_;
+    __event not_full_;
+};
+
+////
+// template inl, not for user
+template <typename QUEUE>
+template <typename... ARGS>
+auto blocking_queue<QUEUE>::push(ARGS&&... args)
+    -> decltype(std::declval<QUEUE&>().push(std::forward<ARGS>(args)...))
+{
+    auto ret = que_.push(std::forward<ARGS>(args)...);
+
+    if (ret)
+        __event_notify(&not_empty_);
+
+    return ret;
+}
+
+template <typename QUEUE>
+template <typename... ARGS>
+auto blocking_queue<QUEUE>::pop(ARGS&&... args)
+    -> decltype(std::declval<QUEUE&>().pop(std::forward<ARGS>(args)...))
+{
+    auto ret = que_.pop(std::forward<ARGS>(args)...);
+
+    if (ret)
+        __event_notify(&not_full_);
+
+    return ret;
+}
+
+template <typename QUEUE>
+void blocking_queue<QUEUE>::commit(int n)
+{
+    que_.commit(n);
+    __event_notify(&not_empty_);
+}
+
+template <typename QUEUE>
+void blocking_queue<QUEUE>::consume(int n)
+{
+    que_.consume(n);
+    __event_notify(&not_full_);
+}
+
+// a failed push leaves t untouched, so it is safe to forward t again
+template <typename QUEUE>
+template <typename U>
+void blocking_queue<QUEUE>::push_wait(U&& t)
+{
+    __event_wait(&not_full_, [this, &t]() { return this->push(std::forward<U>(t)); }, NULL);
+}
+
+template <typename QUEUE>
+template <typename U>
+void blocking_queue<QUEUE>::pop_wait(U& t)
+{
+    __event_wait(&not_empty_, [this, &t]() { return this->pop(t); }, NULL);
+}
+
+template <typename QUEUE>
+template <typename U, typename Rep, typename Period>
+bool blocking_queue<QUEUE>::pop_wait_for(U& t, const std::chrono::duration<Rep, Period>& timeout)
+{
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout);
+
+    return __event_wait(&not_empty_, [this, &t]() { return this->pop(t); }, &deadline);
+}
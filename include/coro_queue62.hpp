@@ -0,0 +1,342 @@
+/*
+  Copyright (c) 2021 wujiaxu <void00@foxmail.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#pragma once
+
+// C++20 only, the header is empty for the older standards so it can be
+// included anyway, test QUEUE62_HAVE_COROUTINE before using it
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define QUEUE62_HAVE_COROUTINE 1
+#endif
+#endif
+
+#ifdef QUEUE62_HAVE_COROUTINE
+#include <coroutine>
+#include "queue62.hpp"
+
+namespace { // not for user
+template <typename QUEUE>
+struct __coro_value;
+template <typename T>
+struct __coro_waiter;
+template <typename T>
+struct __coro_side;
+}
+
+// The coro_queue class makes a queue awaitable, for coroutines which wait
+// for an element (co_await que.async_pop()) or for room (co_await
+// que.async_push(t)) without a thread or a polling loop of their own.
+// A suspended coroutine is resumed by the thread whose push (or pop) makes
+// the queue ready, the element is handed to it first, and it runs inline
+// on that thread until it suspends again. There is no lock: the waiters of
+// each side are a lock-free stack, one thread at a time feeds them in fifo
+// order, another thread finding the side busy leaves a token and goes on.
+// push and pop which find nobody waiting cost one fence more than QUEUE.
+// QUEUE is spsc_queue, mpsc_queue or mpmc_queue. the single side of spsc
+// and mpsc MUST be one coroutine (or thread) at a time, waiting or not.
+// no coroutine may be waiting when coro_queue is destroyed
+template <typename QUEUE>
+class coro_queue
+{
+public:
+    using value_type = typename __coro_value<QUEUE>::type;
+
+    class pop_awaiter;
+    class push_awaiter;
+
+    // args are passed to the constructor of QUEUE
+    template <typename... ARGS>
+    explicit coro_queue(ARGS&&... args) : que_(std::forward<ARGS>(args)...) { }
+    coro_queue(const coro_queue&) = delete;
+    coro_queue(coro_queue&&) = delete;
+    coro_queue& operator=(const coro_queue&) = delete;
+    coro_queue& operator=(coro_queue&&) = delete;
+
+public:
+    // for the other calls, push and pop through it never resume anybody
+    QUEUE& queue() { return que_; }
+
+    // nonblocking, same as QUEUE, then resume the coroutines waiting on the
+    // other side, inline before return
+    bool push(const value_type& t);
+    bool push(value_type&& t);
+    bool pop(value_type& ret);
+
+    // co_await returns the element
+    pop_awaiter async_pop() { return pop_awaiter(this); }
+    // co_await returns when t is pushed, t is copied (or moved) at once
+    push_awaiter async_push(const value_type& t) { return push_awaiter(this, value_type(t)); }
+    push_awaiter async_push(value_type&& t) { return push_awaiter(this, std::move(t)); }
+
+private:
+    template <bool POP>
+    bool op(__coro_waiter<value_type> *w);
+    template <bool POP>
+    bool suspend(__coro_waiter<value_type> *w);
+    template <bool POP>
+    bool feed(__coro_waiter<value_type> *self);
+    template <bool POP>
+    void wake();
+
+    QUEUE que_;
+    alignas(__CACHELINE_SIZE) __coro_side<value_type> poppers_;
+    alignas(__CACHELINE_SIZE) __coro_side<value_type> pushers_;
+};
+
+namespace { // not for user
+template <typename T, unsigned int capacity>
+struct __coro_value<spsc_queue<T, capacity>> { using type = T; };
+template <typename T, unsigned int capacity>
+struct __coro_value<mpsc_queue<T, capacity>> { using type = T; };
+template <typename T, unsigned int capacity>
+struct __coro_value<mpmc_queue<T, capacity>> { using type = T; };
+
+// lives in the awaiter, value is the slot of the element to pop into or
+// to push from
+template <typename T>
+struct __coro_waiter
+{
+    std::coroutine_handle<> handle;
+    __coro_waiter *next;
+    T *value;
+};
+
+// any thread pushes its waiter to inbox, the thread holding owner moves
+// them to the private fifo and feeds them. a thread finding owner taken
+// sets pending and leaves, the owner takes another turn for it
+template <typename T>
+struct __coro_side
+{
+    std::atomic<__coro_waiter<T> *> inbox;
+    std::atomic<int> waiting;
+    std::atomic<bool> owner;
+    std::atomic<bool> pending;
+    // owner only, oldest first
+    __coro_waiter<T> *head;
+    __coro_waiter<T> *tail;
+
+    __coro_side() : inbox(NULL), waiting(0), owner(false), pending(false),
+                    head(NULL), tail(NULL) { }
+};
+}
+
+template <typename QUEUE>
+class coro_queue<QUEUE>::pop_awaiter
+{
+public:
+    explicit pop_awaiter(coro_queue *que) : que_(que) { }
+
+    bool await_ready() { return que_->pop(value_); }
+    bool await_suspend(std::coroutine_handle<> h)
+    {
+        waiter_.handle = h;
+        waiter_.value = &value_;
+        return que_->template suspend<true>(&waiter_);
+    }
+    value_type await_resume() { return std::move(value_); }
+
+private:
+    coro_queue *que_;
+    __coro_waiter<value_type> waiter_;
+    value_type value_;
+};
+
+template <typename QUEUE>
+class coro_queue<QUEUE>::push_awaiter
+{
+public:
+    push_awaiter(coro_queue *que, value_type&& t) : que_(que), value_(std::move(t)) { }
+
+    // a failed push does not move from value_
+    bool await_ready() { return que_->push(std::move(value_)); }
+    bool await_suspend(std::coroutine_handle<> h)
+    {
+        waiter_.handle = h;
+        waiter_.value = &value_;
+        return que_->template suspend<false>(&waiter_);
+    }
+    void await_resume() { }
+
+private:
+    coro_queue *que_;
+    __coro_waiter<value_type> waiter_;
+    value_type value_;
+};
+
+////
+// template inl, not for user
+template <typename QUEUE>
+bool coro_queue<QUEUE>::push(const value_type& t)
+{
+    if (!que_.push(t))
+        return false;
+
+    wake<true>();
+    return true;
+}
+
+template <typename QUEUE>
+bool coro_queue<QUEUE>::push(value_type&& t)
+{
+    if (!que_.push(std::move(t)))
+        return false;
+
+    wake<true>();
+    return true;
+}
+
+template <typename QUEUE>
+bool coro_queue<QUEUE>::pop(value_type& ret)
+{
+    if (!que_.pop(ret))
+        return false;
+
+    wake<false>();
+    return true;
+}
+
+template <typename QUEUE>
+template <bool POP>
+bool coro_queue<QUEUE>::op(__coro_waiter<value_type> *w)
+{
+    if (POP)
+        return que_.pop(*w->value);
+
+    return que_.push(std::move(*w->value));
+}
+
+// after an op of the other side
+template <typename QUEUE>
+template <bool POP>
+void coro_queue<QUEUE>::wake()
+{
+    __coro_side<value_type> *side = POP ? &poppers_ : &pushers_;
+
+    // pairs with the fence in suspend, either the waiter sees this op or
+    // this thread sees the waiter
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (side->waiting.load(std::memory_order_relaxed) > 0)
+        feed<POP>(NULL);
+}
+
+// return false if w is fed at once and the coroutine must not suspend
+template <typename QUEUE>
+template <bool POP>
+bool coro_queue<QUEUE>::suspend(__coro_waiter<value_type> *w)
+{
+    __coro_side<value_type> *side = POP ? &poppers_ : &pushers_;
+    __coro_waiter<value_type> *top = side->inbox.load(std::memory_order_relaxed);
+
+    do
+    {
+        w->next = top;
+    } while (!side->inbox.compare_exchange_weak(top, w, std::memory_order_release,
+                                                std::memory_order_relaxed));
+
+    side->waiting.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    // once w is in inbox, another thread may resume it at any time,
+    // w is only compared from now on
+    if (POP ? __queue_empty(que_, 0) : que_.full())
+        return true;
+
+    return !feed<POP>(w);
+}
+
+// return true if self is fed, the others fed are resumed here
+template <typename QUEUE>
+template <bool POP>
+bool coro_queue<QUEUE>::feed(__coro_waiter<value_type> *self)
+{
+    __coro_side<value_type> *side = POP ? &poppers_ : &pushers_;
+    __coro_waiter<value_type> *ready = NULL;
+    __coro_waiter<value_type> **last = &ready;
+    __coro_waiter<value_type> *w;
+    __coro_waiter<value_type> *next;
+    bool fed_self = false;
+    int fed = 0;
+
+    side->pending.store(true, std::memory_order_seq_cst);
+    while (!side->owner.exchange(true, std::memory_order_seq_cst))
+    {
+        __coro_waiter<value_type> *rev = NULL;
+        __coro_waiter<value_type> *rev_tail;
+
+        side->pending.store(false, std::memory_order_relaxed);
+
+        // inbox is newest first, reverse it to the end of the fifo
+        w = side->inbox.exchange(NULL, std::memory_order_acquire);
+        rev_tail = w;
+        for (; w; w = next)
+        {
+            next = w->next;
+            w->next = rev;
+            rev = w;
+        }
+
+        if (rev)
+        {
+            if (side->tail)
+                side->tail->next = rev;
+            else
+                side->head = rev;
+
+            side->tail = rev_tail;
+        }
+
+        while (side->head && op<POP>(side->head))
+        {
+            w = side->head;
+            side->head = w->next;
+            if (!side->head)
+                side->tail = NULL;
+
+            w->next = NULL;
+            *last = w;
+            last = &w->next;
+            fed++;
+        }
+
+        side->owner.store(false, std::memory_order_release);
+        // pairs with the store of pending above, either that thread takes
+        // owner or this one sees pending
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (!side->pending.load(std::memory_order_relaxed))
+            break;
+    }
+
+    if (fed == 0)
+        return false;
+
+    side->waiting.fetch_sub(fed, std::memory_order_relaxed);
+
+    for (w = ready; w; w = next)
+    {
+        next = w->next;
+        if (w == self)
+            fed_self = true;
+        else
+            w->handle.resume();
+    }
+
+    // the ops above made room (or data) for the other side
+    wake<!POP>();
+    return fed_self;
+}
+#endif
@@ -0,0 +1,122 @@
+/*
+  Copyright (c) 2021 wujiaxu <void00@foxmail.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#pragma once
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <system_error>
+#include "queue62.hpp"
+
+// The eventfd_queue class attaches an eventfd to a queue, for a consumer
+// sitting in epoll (or poll, select) which can not block in blocking_queue::pop_wait.
+// The eventfd is signaled on the empty -> non-empty transition only: push
+// makes the syscall only if the consumer has rearmed it since the last
+// signal, so there is one syscall per burst, not one per element.
+// QUEUE is any queue of this library with empty() or read_available(),
+// the consumer side (rearm) MUST be one thread at a time
+template <typename QUEUE>
+class eventfd_queue
+{
+public:
+    // args are passed to the constructor of QUEUE
+    // throw std::system_error if eventfd fails
+    template <typename... ARGS>
+    explicit eventfd_queue(ARGS&&... args);
+    ~eventfd_queue() { close(fd_); }
+    eventfd_queue(const eventfd_queue&) = delete;
+    eventfd_queue(eventfd_queue&&) = delete;
+    eventfd_queue& operator=(const eventfd_queue&) = delete;
+    eventfd_queue& operator=(eventfd_queue&&) = delete;
+
+public:
+    // nonblocking, readable (EPOLLIN) when there is something to pop
+    int fd() const { return fd_; }
+    // for the other calls, push through it never signals the eventfd
+    QUEUE& queue() { return que_; }
+
+    // same as QUEUE::push, then signal the eventfd if armed
+    template <typename... ARGS>
+    auto push(ARGS&&... args) -> decltype(std::declval<QUEUE&>().push(std::forward<ARGS>(args)...));
+    // same as QUEUE::pop
+    template <typename... ARGS>
+    auto pop(ARGS&&... args) -> decltype(std::declval<QUEUE&>().pop(std::forward<ARGS>(args)...))
+    {
+        return que_.pop(std::forward<ARGS>(args)...);
+    }
+
+    // after pop has drained the queue, clear the eventfd and arm it again
+    // return false if something was pushed meanwhile without a signal,
+    // pop it then rearm again
+    // while (!que.rearm()) { while (que.pop(t)) ...; }
+    bool rearm();
+
+private:
+    QUEUE que_;
+    alignas(__CACHELINE_SIZE) std::atomic<bool> armed_;
+    int fd_;
+};
+
+////
+// template inl, not for user
+template <typename QUEUE>
+template <typename... ARGS>
+eventfd_queue<QUEUE>::eventfd_queue(ARGS&&... args)
+    : que_(std::forward<ARGS>(args)...), armed_(true)
+{
+    fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd_ < 0)
+        throw std::system_error(errno, std::generic_category(), "queue62: eventfd");
+}
+
+template <typename QUEUE>
+template <typename... ARGS>
+auto eventfd_queue<QUEUE>::push(ARGS&&... args)
+    -> decltype(std::declval<QUEUE&>().push(std::forward<ARGS>(args)...))
+{
+    auto ret = que_.push(std::forward<ARGS>(args)...);
+
+    if (ret)
+    {
+        // pairs with the fence in rearm, either the consumer sees the
+        // element or this push sees armed
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (armed_.load(std::memory_order_relaxed) &&
+            armed_.exchange(false, std::memory_order_relaxed))
+        {
+            uint64_t one = 1;
+            ssize_t n = write(fd_, &one, sizeof (one));
+            (void)n;
+        }
+    }
+
+    return ret;
+}
+
+template <typename QUEUE>
+bool eventfd_queue<QUEUE>::rearm()
+{
+    uint64_t cnt;
+    ssize_t n = read(fd_, &cnt, sizeof (cnt));
+
+    (void)n;
+    armed_.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    // a push after the fence signals again, the eventfd stays readable
+    return __queue_empty(que_, 0);
+}
@@ -0,0 +1,301 @@
+/*
+  Copyright (c) 2021 wujiaxu <void00@foxmail.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#pragma once
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <functional>
+#include <thread>
+#include <vector>
+#include "blocking_queue62.hpp"
+
+namespace { // not for user
+template <typename F>
+struct __exec_worker;
+}
+
+// The executor class runs tasks on a fixed set of worker threads.
+// Every worker has its own spsc_queue inbox, guarded by a try-lock on the
+// producer side only. submit takes the inbox of the next worker (round robin
+// per submitting thread), and falls back to a mpmc_queue overflow shared by
+// all workers when the inbox is locked by another submitter or full.
+// A worker takes its own inbox first, then the overflow. Idle workers spin
+// a while then sleep on futex, submit only makes syscall to wake a sleeper.
+// a task in an inbox only runs on that worker, a task MUST NOT throw
+// F is any callable with no argument, default constructible and movable
+template <typename F = std::function<void ()>>
+class executor
+{
+public:
+    using task = F;
+
+    // inbox_size and overflow_size will round up to power of 2
+    explicit executor(int workers, unsigned int inbox_size = 256,
+                      unsigned int overflow_size = 4096);
+    // shutdown, then free the workers
+    ~executor();
+    executor(const executor&) = delete;
+    executor(executor&&) = delete;
+    executor& operator=(const executor&) = delete;
+    executor& operator=(executor&&) = delete;
+
+public:
+    int workers() const { return count_; }
+
+    // any thread, return false only when the inbox and the overflow are full,
+    // t is not moved from then
+    bool submit(const F& t);
+    bool submit(F&& t);
+    // batch, tasks are moved from, one inbox takes as many as it has room for
+    // and the rest go to the overflow, return the number of tasks submitted,
+    // 0 if n <= 0
+    int submit(F *tasks, int n);
+
+    // pin worker i to cpus[i % cpus.size()]
+    // return 0, or the error number of pthread_setaffinity_np
+    int pin(const std::vector<int>& cpus);
+
+    // run every task submitted before, then join the workers
+    // submit MUST NOT be called after or at the same time
+    void shutdown();
+
+private:
+    void run(__exec_worker<F> *w);
+    void release();
+
+    __mpmc_queue<F, 0> overflow_;
+    __exec_worker<F> *workers_;
+    int count_;
+    std::atomic<bool> stop_;
+};
+
+namespace { // not for user
+template <typename F>
+struct __exec_worker
+{
+    __spsc_queue<F, 0> inbox;
+    // submitters only, the worker pops without it
+    alignas(__CACHELINE_SIZE) std::atomic<bool> locked;
+    // the worker sleeps here when there is nothing to run
+    alignas(__CACHELINE_SIZE) __event ready;
+    std::thread thread;
+
+    explicit __exec_worker(unsigned int size) : inbox(size), locked(false) { }
+};
+
+// every submitting thread starts from another worker
+static inline int __exec_next(int count)
+{
+    static std::atomic<unsigned int> next(0);
+    static thread_local unsigned int hint = next.fetch_add(1, std::memory_order_relaxed);
+
+    return hint++ % count;
+}
+
+// wake at most n sleeping workers, starting from first, for the overflow.
+// same as __event_notify, but a woken worker is not woken again
+template <typename F>
+static inline void __exec_wake(__exec_worker<F> *workers, int count, int first, int n)
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    for (int i = 0; i < count && n > 0; i++)
+    {
+        __event *ev = &workers[(first + i) % count].ready;
+
+        if (ev->waiters.load(std::memory_order_relaxed) != 0)
+        {
+            ev->seq.fetch_add(1, std::memory_order_release);
+            syscall(SYS_futex, &ev->seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+            n--;
+        }
+    }
+}
+}
+
+////
+// template inl, not for user
+template <typename F>
+executor<F>::executor(int workers, unsigned int inbox_size, unsigned int overflow_size)
+    : overflow_(overflow_size), count_(0), stop_(false)
+{
+    if (workers < 1)
+        workers = 1;
+
+    workers_ = (__exec_worker<F> *)__aligned_alloc(workers * sizeof (__exec_worker<F>));
+
+    try
+    {
+        for (; count_ < workers; count_++)
+            new (workers_ + count_) __exec_worker<F>(inbox_size);
+
+        for (int i = 0; i < count_; i++)
+            workers_[i].thread = std::thread(&executor<F>::run, this, workers_ + i);
+    }
+    catch (...)
+    {
+        release();
+        throw;
+    }
+}
+
+template <typename F>
+executor<F>::~executor()
+{
+    release();
+}
+
+template <typename F>
+void executor<F>::release()
+{
+    shutdown();
+
+    for (int i = 0; i < count_; i++)
+        workers_[i].~__exec_worker<F>();
+
+    free(workers_);
+    workers_ = NULL;
+    count_ = 0;
+}
+
+template <typename F>
+bool executor<F>::submit(const F& t)
+{
+    F copy(t);
+
+    return submit(std::move(copy));
+}
+
+template <typename F>
+bool executor<F>::submit(F&& t)
+{
+    __exec_worker<F> *w = workers_ + __exec_next(count_);
+    bool done = false;
+
+    if (!w->locked.exchange(true, std::memory_order_acquire))
+    {
+        done = w->inbox.push(std::move(t));
+        w->locked.store(false, std::memory_order_release);
+    }
+
+    if (done)
+    {
+        __event_notify(&w->ready);
+        return true;
+    }
+
+    if (!overflow_.push(std::move(t)))
+        return false;
+
+    __exec_wake(workers_, count_, w - workers_, 1);
+    return true;
+}
+
+template <typename F>
+int executor<F>::submit(F *tasks, int n)
+{
+    __exec_worker<F> *w;
+    int done = 0;
+    int queued;
+
+    if (n <= 0)
+        return 0;
+
+    w = workers_ + __exec_next(count_);
+    if (!w->locked.exchange(true, std::memory_order_acquire))
+    {
+        ring_span<F> span = w->inbox.reserve(n);
+
+        for (int k = 0; k < 2; k++)
+        {
+            for (int i = 0; i < span.len[k]; i++)
+                span.data[k][i] = std::move(tasks[done++]);
+        }
+
+        w->inbox.commit(done);
+        w->locked.store(false, std::memory_order_release);
+
+        if (done > 0)
+            __event_notify(&w->ready);
+    }
+
+    queued = done;
+    while (done < n && overflow_.push(std::move(tasks[done])))
+        done++;
+
+    if (done > queued)
+        __exec_wake(workers_, count_, w - workers_, done - queued);
+
+    return done;
+}
+
+template <typename F>
+int executor<F>::pin(const std::vector<int>& cpus)
+{
+    if (cpus.empty())
+        return EINVAL;
+
+    for (int i = 0; i < count_; i++)
+    {
+        cpu_set_t set;
+        int err;
+
+        CPU_ZERO(&set);
+        CPU_SET(cpus[i % cpus.size()], &set);
+        err = pthread_setaffinity_np(workers_[i].thread.native_handle(), sizeof (set), &set);
+        if (err != 0)
+            return err;
+    }
+
+    return 0;
+}
+
+template <typename F>
+void executor<F>::shutdown()
+{
+    stop_.store(true, std::memory_order_seq_cst);
+
+    for (int i = 0; i < count_; i++)
+        __event_notify(&workers_[i].ready);
+
+    for (int i = 0; i < count_; i++)
+    {
+        if (workers_[i].thread.joinable())
+            workers_[i].thread.join();
+    }
+}
+
+template <typename F>
+void executor<F>::run(__exec_worker<F> *w)
+{
+    F t;
+    bool got;
+
+    for (;;)
+    {
+        // stop is checked last, the inbox and the overflow are drained first
+        __event_wait(&w->ready, [this, w, &t, &got]() {
+            got = w->inbox.pop(t) || overflow_.pop(t);
+            return got || stop_.load(std::memory_order_acquire);
+        }, NULL);
+
+        if (!got)
+            break;
+
+        t();
+        t = F();
+    }
+}
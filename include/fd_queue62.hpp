@@ -0,0 +1,99 @@
+/*
+  Copyright (c) 2021 wujiaxu <void00@foxmail.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#pragma once
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "queue62.hpp"
+
+// Ring-aware I/O for a byte queue, any queue of 1-byte elements with
+// reserve/commit and peek/consume: spsc_queue<char>, shm_spsc_queue<char>.
+// Data goes between the fd and the ring by one readv/writev over the (up to
+// two) regions of the ring, without a buffer in between.
+// ring_read_fd is a producer, ring_write_fd is a consumer of the queue
+
+// read at most n bytes from fd into que
+// return the number of bytes read, 0 at end of file or if n <= 0, or -1
+// with errno set by readv, or ENOBUFS if que is full
+template <typename QUEUE>
+ssize_t ring_read_fd(QUEUE& que, int fd, int n = INT_MAX);
+
+// write at most n bytes of que to fd, the written ones are removed
+// return the number of bytes written, 0 if que is empty or if n <= 0,
+// or -1 with errno set by writev
+template <typename QUEUE>
+ssize_t ring_write_fd(QUEUE& que, int fd, int n = INT_MAX);
+
+namespace { // not for user
+template <typename T>
+static inline int __span_iov(const ring_span<T>& span, struct iovec *iov)
+{
+    static_assert(sizeof (T) == 1 && std::is_trivially_copyable<T>::value,
+                  "only for the queues of bytes");
+
+    iov[0].iov_base = (void *)span.data[0];
+    iov[0].iov_len = span.len[0];
+    iov[1].iov_base = (void *)span.data[1];
+    iov[1].iov_len = span.len[1];
+    return span.len[1] > 0 ? 2 : 1;
+}
+}
+
+////
+// template inl, not for user
+template <typename QUEUE>
+ssize_t ring_read_fd(QUEUE& que, int fd, int n)
+{
+    struct iovec iov[2];
+    ssize_t ret;
+
+    if (n <= 0)
+        return 0;
+
+    auto span = que.reserve(n);
+    if (span.size() == 0)
+    {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    ret = readv(fd, iov, __span_iov(span, iov));
+    if (ret > 0)
+        que.commit(ret);
+
+    return ret;
+}
+
+template <typename QUEUE>
+ssize_t ring_write_fd(QUEUE& que, int fd, int n)
+{
+    struct iovec iov[2];
+    ssize_t ret;
+
+    if (n <= 0)
+        return 0;
+
+    auto span = que.peek(n);
+    if (span.size() == 0)
+        return 0;
+
+    ret = writev(fd, iov, __span_iov(span, iov));
+    if (ret > 0)
+        que.consume(ret);
+
+    return ret;
+}
@@ -0,0 +1,340 @@
+/*
+  Copyright (c) 2021 wujiaxu <void00@foxmail.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#pragma once
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shm_queue62.hpp"
+
+// The mmap_spsc_queue class provides a single-producer/single-consumer fifo
+// queue kept in a file, ring and indices live in a mmap'd regular file with
+// the same header as shm_spsc_queue. Reopening the file after the process
+// has exited (or crashed) gives back every element not popped yet.
+// pushing and popping is wait-free, exactly the same as spsc_queue, the
+// file is written back by the kernel. sync() is the checkpoint: what was
+// pushed and popped before it survives an OS crash or a power loss too.
+// pages may be written back in any order between checkpoints, after an OS
+// crash the elements pushed since the last one can not be trusted
+template <typename T>
+class mmap_spsc_queue
+{
+public:
+    mmap_spsc_queue() : header_(NULL), arr_(NULL), map_size_(0),
+                        sync_every_(0), error_(0), pushed_(0), popped_(0) { }
+    ~mmap_spsc_queue() { close(); }
+    mmap_spsc_queue(const mmap_spsc_queue&) = delete;
+    mmap_spsc_queue(mmap_spsc_queue&&) = delete;
+    mmap_spsc_queue& operator=(const mmap_spsc_queue&) = delete;
+    mmap_spsc_queue& operator=(mmap_spsc_queue&&) = delete;
+
+public:
+    // create the file for size elements (round up to power of 2), or reopen
+    // it with the elements still in it, size is ignored then
+    // sync_every > 0: sync() after every sync_every elements pushed (or
+    // popped) through this object, 0: only when sync() is called
+    // return false and set errno if failed
+    // EAGAIN means the creator has not finished initialization, try again
+    // (or it crashed before, remove the file)
+    // EPROTO means the file is written by another version of this header
+    bool open(const char *path, unsigned int size,
+              unsigned int sync_every = 0, mode_t mode = 0600);
+    // unmap only, nothing is lost, call sync() first for a checkpoint
+    void close();
+
+    // checkpoint, msync the ring then the indices
+    // return false and set errno if failed, EBADF if not open, or if a
+    // sync_every checkpoint failed since the last call (errno is its error)
+    bool sync();
+    // the error of the last failed sync_every checkpoint not reported by
+    // sync() yet, 0 if none
+    int last_error() const { return error_.load(std::memory_order_relaxed); }
+
+    int read_available() const;
+
+    bool push(const T& t);
+    bool pop(T& ret);
+
+    int push(const T *ret, int n);
+    int pop(T *ret, int n);
+
+    ring_span<T> reserve(int n);
+    void commit(int n);
+    ring_span<T> peek(int n);
+    void consume(int n);
+
+private:
+    bool checkpoint();
+    void pushed(int n);
+    void popped(int n);
+
+    __shm_header *header_;
+    T *arr_;
+    size_t map_size_;
+    unsigned int sync_every_;
+    std::atomic<int> error_;
+    // elements since the last sync, the producer and the consumer may use
+    // the same object from their own threads
+    alignas(__CACHELINE_SIZE) unsigned int pushed_;
+    alignas(__CACHELINE_SIZE) unsigned int popped_;
+
+    using WORKER = __spsc_worker<T, true>;
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "T MUST be trivially copyable to be kept in a file");
+};
+
+////
+// template inl, not for user
+template <typename T>
+bool mmap_spsc_queue<T>::open(const char *path, unsigned int size,
+                              unsigned int sync_every, mode_t mode)
+{
+    struct stat st;
+    // the ring starts on its own page, sync() writes it back before the header
+    size_t data_offset = sysconf(_SC_PAGESIZE);
+    size_t map_size;
+    bool creator = true;
+    void *ptr;
+    int fd;
+    int err;
+
+    close();
+    size = __round_up_power2(size, 2);
+    map_size = data_offset + (size_t)size * sizeof (T);
+
+    fd = ::open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, mode);
+    if (fd < 0 && errno == EEXIST)
+    {
+        creator = false;
+        fd = ::open(path, O_RDWR | O_CLOEXEC);
+    }
+
+    if (fd < 0)
+        return false;
+
+    if (creator)
+    {
+        // blocks allocated now, never SIGBUS on a full disk later
+        err = posix_fallocate(fd, 0, map_size);
+    }
+    else if (fstat(fd, &st) != 0)
+        err = errno;
+    else if ((size_t)st.st_size < __SHM_DATA_OFFSET)
+        err = EAGAIN;
+    else
+    {
+        map_size = st.st_size;
+        err = 0;
+    }
+
+    if (err != 0)
+    {
+        ::close(fd);
+        if (creator)
+            unlink(path);
+
+        errno = err;
+        return false;
+    }
+
+    ptr = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    err = errno;
+    ::close(fd);
+    if (ptr == MAP_FAILED)
+    {
+        if (creator)
+            unlink(path);
+
+        errno = err;
+        return false;
+    }
+
+    header_ = (__shm_header *)ptr;
+    if (creator)
+        __shm_init(header_, sizeof (T), size, data_offset);
+    else
+    {
+        // the caches of in/out are never ahead of them, nothing to recover
+        err = __shm_check(header_, sizeof (T), map_size);
+        if (err != 0)
+        {
+            munmap(ptr, map_size);
+            header_ = NULL;
+            errno = err;
+            return false;
+        }
+    }
+
+    arr_ = (T *)((char *)ptr + header_->data_offset);
+    map_size_ = map_size;
+    sync_every_ = sync_every;
+    error_ = 0;
+    pushed_ = 0;
+    popped_ = 0;
+    return true;
+}
+
+template <typename T>
+void mmap_spsc_queue<T>::close()
+{
+    if (header_)
+    {
+        munmap(header_, map_size_);
+        header_ = NULL;
+        arr_ = NULL;
+        map_size_ = 0;
+    }
+}
+
+template <typename T>
+bool mmap_spsc_queue<T>::sync()
+{
+    int err;
+
+    if (!header_)
+    {
+        errno = EBADF;
+        return false;
+    }
+
+    err = error_.exchange(0, std::memory_order_relaxed);
+    if (!checkpoint())
+        return false;
+
+    if (err != 0)
+    {
+        errno = err;
+        return false;
+    }
+
+    return true;
+}
+
+template <typename T>
+bool mmap_spsc_queue<T>::checkpoint()
+{
+    size_t off = header_->data_offset;
+
+    // the elements reach the disk before the indices pointing to them
+    if (msync(arr_, map_size_ - off, MS_SYNC) != 0)
+        return false;
+
+    return msync(header_, off, MS_SYNC) == 0;
+}
+
+// a failed checkpoint is kept for sync() and last_error()
+template <typename T>
+void mmap_spsc_queue<T>::pushed(int n)
+{
+    if (sync_every_ > 0 && (pushed_ += n) >= sync_every_)
+    {
+        pushed_ = 0;
+        if (!checkpoint())
+            error_.store(errno, std::memory_order_relaxed);
+    }
+}
+
+template <typename T>
+void mmap_spsc_queue<T>::popped(int n)
+{
+    if (sync_every_ > 0 && (popped_ += n) >= sync_every_)
+    {
+        popped_ = 0;
+        if (!checkpoint())
+            error_.store(errno, std::memory_order_relaxed);
+    }
+}
+
+template <typename T>
+int mmap_spsc_queue<T>::read_available() const
+{
+    return header_->fifo.in - header_->fifo.out;
+}
+
+template <typename T>
+bool mmap_spsc_queue<T>::push(const T& t)
+{
+    __fifo *fifo = &header_->fifo;
+
+    if (__fifo_writable(fifo, 1) == 0)
+        return false;
+
+    arr_[fifo->in.load(std::memory_order_relaxed) & fifo->mask] = t;
+
+    __spsc_commit(fifo, 1);
+    pushed(1);
+
+    return true;
+}
+
+template <typename T>
+bool mmap_spsc_queue<T>::pop(T& t)
+{
+    __fifo *fifo = &header_->fifo;
+
+    if (__fifo_readable(fifo, 1) == 0)
+        return false;
+
+    t = arr_[fifo->out.load(std::memory_order_relaxed) & fifo->mask];
+
+    __spsc_consume(fifo, 1);
+    popped(1);
+
+    return true;
+}
+
+template <typename T>
+int mmap_spsc_queue<T>::push(const T *ret, int n)
+{
+    n = WORKER::push(&header_->fifo, arr_, ret, n);
+    pushed(n);
+    return n;
+}
+
+template <typename T>
+int mmap_spsc_queue<T>::pop(T *ret, int n)
+{
+    n = WORKER::pop(&header_->fifo, arr_, ret, n);
+    popped(n);
+    return n;
+}
+
+template <typename T>
+ring_span<T> mmap_spsc_queue<T>::reserve(int n)
+{
+    return __spsc_reserve(&header_->fifo, arr_, n);
+}
+
+template <typename T>
+void mmap_spsc_queue<T>::commit(int n)
+{
+    __spsc_commit(&header_->fifo, n);
+    pushed(n);
+}
+
+template <typename T>
+ring_span<T> mmap_spsc_queue<T>::peek(int n)
+{
+    return __spsc_peek(&header_->fifo, arr_, n);
+}
+
+template <typename T>
+void mmap_spsc_queue<T>::consume(int n)
+{
+    __spsc_consume(&header_->fifo, n);
+    popped(n);
+}
@@ -15,28 +15,117 @@
 */
 #pragma once
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <atomic>
+#include <chrono>
 #include <new>
+#include <stdexcept>
+#include <type_traits>
 #include <utility>
+#ifdef QUEUE62_TRACE
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
 
 #define __CHECK_POWER_OF_2(x) ((x) > 0 && ((x) & ((x) - 1)) == 0)
+#define __CACHELINE_SIZE 64
 
 namespace { // not for user
 template <typename T, unsigned int capacity>
 class __spsc_queue;
 template <typename T, unsigned int capacity>
 class __mpmc_queue;
+template <typename T, unsigned int capacity>
+class __mpmc_seq_queue;
+template <typename T, unsigned int capacity>
+class __mpsc_queue;
+template <typename T, unsigned int capacity, bool lossy>
+class __bcast_queue;
+template <typename T, unsigned int capacity>
+class __ws_deque;
+template <typename T>
+class __seg_spsc_queue;
+template <typename T>
+class __sharded_queue;
+template <typename T, unsigned int lanes, typename LANE>
+class __prio_queue;
+
+// stored in slots directly, otherwise stored as pointer (or boxed pointer)
+template <typename T>
+struct __mpmc_inline
+{
+    static constexpr bool value = std::is_trivially_copyable<T>::value &&
+                                  !std::is_pointer<T>::value;
+};
+
+static inline void __cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    asm volatile("pause" ::: "memory");
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#else
+    asm volatile("" ::: "memory");
+#endif
+}
 }
 
+// at most two contiguous regions inside a ring,
+// the second one is not empty only when the regions wrap around
+template <typename T>
+struct ring_span
+{
+    T *data[2];
+    int len[2];
+
+    int size() const { return len[0] + len[1]; }
+};
+
+#ifdef QUEUE62_STATS
+// counters of a mpmc_queue (or mpsc_queue), only built with -DQUEUE62_STATS
+struct mpmc_stats
+{
+    uint64_t cas_attempts;   // CAS on the indices (or slots) shared by threads
+    uint64_t cas_failures;   // lost to another thread and retried
+    uint64_t push_full;      // push returned nothing because it was full
+    uint64_t pop_empty;      // pop returned nothing because it was empty
+    unsigned int high_water; // the most elements ever seen by a push
+};
+#endif
+
+#ifdef QUEUE62_TRACE
+// time from push to pop of the sampled elements (one position of every
+// QUEUE62_TRACE_SAMPLE, 64 by default), in nanoseconds.
+// spsc_queue and mpmc_queue only, only built with -DQUEUE62_TRACE
+struct queue_latency
+{
+    uint64_t count;          // elements sampled
+    double p50;
+    double p99;
+    double p999;
+    double max;
+    // (the largest value, count) of every bucket not empty, for export,
+    // buckets are 12.5% wide
+    std::vector<std::pair<double, uint64_t>> buckets;
+};
+#endif
+
 // replace boost/lockfree/spsc_queue.hpp
 // The spsc_queue class provides a single-producer/single-consumer fifo queue
 // pushing and popping is wait-free
-template <typename T, unsigned int capacity>
+// capacity == 0 means the ring is allocated on heap, sized by constructor
+template <typename T, unsigned int capacity = 0>
 class spsc_queue
 {
 public:
     spsc_queue()  { }
+    // only for capacity == 0, size will round up to power of 2
+    explicit spsc_queue(unsigned int size) : queue_(size) { }
     ~spsc_queue() { }
     spsc_queue(const spsc_queue&) = delete;
     spsc_queue(spsc_queue&&) = delete;
@@ -45,6 +134,7 @@ public:
 
 public:
     int read_available() const;
+    bool full() const;
 
     bool push(const T& t);
     bool push(T&& t);
@@ -53,6 +143,21 @@ public:
     int push(const T *ret, int n);
     int pop(T *ret, int n);
 
+    // zero-copy for producer, writable regions for at most n elements,
+    // fill them in place then commit how many were written
+    ring_span<T> reserve(int n);
+    void commit(int n);
+
+    // zero-copy for consumer, readable regions for at most n elements,
+    // use them in place then consume how many were used
+    ring_span<T> peek(int n);
+    void consume(int n);
+
+#ifdef QUEUE62_TRACE
+    // a snapshot, elements are still being recorded while reading
+    queue_latency latency() const;
+#endif
+
 private:
     __spsc_queue<T, capacity> queue_;
 };
@@ -60,11 +165,15 @@ private:
 // thread-safety multi-producer/multi-consumer circular-queue
 // The mpmc_queue class provides a multi-producers/multi-consumers fifo queue
 // pushing and popping is lock-free (NOT wait-free, implemented using CAS)
-template <typename T, unsigned int capacity>
+// capacity == 0 means the ring is allocated on heap, sized by constructor
+// trivially copyable non-pointer types are stored in slots, no new/delete
+template <typename T, unsigned int capacity = 0>
 class mpmc_queue
 {
 public:
     mpmc_queue()  { }
+    // only for capacity == 0, size will round up to power of 2
+    explicit mpmc_queue(unsigned int size) : queue_(size) { }
     ~mpmc_queue() { }
     mpmc_queue(const mpmc_queue&) = delete;
     mpmc_queue(mpmc_queue&&) = delete;
@@ -74,13 +183,319 @@ public:
 public:
     bool empty() const;
     size_t size() const;
+    // a push would fail now
+    bool full() const;
+
+    bool push(const T& t);
+    bool push(T&& t);
+    bool pop(T& ret);
+
+    // batch, each call claims a contiguous run of slots with one CAS,
+    // return the number of elements pushed/popped
+    int push(const T *ret, int n);
+    int pop(T *ret, int n);
+
+#ifdef QUEUE62_STATS
+    // a snapshot, counters are still going on while reading
+    mpmc_stats stats() const;
+#endif
+
+#ifdef QUEUE62_TRACE
+    // a snapshot, elements are still being recorded while reading
+    queue_latency latency() const;
+#endif
+
+private:
+    typename std::conditional<__mpmc_inline<T>::value,
+                              __mpmc_seq_queue<T, capacity>,
+                              __mpmc_queue<T, capacity>>::type queue_;
+};
+
+// thread-safety multi-producer/single-consumer circular-queue
+// The mpsc_queue class provides a multi-producers/single-consumer fifo queue
+// pushing is lock-free (CAS on the producer index only),
+// popping is wait-free, the consumer never makes CAS
+// capacity == 0 means the ring is allocated on heap, sized by constructor
+// any type is stored in slots directly, its move MUST NOT throw,
+// a throwing copy is made before the slot is taken
+template <typename T, unsigned int capacity = 0>
+class mpsc_queue
+{
+public:
+    mpsc_queue()  { }
+    // only for capacity == 0, size will round up to power of 2
+    explicit mpsc_queue(unsigned int size) : queue_(size) { }
+    ~mpsc_queue() { }
+    mpsc_queue(const mpsc_queue&) = delete;
+    mpsc_queue(mpsc_queue&&) = delete;
+    mpsc_queue& operator=(const mpsc_queue&) = delete;
+    mpsc_queue& operator=(mpsc_queue&&) = delete;
+
+public:
+    bool empty() const;
+    size_t size() const;
+    // a push would fail now
+    bool full() const;
+
+    bool push(const T& t);
+    bool push(T&& t);
+    bool pop(T& ret);
+
+    // batch, each push claims a contiguous run of slots with one CAS,
+    // return the number of elements pushed/popped
+    int push(const T *ret, int n);
+    int pop(T *ret, int n);
+
+#ifdef QUEUE62_STATS
+    // a snapshot, counters are still going on while reading
+    mpmc_stats stats() const;
+#endif
+
+private:
+    __mpsc_queue<T, capacity> queue_;
+};
+
+// single-producer/multi-consumer broadcast circular-queue
+// The broadcast_queue class provides a fifo queue whose every element is
+// seen by every consumer, elements are written once and read in place.
+// consumers are numbered 0 .. consumers - 1, each one has its own cursor
+// and every cursor MUST be used by only one thread at a time.
+// lossy == false: push fails when the slowest consumer is capacity behind
+// lossy == true: push never fails, a consumer falling capacity behind skips
+//                the overwritten elements, counted by dropped().
+//                T MUST be trivially copyable, reading in place is not allowed
+// pushing is wait-free, popping is wait-free when lossy == false and
+// lock-free when lossy == true: a consumer being overwritten skips at least
+// the overwritten element and retries, and may do so again as long as the
+// producer laps it
+// capacity == 0 means the ring is allocated on heap, sized by constructor
+template <typename T, unsigned int capacity = 0, bool lossy = false>
+class broadcast_queue
+{
+public:
+    explicit broadcast_queue(unsigned int consumers) : queue_(consumers) { }
+    // only for capacity == 0, size will round up to power of 2
+    broadcast_queue(unsigned int size, unsigned int consumers) : queue_(size, consumers) { }
+    ~broadcast_queue() { }
+    broadcast_queue(const broadcast_queue&) = delete;
+    broadcast_queue(broadcast_queue&&) = delete;
+    broadcast_queue& operator=(const broadcast_queue&) = delete;
+    broadcast_queue& operator=(broadcast_queue&&) = delete;
+
+public:
+    unsigned int consumers() const;
+
+    // producer
+    bool push(const T& t);
+    int push(const T *ret, int n);
+
+    // zero-copy for producer, only for lossy == false
+    ring_span<T> reserve(int n);
+    void commit(int n);
+
+    // consumer id
+    int read_available(unsigned int id) const;
+    bool pop(unsigned int id, T& ret);
+    int pop(unsigned int id, T *ret, int n);
+
+    // zero-copy for consumer id, only for lossy == false
+    ring_span<const T> peek(unsigned int id, int n);
+    void consume(unsigned int id, int n);
+
+    // elements consumer id has missed, always 0 when lossy == false
+    uint64_t dropped(unsigned int id) const;
+
+private:
+    __bcast_queue<T, capacity, lossy> queue_;
+};
+
+// Chase-Lev work-stealing deque, only for pointer types
+// The ws_deque class is owned by one worker thread, which pushes and pops
+// at the bottom (LIFO) without CAS, only a pop racing a thief for the last
+// element makes one CAS. other threads steal at the top (FIFO) with one CAS.
+// capacity == 0 means the ring is allocated on heap and doubled when full,
+// old rings are kept (thieves may still read them) until destruction
+template <typename T, unsigned int capacity = 0>
+class ws_deque
+{
+public:
+    ws_deque()  { }
+    // only for capacity == 0, initial size will round up to power of 2
+    explicit ws_deque(unsigned int size) : deque_(size) { }
+    ~ws_deque() { }
+    ws_deque(const ws_deque&) = delete;
+    ws_deque(ws_deque&&) = delete;
+    ws_deque& operator=(const ws_deque&) = delete;
+    ws_deque& operator=(ws_deque&&) = delete;
+
+public:
+    bool empty() const;
+    size_t size() const;
+
+    // owner only, push fails only when capacity != 0 and it is full
+    bool push(T t);
+    bool pop(T& ret);
+
+    // any thread, fails when empty or another thread took the element
+    bool steal(T& ret);
+
+private:
+    __ws_deque<T, capacity> deque_;
+    static_assert(std::is_pointer<T>::value, "T MUST be pointer type");
+};
+
+// single-producer/single-consumer queue without a capacity limit
+// The unbounded_spsc_queue class links fixed-size rings (segments), each one
+// works the same as spsc_queue. the producer links a new segment when the
+// last one is full, the consumer moves on when the first one is drained and
+// hands it back to the producer as a spare (at most one, others are freed).
+// pushing and popping inside a segment is wait-free, linking a segment
+// may allocate memory
+template <typename T>
+class unbounded_spsc_queue
+{
+public:
+    // segment_size will round up to power of 2
+    explicit unbounded_spsc_queue(unsigned int segment_size = 1024) : queue_(segment_size) { }
+    ~unbounded_spsc_queue() { }
+    unbounded_spsc_queue(const unbounded_spsc_queue&) = delete;
+    unbounded_spsc_queue(unbounded_spsc_queue&&) = delete;
+    unbounded_spsc_queue& operator=(const unbounded_spsc_queue&) = delete;
+    unbounded_spsc_queue& operator=(unbounded_spsc_queue&&) = delete;
+
+public:
+    // consumer only
+    bool empty() const;
+
+    // push fails only when a new segment can not be allocated
+    bool push(const T& t);
+    bool push(T&& t);
+    bool pop(T& ret);
+
+    int push(const T *ret, int n);
+    int pop(T *ret, int n);
+
+private:
+    __seg_spsc_queue<T> queue_;
+};
+
+// multi-producer/multi-consumer queue made of several mpmc_queue shards
+// The sharded_mpmc_queue class maps every thread to a home shard, so threads
+// on different shards never touch the same indices. push goes to the home
+// shard first, pop takes from the home shard first, then both go on to the
+// other shards when it is full (or empty).
+// order is FIFO only inside a shard, elements of one producer stay in order
+// as long as its home shard is not full.
+// pushing and popping is lock-free, same as mpmc_queue
+template <typename T>
+class sharded_mpmc_queue
+{
+public:
+    // size of each shard will round up to power of 2,
+    // shards == 0 means one shard for each online CPU
+    explicit sharded_mpmc_queue(unsigned int size, unsigned int shards = 0) : queue_(size, shards) { }
+    ~sharded_mpmc_queue() { }
+    sharded_mpmc_queue(const sharded_mpmc_queue&) = delete;
+    sharded_mpmc_queue(sharded_mpmc_queue&&) = delete;
+    sharded_mpmc_queue& operator=(const sharded_mpmc_queue&) = delete;
+    sharded_mpmc_queue& operator=(sharded_mpmc_queue&&) = delete;
+
+public:
+    unsigned int shards() const;
+    bool empty() const;
+    size_t size() const;
 
+    // fails only when every shard is full (or empty)
     bool push(const T& t);
     bool push(T&& t);
     bool pop(T& ret);
 
+    // batch, the home shard first, return the number of elements pushed/popped
+    int push(const T *ret, int n);
+    int pop(T *ret, int n);
+
+#ifdef QUEUE62_STATS
+    // sum of the shards, high_water is the highest shard
+    mpmc_stats stats() const;
+#endif
+
+private:
+    __sharded_queue<T> queue_;
+};
+
+// multi-producer/multi-consumer queue with priority lanes
+// The priority_mpmc_queue class holds lanes mpmc_queue rings, lane 0 is the
+// highest priority. a bitmap of non-empty lanes is kept, pop goes straight
+// to the first non-empty lane and never polls empty ones.
+// strict mode: a lower lane is popped only when every higher lane is empty
+// weighted mode: lane i is popped at most weights[i] times in each round
+//                while another lane is waiting, so no lane starves. with
+//                several consumers the weights are followed approximately.
+// pushing and popping is lock-free, same as mpmc_queue
+template <typename T, unsigned int lanes>
+class priority_mpmc_queue
+{
+public:
+    // strict mode, size of each lane will round up to power of 2
+    explicit priority_mpmc_queue(unsigned int size) : queue_(size, NULL) { }
+    // weighted mode, every weight MUST NOT be 0
+    priority_mpmc_queue(unsigned int size, const unsigned int (&weights)[lanes]) : queue_(size, weights) { }
+    ~priority_mpmc_queue() { }
+    priority_mpmc_queue(const priority_mpmc_queue&) = delete;
+    priority_mpmc_queue(priority_mpmc_queue&&) = delete;
+    priority_mpmc_queue& operator=(const priority_mpmc_queue&) = delete;
+    priority_mpmc_queue& operator=(priority_mpmc_queue&&) = delete;
+
+public:
+    bool empty() const;
+
+    bool push(unsigned int lane, const T& t);
+    bool push(unsigned int lane, T&& t);
+    int push(unsigned int lane, const T *ret, int n);
+
+    // lane is set to the lane of ret
+    bool pop(T& ret);
+    bool pop(T& ret, unsigned int& lane);
+    // batch, all of the elements come from one lane, 0 if n <= 0
+    int pop(T *ret, int n);
+
+private:
+    __prio_queue<T, lanes, typename std::conditional<__mpmc_inline<T>::value,
+                                                     __mpmc_seq_queue<T, 0>,
+                                                     __mpmc_queue<T, 0>>::type> queue_;
+};
+
+// single-consumer queue with priority lanes, each lane is a spsc_queue and
+// has at most one producer thread (producers of different lanes may differ).
+// the same bitmap and modes as priority_mpmc_queue
+// pushing and popping is wait-free
+template <typename T, unsigned int lanes>
+class priority_spsc_queue
+{
+public:
+    // strict mode, size of each lane will round up to power of 2
+    explicit priority_spsc_queue(unsigned int size) : queue_(size, NULL) { }
+    // weighted mode, every weight MUST NOT be 0
+    priority_spsc_queue(unsigned int size, const unsigned int (&weights)[lanes]) : queue_(size, weights) { }
+    ~priority_spsc_queue() { }
+    priority_spsc_queue(const priority_spsc_queue&) = delete;
+    priority_spsc_queue(priority_spsc_queue&&) = delete;
+    priority_spsc_queue& operator=(const priority_spsc_queue&) = delete;
+    priority_spsc_queue& operator=(priority_spsc_queue&&) = delete;
+
+public:
+    bool empty() const;
+
+    bool push(unsigned int lane, const T& t);
+    bool push(unsigned int lane, T&& t);
+    int push(unsigned int lane, const T *ret, int n);
+
+    bool pop(T& ret);
+    bool pop(T& ret, unsigned int& lane);
+    int pop(T *ret, int n);
+
 private:
-    __mpmc_queue<T, capacity> queue_;
+    __prio_queue<T, lanes, __spsc_queue<T, 0>> queue_;
 };
 
 ////
@@ -91,6 +506,12 @@ int spsc_queue<T, capacity>::read_available() const
     return queue_.read_available();
 }
 
+template <typename T, unsigned int capacity>
+bool spsc_queue<T, capacity>::full() const
+{
+    return queue_.full();
+}
+
 template <typename T, unsigned int capacity>
 bool spsc_queue<T, capacity>::push(const T& t)
 {
@@ -121,6 +542,38 @@ int spsc_queue<T, capacity>::pop(T *ret, int n)
     return queue_.pop(ret, n);
 }
 
+template <typename T, unsigned int capacity>
+ring_span<T> spsc_queue<T, capacity>::reserve(int n)
+{
+    return queue_.reserve(n);
+}
+
+template <typename T, unsigned int capacity>
+void spsc_queue<T, capacity>::commit(int n)
+{
+    queue_.commit(n);
+}
+
+template <typename T, unsigned int capacity>
+ring_span<T> spsc_queue<T, capacity>::peek(int n)
+{
+    return queue_.peek(n);
+}
+
+template <typename T, unsigned int capacity>
+void spsc_queue<T, capacity>::consume(int n)
+{
+    queue_.consume(n);
+}
+
+#ifdef QUEUE62_TRACE
+template <typename T, unsigned int capacity>
+queue_latency spsc_queue<T, capacity>::latency() const
+{
+    return queue_.latency();
+}
+#endif
+
 template <typename T, unsigned int capacity>
 bool mpmc_queue<T, capacity>::empty() const
 {
@@ -133,6 +586,12 @@ size_t mpmc_queue<T, capacity>::size() const
     return queue_.size();
 }
 
+template <typename T, unsigned int capacity>
+bool mpmc_queue<T, capacity>::full() const
+{
+    return queue_.full();
+}
+
 template <typename T, unsigned int capacity>
 bool mpmc_queue<T, capacity>::push(const T& t)
 {
@@ -151,246 +610,3484 @@ bool mpmc_queue<T, capacity>::pop(T& t)
     return queue_.pop(t);
 }
 
-namespace {
-struct __fifo
+template <typename T, unsigned int capacity>
+int mpmc_queue<T, capacity>::push(const T *ret, int n)
 {
-    unsigned int in;
-    unsigned int out;
-    unsigned int mask;
-    unsigned int size;
-    void *buffer;
-};
-
-template <typename T, bool is_trivial = std::is_trivial<T>::value>
-class __spsc_worker;
+    return queue_.push(ret, n);
+}
 
 template <typename T, unsigned int capacity>
-class __spsc_queue
+int mpmc_queue<T, capacity>::pop(T *ret, int n)
 {
-public:
-    __spsc_queue();
-    ~__spsc_queue() { }
-    __spsc_queue(const __spsc_queue&) = delete;
-    __spsc_queue(__spsc_queue&&) = delete;
-    __spsc_queue& operator=(const __spsc_queue&) = delete;
-    __spsc_queue& operator=(__spsc_queue&&) = delete;
-
-public:
-    int read_available() const;
-
-    bool push(const T& t);
-    bool push(T&& t);
-    bool pop(T& ret);
-
-    int push(const T *ret, int n);
-    int pop(T *ret, int n);
-
-private:
-    __fifo fifo_;
-    T arr_[capacity];
-
-    using WORKER = __spsc_worker<T, std::is_trivial<T>::value>;
-    static_assert(__CHECK_POWER_OF_2(capacity), "Capacity MUST power of 2");
-};
+    return queue_.pop(ret, n);
+}
 
+#ifdef QUEUE62_STATS
 template <typename T, unsigned int capacity>
-__spsc_queue<T, capacity>::__spsc_queue()
+mpmc_stats mpmc_queue<T, capacity>::stats() const
 {
-    fifo_.in = 0;
-    fifo_.out = 0;
-    fifo_.mask = capacity - 1;
-    fifo_.size = capacity;
-    fifo_.buffer = &arr_;
+    return queue_.stats();
 }
+#endif
 
+#ifdef QUEUE62_TRACE
 template <typename T, unsigned int capacity>
-int __spsc_queue<T, capacity>::read_available() const
+queue_latency mpmc_queue<T, capacity>::latency() const
 {
-    return fifo_.in - fifo_.out;
+    return queue_.latency();
 }
+#endif
 
 template <typename T, unsigned int capacity>
-bool __spsc_queue<T, capacity>::push(const T& t)
+bool mpsc_queue<T, capacity>::empty() const
 {
-    if (capacity - fifo_.in + fifo_.out == 0)
-        return false;
-
-    arr_[fifo_.in & (capacity - 1)] = t;
-
-    asm volatile("sfence" ::: "memory");
-
-    ++fifo_.in;
-
-    return true;
+    return queue_.empty();
 }
 
 template <typename T, unsigned int capacity>
-bool __spsc_queue<T, capacity>::push(T&& t)
+size_t mpsc_queue<T, capacity>::size() const
 {
-    if (capacity - fifo_.in + fifo_.out == 0)
-        return false;
-
-    arr_[fifo_.in & (capacity - 1)] = std::move(t);
-
-    asm volatile("sfence" ::: "memory");
-
-    ++fifo_.in;
-
-    return true;
+    return queue_.size();
 }
 
 template <typename T, unsigned int capacity>
-bool __spsc_queue<T, capacity>::pop(T& t)
+bool mpsc_queue<T, capacity>::full() const
 {
-    if (fifo_.in - fifo_.out == 0)
-        return false;
+    return queue_.full();
+}
 
-    t = std::move(arr_[fifo_.out & (capacity - 1)]);
+template <typename T, unsigned int capacity>
+bool mpsc_queue<T, capacity>::push(const T& t)
+{
+    return queue_.push(t);
+}
 
-    asm volatile("sfence" ::: "memory");
+template <typename T, unsigned int capacity>
+bool mpsc_queue<T, capacity>::push(T&& t)
+{
+    return queue_.push(std::move(t));
+}
 
-    ++fifo_.out;
+template <typename T, unsigned int capacity>
+bool mpsc_queue<T, capacity>::pop(T& t)
+{
+    return queue_.pop(t);
+}
 
-    return true;
+template <typename T, unsigned int capacity>
+int mpsc_queue<T, capacity>::push(const T *ret, int n)
+{
+    return queue_.push(ret, n);
 }
 
 template <typename T, unsigned int capacity>
-int __spsc_queue<T, capacity>::push(const T *ret, int n)
+int mpsc_queue<T, capacity>::pop(T *ret, int n)
 {
-    return WORKER::push(&fifo_, ret, n);
+    return queue_.pop(ret, n);
 }
 
+#ifdef QUEUE62_STATS
 template <typename T, unsigned int capacity>
-int __spsc_queue<T, capacity>::pop(T *ret, int n)
+mpmc_stats mpsc_queue<T, capacity>::stats() const
 {
-    return WORKER::pop(&fifo_, ret, n);
+    return queue_.stats();
 }
+#endif
 
-static inline unsigned int _min(unsigned int a, unsigned int b)
+template <typename T, unsigned int capacity, bool lossy>
+unsigned int broadcast_queue<T, capacity, lossy>::consumers() const
 {
-    return (a < b) ? a : b;
+    return queue_.consumers();
 }
 
-template <typename T>
-class __spsc_worker<T, true>
+template <typename T, unsigned int capacity, bool lossy>
+bool broadcast_queue<T, capacity, lossy>::push(const T& t)
 {
-public:
-    static int push(__fifo *fifo, const T *ret, int n)
+    return queue_.push(&t, 1) == 1;
+}
+
+template <typename T, unsigned int capacity, bool lossy>
+int broadcast_queue<T, capacity, lossy>::push(const T *ret, int n)
+{
+    return queue_.push(ret, n);
+}
+
+template <typename T, unsigned int capacity, bool lossy>
+ring_span<T> broadcast_queue<T, capacity, lossy>::reserve(int n)
+{
+    static_assert(!lossy, "reserve() is only for lossy == false");
+    return queue_.reserve(n);
+}
+
+template <typename T, unsigned int capacity, bool lossy>
+void broadcast_queue<T, capacity, lossy>::commit(int n)
+{
+    static_assert(!lossy, "commit() is only for lossy == false");
+    queue_.commit(n);
+}
+
+template <typename T, unsigned int capacity, bool lossy>
+int broadcast_queue<T, capacity, lossy>::read_available(unsigned int id) const
+{
+    return queue_.read_available(id);
+}
+
+template <typename T, unsigned int capacity, bool lossy>
+bool broadcast_queue<T, capacity, lossy>::pop(unsigned int id, T& t)
+{
+    return queue_.pop(id, &t, 1) == 1;
+}
+
+template <typename T, unsigned int capacity, bool lossy>
+int broadcast_queue<T, capacity, lossy>::pop(unsigned int id, T *ret, int n)
+{
+    return queue_.pop(id, ret, n);
+}
+
+template <typename T, unsigned int capacity, bool lossy>
+ring_span<const T> broadcast_queue<T, capacity, lossy>::peek(unsigned int id, int n)
+{
+    static_assert(!lossy, "peek() is only for lossy == false");
+    return queue_.peek(id, n);
+}
+
+template <typename T, unsigned int capacity, bool lossy>
+void broadcast_queue<T, capacity, lossy>::consume(unsigned int id, int n)
+{
+    static_assert(!lossy, "consume() is only for lossy == false");
+    queue_.consume(id, n);
+}
+
+template <typename T, unsigned int capacity, bool lossy>
+uint64_t broadcast_queue<T, capacity, lossy>::dropped(unsigned int id) const
+{
+    return queue_.dropped(id);
+}
+
+template <typename T, unsigned int capacity>
+bool ws_deque<T, capacity>::empty() const
+{
+    return deque_.size() == 0;
+}
+
+template <typename T, unsigned int capacity>
+size_t ws_deque<T, capacity>::size() const
+{
+    return deque_.size();
+}
+
+template <typename T, unsigned int capacity>
+bool ws_deque<T, capacity>::push(T t)
+{
+    return deque_.push((uint64_t)t);
+}
+
+template <typename T, unsigned int capacity>
+bool ws_deque<T, capacity>::pop(T& t)
+{
+    uint64_t ptr;
+
+    if (!deque_.pop(ptr))
+        return false;
+
+    t = (T)ptr;
+    return true;
+}
+
+template <typename T, unsigned int capacity>
+bool ws_deque<T, capacity>::steal(T& t)
+{
+    uint64_t ptr;
+
+    if (!deque_.steal(ptr))
+        return false;
+
+    t = (T)ptr;
+    return true;
+}
+
+template <typename T>
+bool unbounded_spsc_queue<T>::empty() const
+{
+    return queue_.empty();
+}
+
+template <typename T>
+bool unbounded_spsc_queue<T>::push(const T& t)
+{
+    return queue_.push(t);
+}
+
+template <typename T>
+bool unbounded_spsc_queue<T>::push(T&& t)
+{
+    return queue_.push(std::move(t));
+}
+
+template <typename T>
+bool unbounded_spsc_queue<T>::pop(T& t)
+{
+    return queue_.pop(t);
+}
+
+template <typename T>
+int unbounded_spsc_queue<T>::push(const T *ret, int n)
+{
+    return queue_.push(ret, n);
+}
+
+template <typename T>
+int unbounded_spsc_queue<T>::pop(T *ret, int n)
+{
+    return queue_.pop(ret, n);
+}
+
+template <typename T>
+unsigned int sharded_mpmc_queue<T>::shards() const
+{
+    return queue_.shards();
+}
+
+template <typename T>
+bool sharded_mpmc_queue<T>::empty() const
+{
+    return queue_.empty();
+}
+
+template <typename T>
+size_t sharded_mpmc_queue<T>::size() const
+{
+    return queue_.size();
+}
+
+template <typename T>
+bool sharded_mpmc_queue<T>::push(const T& t)
+{
+    return queue_.push(t);
+}
+
+template <typename T>
+bool sharded_mpmc_queue<T>::push(T&& t)
+{
+    return queue_.push(std::move(t));
+}
+
+template <typename T>
+bool sharded_mpmc_queue<T>::pop(T& t)
+{
+    return queue_.pop(t);
+}
+
+template <typename T>
+int sharded_mpmc_queue<T>::push(const T *ret, int n)
+{
+    return queue_.push(ret, n);
+}
+
+template <typename T>
+int sharded_mpmc_queue<T>::pop(T *ret, int n)
+{
+    return queue_.pop(ret, n);
+}
+
+#ifdef QUEUE62_STATS
+template <typename T>
+mpmc_stats sharded_mpmc_queue<T>::stats() const
+{
+    return queue_.stats();
+}
+#endif
+
+template <typename T, unsigned int lanes>
+bool priority_mpmc_queue<T, lanes>::empty() const
+{
+    return queue_.empty();
+}
+
+template <typename T, unsigned int lanes>
+bool priority_mpmc_queue<T, lanes>::push(unsigned int lane, const T& t)
+{
+    return queue_.push(lane, t);
+}
+
+template <typename T, unsigned int lanes>
+bool priority_mpmc_queue<T, lanes>::push(unsigned int lane, T&& t)
+{
+    return queue_.push(lane, std::move(t));
+}
+
+template <typename T, unsigned int lanes>
+int priority_mpmc_queue<T, lanes>::push(unsigned int lane, const T *ret, int n)
+{
+    return queue_.push(lane, ret, n);
+}
+
+template <typename T, unsigned int lanes>
+bool priority_mpmc_queue<T, lanes>::pop(T& t)
+{
+    unsigned int lane;
+
+    return queue_.pop(&t, 1, lane) == 1;
+}
+
+template <typename T, unsigned int lanes>
+bool priority_mpmc_queue<T, lanes>::pop(T& t, unsigned int& lane)
+{
+    return queue_.pop(&t, 1, lane) == 1;
+}
+
+template <typename T, unsigned int lanes>
+int priority_mpmc_queue<T, lanes>::pop(T *ret, int n)
+{
+    unsigned int lane;
+
+    return queue_.pop(ret, n, lane);
+}
+
+template <typename T, unsigned int lanes>
+bool priority_spsc_queue<T, lanes>::empty() const
+{
+    return queue_.empty();
+}
+
+template <typename T, unsigned int lanes>
+bool priority_spsc_queue<T, lanes>::push(unsigned int lane, const T& t)
+{
+    return queue_.push(lane, t);
+}
+
+template <typename T, unsigned int lanes>
+bool priority_spsc_queue<T, lanes>::push(unsigned int lane, T&& t)
+{
+    return queue_.push(lane, std::move(t));
+}
+
+template <typename T, unsigned int lanes>
+int priority_spsc_queue<T, lanes>::push(unsigned int lane, const T *ret, int n)
+{
+    return queue_.push(lane, ret, n);
+}
+
+template <typename T, unsigned int lanes>
+bool priority_spsc_queue<T, lanes>::pop(T& t)
+{
+    unsigned int lane;
+
+    return queue_.pop(&t, 1, lane) == 1;
+}
+
+template <typename T, unsigned int lanes>
+bool priority_spsc_queue<T, lanes>::pop(T& t, unsigned int& lane)
+{
+    return queue_.pop(&t, 1, lane) == 1;
+}
+
+template <typename T, unsigned int lanes>
+int priority_spsc_queue<T, lanes>::pop(T *ret, int n)
+{
+    unsigned int lane;
+
+    return queue_.pop(ret, n, lane);
+}
+
+namespace {
+#ifdef QUEUE62_TRACE
+#ifndef QUEUE62_TRACE_SAMPLE
+#define QUEUE62_TRACE_SAMPLE 64
+#endif
+static_assert(__CHECK_POWER_OF_2(QUEUE62_TRACE_SAMPLE), "QUEUE62_TRACE_SAMPLE MUST power of 2");
+
+// log-linear histogram, 8 linear buckets for each power of 2
+static constexpr unsigned int __TRACE_SUB_BITS = 3;
+static constexpr unsigned int __TRACE_SUB = 1U << __TRACE_SUB_BITS;
+static constexpr unsigned int __TRACE_BUCKETS = (64 - __TRACE_SUB_BITS + 1) * __TRACE_SUB;
+
+// only the positions which are multiple of QUEUE62_TRACE_SAMPLE are stamped,
+// so producers and consumers agree on them without talking to each other.
+// a stamp is written before its slot is published, and read before the
+// slot is given back to producers, it is never overwritten while in use
+struct __trace
+{
+    std::atomic<uint64_t> *stamps;
+    unsigned int mask;
+    unsigned int shift;
+    std::atomic<uint64_t> max;
+    std::atomic<uint64_t> buckets[__TRACE_BUCKETS];
+};
+
+// TSC, it is invariant and synchronized between cores on recent x86
+static inline uint64_t __trace_now()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t t;
+
+    asm volatile("mrs %0, cntvct_el0" : "=r"(t));
+    return t;
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// ticks of __trace_now per nanosecond, x86 measures it once (10ms)
+static inline double __trace_ticks_per_ns()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    static const double ratio = []() {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t tsc = __trace_now();
+        struct timespec ts = {0, 10000000};
+
+        nanosleep(&ts, NULL);
+        std::chrono::duration<double, std::nano> ns = std::chrono::steady_clock::now() - start;
+        return (__trace_now() - tsc) / ns.count();
+    }();
+
+    return ratio;
+#elif defined(__aarch64__)
+    uint64_t freq;
+
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(freq));
+    return freq / 1e9;
+#else
+    return 1;
+#endif
+}
+
+static inline unsigned int __trace_bucket(uint64_t v)
+{
+    unsigned int msb;
+
+    if (v < __TRACE_SUB)
+        return v;
+
+    msb = 63 - __builtin_clzll(v);
+    return (msb - __TRACE_SUB_BITS + 1) * __TRACE_SUB +
+           ((v >> (msb - __TRACE_SUB_BITS)) & (__TRACE_SUB - 1));
+}
+
+// the largest value of bucket i
+static inline uint64_t __trace_bucket_max(unsigned int i)
+{
+    unsigned int shift;
+
+    if (i < __TRACE_SUB)
+        return i;
+
+    shift = i / __TRACE_SUB - 1;
+    return ((uint64_t)(__TRACE_SUB + i % __TRACE_SUB) << shift) + ((uint64_t(1) << shift) - 1);
+}
+
+// NULL if it can not be allocated, the queue is not traced then
+static inline __trace *__trace_create(unsigned int size)
+{
+    unsigned int n = size > QUEUE62_TRACE_SAMPLE ? size / QUEUE62_TRACE_SAMPLE : 1;
+    __trace *trace = new (std::nothrow) __trace;
+
+    if (!trace)
+        return NULL;
+
+    trace->stamps = new (std::nothrow) std::atomic<uint64_t>[n];
+    if (!trace->stamps)
+    {
+        delete trace;
+        return NULL;
+    }
+
+    for (unsigned int i = 0; i < n; i++)
+        trace->stamps[i] = 0;
+
+    trace->mask = size - 1;
+    trace->shift = __builtin_ctz(QUEUE62_TRACE_SAMPLE);
+    trace->max = 0;
+    for (std::atomic<uint64_t>& b : trace->buckets)
+        b = 0;
+
+    return trace;
+}
+
+static inline void __trace_destroy(__trace *trace)
+{
+    if (trace)
+    {
+        delete[] trace->stamps;
+        delete trace;
+    }
+}
+
+// stamp the sampled positions of [pos, pos + n), before they are published
+static inline void __trace_push(__trace *trace, unsigned int pos, unsigned int n)
+{
+    unsigned int p = (pos + QUEUE62_TRACE_SAMPLE - 1) & ~(QUEUE62_TRACE_SAMPLE - 1U);
+    uint64_t now;
+
+    if (!trace || p - pos >= n)
+        return;
+
+    now = __trace_now();
+    for (; p - pos < n; p += QUEUE62_TRACE_SAMPLE)
+        trace->stamps[(p & trace->mask) >> trace->shift].store(now, std::memory_order_relaxed);
+
+    // the tagged mpmc engine publishes slots by plain stores
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+// record the sampled positions of [pos, pos + n), before they are given back
+static inline void __trace_pop(__trace *trace, unsigned int pos, unsigned int n)
+{
+    unsigned int p = (pos + QUEUE62_TRACE_SAMPLE - 1) & ~(QUEUE62_TRACE_SAMPLE - 1U);
+    uint64_t now;
+
+    if (!trace || p - pos >= n)
+        return;
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    now = __trace_now();
+    for (; p - pos < n; p += QUEUE62_TRACE_SAMPLE)
+    {
+        uint64_t stamp = trace->stamps[(p & trace->mask) >> trace->shift].load(std::memory_order_relaxed);
+        // the clock of another core may be a little behind
+        uint64_t d = now > stamp ? now - stamp : 0;
+        uint64_t old = trace->max.load(std::memory_order_relaxed);
+
+        trace->buckets[__trace_bucket(d)].fetch_add(1, std::memory_order_relaxed);
+        while (d > old && !trace->max.compare_exchange_weak(old, d, std::memory_order_relaxed))
+            ;
+    }
+}
+
+// the largest value of the bucket holding the rank-th smallest one
+static inline uint64_t __trace_quantile(const uint64_t *counts, uint64_t total, uint64_t max,
+                                        double q)
+{
+    uint64_t rank = (uint64_t)(q * total);
+    uint64_t seen = 0;
+
+    if (rank < q * total || rank == 0)
+        rank++;
+
+    for (unsigned int i = 0; i < __TRACE_BUCKETS; i++)
+    {
+        seen += counts[i];
+        if (seen >= rank)
+            return __trace_bucket_max(i) < max ? __trace_bucket_max(i) : max;
+    }
+
+    return max;
+}
+
+static inline queue_latency __trace_snapshot(const __trace *trace)
+{
+    queue_latency res = queue_latency();
+    uint64_t counts[__TRACE_BUCKETS];
+    uint64_t max;
+    double ratio;
+
+    if (!trace)
+        return res;
+
+    for (unsigned int i = 0; i < __TRACE_BUCKETS; i++)
+    {
+        counts[i] = trace->buckets[i].load(std::memory_order_relaxed);
+        res.count += counts[i];
+    }
+
+    // max is read last, it covers every element counted above
+    max = trace->max.load(std::memory_order_relaxed);
+    if (res.count == 0)
+        return res;
+
+    ratio = __trace_ticks_per_ns();
+    for (unsigned int i = 0; i < __TRACE_BUCKETS; i++)
+    {
+        if (counts[i] > 0)
+            res.buckets.emplace_back((__trace_bucket_max(i) < max ? __trace_bucket_max(i) : max) /
+                                     ratio, counts[i]);
+    }
+
+    res.p50 = __trace_quantile(counts, res.count, max, 0.5) / ratio;
+    res.p99 = __trace_quantile(counts, res.count, max, 0.99) / ratio;
+    res.p999 = __trace_quantile(counts, res.count, max, 0.999) / ratio;
+    res.max = max / ratio;
+    return res;
+}
+
+#define __TRACE_INIT(fifo) ((fifo)->trace = NULL)
+#define __TRACE_CREATE(fifo, size) ((fifo)->trace = __trace_create(size))
+#define __TRACE_DESTROY(fifo) __trace_destroy((fifo)->trace)
+#define __TRACE_PUSH(fifo, pos, n) __trace_push((fifo)->trace, (pos), (n))
+#define __TRACE_POP(fifo, pos, n) __trace_pop((fifo)->trace, (pos), (n))
+#else
+// nothing is left when tracing is off
+#define __TRACE_INIT(fifo) ((void)0)
+#define __TRACE_CREATE(fifo, size) ((void)0)
+#define __TRACE_DESTROY(fifo) ((void)0)
+#define __TRACE_PUSH(fifo, pos, n) ((void)0)
+#define __TRACE_POP(fifo, pos, n) ((void)0)
+#endif
+
+// producer and consumer indices live on their own cache lines,
+// each side keeps a private copy of the other side's index and only
+// re-reads the shared one when the ring looks full (or empty)
+struct __fifo
+{
+    unsigned int mask;
+    unsigned int size;
+    void *buffer;
+#ifdef QUEUE62_TRACE
+    // owned by __spsc_queue, shm and mmap rings are never traced,
+    // it fits in the line of buffer, the layout in shared memory is the same
+    __trace *trace;
+#endif
+
+    // producer
+    alignas(__CACHELINE_SIZE) std::atomic<unsigned int> in;
+    unsigned int out_cache;
+
+    // consumer
+    alignas(__CACHELINE_SIZE) std::atomic<unsigned int> out;
+    unsigned int in_cache;
+};
+
+static inline unsigned int _min(unsigned int a, unsigned int b)
+{
+    return (a < b) ? a : b;
+}
+
+// free slots seen by producer, refresh out_cache only if less than n
+static inline unsigned int __fifo_writable(__fifo *fifo, unsigned int n)
+{
+    unsigned int in = fifo->in.load(std::memory_order_relaxed);
+    unsigned int len = fifo->size - in + fifo->out_cache;
+
+    if (len < n)
+    {
+        fifo->out_cache = fifo->out.load(std::memory_order_acquire);
+        len = fifo->size - in + fifo->out_cache;
+    }
+
+    return len;
+}
+
+// used slots seen by consumer, refresh in_cache only if less than n
+static inline unsigned int __fifo_readable(__fifo *fifo, unsigned int n)
+{
+    unsigned int out = fifo->out.load(std::memory_order_relaxed);
+    unsigned int len = fifo->in_cache - out;
+
+    if (len < n)
+    {
+        fifo->in_cache = fifo->in.load(std::memory_order_acquire);
+        len = fifo->in_cache - out;
+    }
+
+    return len;
+}
+
+static inline void __fifo_init(__fifo *fifo, void *buffer, unsigned int size)
+{
+    fifo->in = 0;
+    fifo->out = 0;
+    fifo->in_cache = 0;
+    fifo->out_cache = 0;
+    fifo->mask = size - 1;
+    fifo->size = size;
+    fifo->buffer = buffer;
+    __TRACE_INIT(fifo);
+}
+
+template <typename T, typename FIFO>
+static inline ring_span<T> __fifo_span(FIFO *fifo, T *arr, unsigned int idx, unsigned int len)
+{
+    ring_span<T> span;
+    unsigned int l = _min(len, fifo->size - idx);
+
+    span.data[0] = arr + idx;
+    span.len[0] = l;
+    span.data[1] = arr;
+    span.len[1] = len - l;
+    return span;
+}
+
+template <typename T>
+static inline ring_span<T> __spsc_reserve(__fifo *fifo, T *arr, int n)
+{
+    unsigned int len = _min(n, __fifo_writable(fifo, n));
+
+    return __fifo_span(fifo, arr, fifo->in.load(std::memory_order_relaxed) & fifo->mask, len);
+}
+
+// the elements written before are visible to the consumer
+// which loads fifo->in with acquire
+static inline void __spsc_commit(__fifo *fifo, int n)
+{
+    __TRACE_PUSH(fifo, fifo->in.load(std::memory_order_relaxed), n);
+    fifo->in.store(fifo->in.load(std::memory_order_relaxed) + n, std::memory_order_release);
+}
+
+template <typename T>
+static inline ring_span<T> __spsc_peek(__fifo *fifo, T *arr, int n)
+{
+    unsigned int len = _min(n, __fifo_readable(fifo, n));
+
+    return __fifo_span(fifo, arr, fifo->out.load(std::memory_order_relaxed) & fifo->mask, len);
+}
+
+// the elements read before are done when the producer sees fifo->out
+static inline void __spsc_consume(__fifo *fifo, int n)
+{
+    __TRACE_POP(fifo, fifo->out.load(std::memory_order_relaxed), n);
+    fifo->out.store(fifo->out.load(std::memory_order_relaxed) + n, std::memory_order_release);
+}
+
+static inline unsigned int __round_up_power2(unsigned int v, unsigned int min)
+{
+    if (v < min)
+        v = min;
+
+    if (v > (1U << 31))
+        throw std::length_error("queue62: capacity too large");
+
+    v--;
+    v |= v >> 1;
+    v |= v >> 2;
+    v |= v >> 4;
+    v |= v >> 8;
+    v |= v >> 16;
+    return v + 1;
+}
+
+// cache line aligned, so the ring never shares a line with anything else
+static inline void *__aligned_alloc(size_t size)
+{
+    void *ptr;
+
+    if (posix_memalign(&ptr, __CACHELINE_SIZE, size) != 0)
+        throw std::bad_alloc();
+
+    return ptr;
+}
+
+template <typename T, bool is_trivial = std::is_trivial<T>::value>
+class __spsc_worker;
+
+template <typename T, unsigned int capacity>
+class __spsc_queue
+{
+public:
+    __spsc_queue();
+    ~__spsc_queue() { __TRACE_DESTROY(&fifo_); }
+    __spsc_queue(const __spsc_queue&) = delete;
+    __spsc_queue(__spsc_queue&&) = delete;
+    __spsc_queue& operator=(const __spsc_queue&) = delete;
+    __spsc_queue& operator=(__spsc_queue&&) = delete;
+
+public:
+    int read_available() const;
+    bool full() const;
+
+    bool push(const T& t);
+    bool push(T&& t);
+    bool pop(T& ret);
+
+    int push(const T *ret, int n);
+    int pop(T *ret, int n);
+
+    ring_span<T> reserve(int n);
+    void commit(int n);
+    ring_span<T> peek(int n);
+    void consume(int n);
+
+#ifdef QUEUE62_TRACE
+    queue_latency latency() const { return __trace_snapshot(fifo_.trace); }
+#endif
+
+private:
+    __fifo fifo_;
+    alignas(__CACHELINE_SIZE) T arr_[capacity];
+
+    using WORKER = __spsc_worker<T, std::is_trivial<T>::value>;
+    static_assert(__CHECK_POWER_OF_2(capacity), "Capacity MUST power of 2");
+};
+
+// heap storage, sized at runtime
+template <typename T>
+class __spsc_queue<T, 0>
+{
+public:
+    explicit __spsc_queue(unsigned int size);
+    ~__spsc_queue();
+    __spsc_queue(const __spsc_queue&) = delete;
+    __spsc_queue(__spsc_queue&&) = delete;
+    __spsc_queue& operator=(const __spsc_queue&) = delete;
+    __spsc_queue& operator=(__spsc_queue&&) = delete;
+
+public:
+    int read_available() const;
+    bool full() const;
+
+    bool push(const T& t);
+    bool push(T&& t);
+    bool pop(T& ret);
+
+    int push(const T *ret, int n);
+    int pop(T *ret, int n);
+
+    ring_span<T> reserve(int n);
+    void commit(int n);
+    ring_span<T> peek(int n);
+    void consume(int n);
+
+#ifdef QUEUE62_TRACE
+    queue_latency latency() const { return __trace_snapshot(fifo_.trace); }
+#endif
+
+private:
+    __fifo fifo_;
+
+    using WORKER = __spsc_worker<T, std::is_trivial<T>::value>;
+};
+
+template <typename T, unsigned int capacity>
+__spsc_queue<T, capacity>::__spsc_queue()
+{
+    __fifo_init(&fifo_, &arr_, capacity);
+    __TRACE_CREATE(&fifo_, capacity);
+}
+
+template <typename T, unsigned int capacity>
+int __spsc_queue<T, capacity>::read_available() const
+{
+    return fifo_.in - fifo_.out;
+}
+
+template <typename T, unsigned int capacity>
+bool __spsc_queue<T, capacity>::full() const
+{
+    return fifo_.in - fifo_.out >= fifo_.size;
+}
+
+template <typename T, unsigned int capacity>
+bool __spsc_queue<T, capacity>::push(const T& t)
+{
+    if (__fifo_writable(&fifo_, 1) == 0)
+        return false;
+
+    arr_[fifo_.in.load(std::memory_order_relaxed) & (capacity - 1)] = t;
+
+    __spsc_commit(&fifo_, 1);
+
+    return true;
+}
+
+template <typename T, unsigned int capacity>
+bool __spsc_queue<T, capacity>::push(T&& t)
+{
+    if (__fifo_writable(&fifo_, 1) == 0)
+        return false;
+
+    arr_[fifo_.in.load(std::memory_order_relaxed) & (capacity - 1)] = std::move(t);
+
+    __spsc_commit(&fifo_, 1);
+
+    return true;
+}
+
+template <typename T, unsigned int capacity>
+bool __spsc_queue<T, capacity>::pop(T& t)
+{
+    if (__fifo_readable(&fifo_, 1) == 0)
+        return false;
+
+    t = std::move(arr_[fifo_.out.load(std::memory_order_relaxed) & (capacity - 1)]);
+
+    __spsc_consume(&fifo_, 1);
+
+    return true;
+}
+
+template <typename T, unsigned int capacity>
+int __spsc_queue<T, capacity>::push(const T *ret, int n)
+{
+    return WORKER::push(&fifo_, arr_, ret, n);
+}
+
+template <typename T, unsigned int capacity>
+int __spsc_queue<T, capacity>::pop(T *ret, int n)
+{
+    return WORKER::pop(&fifo_, arr_, ret, n);
+}
+
+template <typename T, unsigned int capacity>
+ring_span<T> __spsc_queue<T, capacity>::reserve(int n)
+{
+    return __spsc_reserve(&fifo_, arr_, n);
+}
+
+template <typename T, unsigned int capacity>
+void __spsc_queue<T, capacity>::commit(int n)
+{
+    __spsc_commit(&fifo_, n);
+}
+
+template <typename T, unsigned int capacity>
+ring_span<T> __spsc_queue<T, capacity>::peek(int n)
+{
+    return __spsc_peek(&fifo_, arr_, n);
+}
+
+template <typename T, unsigned int capacity>
+void __spsc_queue<T, capacity>::consume(int n)
+{
+    __spsc_consume(&fifo_, n);
+}
+
+template <typename T>
+__spsc_queue<T, 0>::__spsc_queue(unsigned int size)
+{
+    size = __round_up_power2(size, 2);
+    T *arr = (T *)__aligned_alloc(size * sizeof (T));
+    unsigned int i = 0;
+
+    try
+    {
+        for (; i < size; i++)
+            new (arr + i) T();
+    }
+    catch (...)
+    {
+        while (i > 0)
+            arr[--i].~T();
+
+        free(arr);
+        throw;
+    }
+
+    __fifo_init(&fifo_, arr, size);
+    __TRACE_CREATE(&fifo_, size);
+}
+
+template <typename T>
+__spsc_queue<T, 0>::~__spsc_queue()
+{
+    T *arr = (T *)fifo_.buffer;
+
+    for (unsigned int i = 0; i < fifo_.size; i++)
+        arr[i].~T();
+
+    free(arr);
+    __TRACE_DESTROY(&fifo_);
+}
+
+template <typename T>
+int __spsc_queue<T, 0>::read_available() const
+{
+    return fifo_.in - fifo_.out;
+}
+
+template <typename T>
+bool __spsc_queue<T, 0>::full() const
+{
+    return fifo_.in - fifo_.out >= fifo_.size;
+}
+
+template <typename T>
+bool __spsc_queue<T, 0>::push(const T& t)
+{
+    if (__fifo_writable(&fifo_, 1) == 0)
+        return false;
+
+    ((T *)fifo_.buffer)[fifo_.in.load(std::memory_order_relaxed) & fifo_.mask] = t;
+
+    __spsc_commit(&fifo_, 1);
+
+    return true;
+}
+
+template <typename T>
+bool __spsc_queue<T, 0>::push(T&& t)
+{
+    if (__fifo_writable(&fifo_, 1) == 0)
+        return false;
+
+    ((T *)fifo_.buffer)[fifo_.in.load(std::memory_order_relaxed) & fifo_.mask] = std::move(t);
+
+    __spsc_commit(&fifo_, 1);
+
+    return true;
+}
+
+template <typename T>
+bool __spsc_queue<T, 0>::pop(T& t)
+{
+    if (__fifo_readable(&fifo_, 1) == 0)
+        return false;
+
+    t = std::move(((T *)fifo_.buffer)[fifo_.out.load(std::memory_order_relaxed) & fifo_.mask]);
+
+    __spsc_consume(&fifo_, 1);
+
+    return true;
+}
+
+template <typename T>
+int __spsc_queue<T, 0>::push(const T *ret, int n)
+{
+    return WORKER::push(&fifo_, (T *)fifo_.buffer, ret, n);
+}
+
+template <typename T>
+int __spsc_queue<T, 0>::pop(T *ret, int n)
+{
+    return WORKER::pop(&fifo_, (T *)fifo_.buffer, ret, n);
+}
+
+template <typename T>
+ring_span<T> __spsc_queue<T, 0>::reserve(int n)
+{
+    return __spsc_reserve(&fifo_, (T *)fifo_.buffer, n);
+}
+
+template <typename T>
+void __spsc_queue<T, 0>::commit(int n)
+{
+    __spsc_commit(&fifo_, n);
+}
+
+template <typename T>
+ring_span<T> __spsc_queue<T, 0>::peek(int n)
+{
+    return __spsc_peek(&fifo_, (T *)fifo_.buffer, n);
+}
+
+template <typename T>
+void __spsc_queue<T, 0>::consume(int n)
+{
+    __spsc_consume(&fifo_, n);
+}
+
+template <typename T>
+class __spsc_worker<T, true>
+{
+public:
+    static int push(__fifo *fifo, T *arr, const T *ret, int n)
+    {
+        unsigned int len = _min(n, __fifo_writable(fifo, n));
+        if (len == 0)
+            return 0;
+
+        unsigned int idx_in = fifo->in.load(std::memory_order_relaxed) & fifo->mask;
+        unsigned int l = _min(len, fifo->size - idx_in);
+
+        memcpy(arr + idx_in, ret, l * sizeof (T));
+        memcpy(arr, ret + l, (len - l) * sizeof (T));
+
+        __spsc_commit(fifo, len);
+
+        return len;
+    }
+
+    static int pop(__fifo *fifo, T *arr, T *ret, int n)
+    {
+        unsigned int len = _min(n, __fifo_readable(fifo, n));
+        if (len == 0)
+            return 0;
+
+        unsigned int idx_out = fifo->out.load(std::memory_order_relaxed) & fifo->mask;
+        unsigned int l = _min(len, fifo->size - idx_out);
+
+        memcpy(ret, arr + idx_out, l * sizeof (T));
+        memcpy(ret + l, arr, (len - l) * sizeof (T));
+
+        __spsc_consume(fifo, len);
+
+        return len;
+    }
+};
+
+template <typename T>
+class __spsc_worker<T, false>
+{
+public:
+    static int push(__fifo *fifo, T *arr, const T *ret, int n)
+    {
+        unsigned int len = _min(n, __fifo_writable(fifo, n));
+        if (len == 0)
+            return 0;
+
+        unsigned int idx_in = fifo->in.load(std::memory_order_relaxed) & fifo->mask;
+        unsigned int l = _min(len, fifo->size - idx_in);
+
+        for (unsigned int i = 0; i < l; i++)
+            arr[idx_in + i] = ret[i];
+
+        for (unsigned int i = 0; i < len - l; i++)
+            arr[i] = ret[l + i];
+
+        __spsc_commit(fifo, len);
+
+        return len;
+    }
+
+    static int pop(__fifo *fifo, T *arr, T *ret, int n)
+    {
+        unsigned int len = _min(n, __fifo_readable(fifo, n));
+        if (len == 0)
+            return 0;
+
+        unsigned int idx_out = fifo->out.load(std::memory_order_relaxed) & fifo->mask;
+        unsigned int l = _min(len, fifo->size - idx_out);
+
+        for (unsigned int i = 0; i < l; i++)
+            ret[i] = std::move(arr[idx_out + i]);
+
+        for (unsigned int i = 0; i < len - l; i++)
+            ret[l + i] = std::move(arr[i]);
+
+        __spsc_consume(fifo, len);
+
+        return len;
+    }
+};
+
+#ifdef QUEUE62_STATS
+static constexpr unsigned int __STATS_SHARDS = 16;
+
+// threads are spread over the cells, so counting is not another hot spot
+struct alignas(__CACHELINE_SIZE) __stats_cell
+{
+    std::atomic<uint64_t> cas_attempts;
+    std::atomic<uint64_t> cas_failures;
+    std::atomic<uint64_t> push_full;
+    std::atomic<uint64_t> pop_empty;
+};
+
+struct __mpmc_stats
+{
+    __stats_cell cells[__STATS_SHARDS];
+    alignas(__CACHELINE_SIZE) std::atomic<unsigned int> high_water;
+};
+
+static inline __stats_cell *__stats_local(__mpmc_stats *stats)
+{
+    static std::atomic<unsigned int> next(0);
+    static thread_local unsigned int shard = next.fetch_add(1, std::memory_order_relaxed) %
+                                             __STATS_SHARDS;
+
+    return &stats->cells[shard];
+}
+
+static inline void __stats_init(__mpmc_stats *stats)
+{
+    for (__stats_cell& c : stats->cells)
+    {
+        c.cas_attempts = 0;
+        c.cas_failures = 0;
+        c.push_full = 0;
+        c.pop_empty = 0;
+    }
+
+    stats->high_water = 0;
+}
+
+static inline bool __stats_cas(__mpmc_stats *stats, bool succ)
+{
+    __stats_cell *c = __stats_local(stats);
+
+    c->cas_attempts.fetch_add(1, std::memory_order_relaxed);
+    if (!succ)
+        c->cas_failures.fetch_add(1, std::memory_order_relaxed);
+
+    return succ;
+}
+
+// fifo->out of the tagged queue moves after its CAS, the caller clamps n
+static inline void __stats_occupancy(__mpmc_stats *stats, unsigned int n)
+{
+    unsigned int old = stats->high_water.load(std::memory_order_relaxed);
+
+    while (n > old && !stats->high_water.compare_exchange_weak(old, n, std::memory_order_relaxed))
+        ;
+}
+
+static inline mpmc_stats __stats_snapshot(const __mpmc_stats *stats)
+{
+    mpmc_stats res = {0, 0, 0, 0, 0};
+
+    for (const __stats_cell& c : stats->cells)
+    {
+        res.cas_attempts += c.cas_attempts.load(std::memory_order_relaxed);
+        res.cas_failures += c.cas_failures.load(std::memory_order_relaxed);
+        res.push_full += c.push_full.load(std::memory_order_relaxed);
+        res.pop_empty += c.pop_empty.load(std::memory_order_relaxed);
+    }
+
+    res.high_water = stats->high_water.load(std::memory_order_relaxed);
+    return res;
+}
+
+#define __STATS_INIT(fifo) __stats_init(&(fifo)->stats)
+#define __STATS_CAS(fifo, succ) __stats_cas(&(fifo)->stats, (succ))
+#define __STATS_INC(fifo, field) \
+    __stats_local(&(fifo)->stats)->field.fetch_add(1, std::memory_order_relaxed)
+#define __STATS_OCCUPANCY(fifo, n) __stats_occupancy(&(fifo)->stats, (n))
+#else
+// nothing is left when stats are off
+#define __STATS_INIT(fifo) ((void)0)
+#define __STATS_CAS(fifo, succ) (succ)
+#define __STATS_INC(fifo, field) ((void)0)
+#define __STATS_OCCUPANCY(fifo, n) ((void)0)
+#endif
+
+struct __atomic_fifo
+{
+    unsigned int mask;
+    unsigned int size;
+    uint64_t *buffer;
+    std::atomic<unsigned int> in;
+    std::atomic<unsigned int> out;
+#ifdef QUEUE62_STATS
+    __mpmc_stats stats;
+#endif
+#ifdef QUEUE62_TRACE
+    __trace *trace;
+#endif
+};
+
+template <typename T, bool is_pointer = std::is_pointer<T>::value>
+class __mpmc_worker;
+
+template <typename T, unsigned int capacity>
+class __mpmc_queue
+{
+public:
+    __mpmc_queue();
+    ~__mpmc_queue();
+    __mpmc_queue(const __mpmc_queue&) = delete;
+    __mpmc_queue(__mpmc_queue&&) = delete;
+    __mpmc_queue& operator=(const __mpmc_queue&) = delete;
+    __mpmc_queue& operator=(__mpmc_queue&&) = delete;
+
+public:
+    bool empty() const;
+    size_t size() const;
+    bool full() const;
+
+    bool push(const T& t);
+    bool push(T&& t);
+    bool pop(T& ret);
+
+    int push(const T *ret, int n);
+    int pop(T *ret, int n);
+
+#ifdef QUEUE62_STATS
+    mpmc_stats stats() const { return __stats_snapshot(&fifo_.stats); }
+#endif
+
+#ifdef QUEUE62_TRACE
+    queue_latency latency() const { return __trace_snapshot(fifo_.trace); }
+#endif
+
+private:
+    __atomic_fifo fifo_;
+    uint64_t arr_[capacity];
+
+    using WORKER = __mpmc_worker<T, std::is_pointer<T>::value>;
+    static_assert(__CHECK_POWER_OF_2(capacity), "Capacity MUST power of 2");
+    static_assert(capacity > 2, "Capacity MUST larger than 2");
+};
+
+// heap storage, sized at runtime
+template <typename T>
+class __mpmc_queue<T, 0>
+{
+public:
+    explicit __mpmc_queue(unsigned int size);
+    ~__mpmc_queue();
+    __mpmc_queue(const __mpmc_queue&) = delete;
+    __mpmc_queue(__mpmc_queue&&) = delete;
+    __mpmc_queue& operator=(const __mpmc_queue&) = delete;
+    __mpmc_queue& operator=(__mpmc_queue&&) = delete;
+
+public:
+    bool empty() const;
+    size_t size() const;
+    bool full() const;
+
+    bool push(const T& t);
+    bool push(T&& t);
+    bool pop(T& ret);
+
+    int push(const T *ret, int n);
+    int pop(T *ret, int n);
+
+#ifdef QUEUE62_STATS
+    mpmc_stats stats() const { return __stats_snapshot(&fifo_.stats); }
+#endif
+
+#ifdef QUEUE62_TRACE
+    queue_latency latency() const { return __trace_snapshot(fifo_.trace); }
+#endif
+
+private:
+    __atomic_fifo fifo_;
+
+    using WORKER = __mpmc_worker<T, std::is_pointer<T>::value>;
+};
+
+static constexpr uint64_t PTR_IN = (uint64_t(1) << 63);
+static constexpr uint64_t PTR_OUT = (uint64_t(1) << 62);
+static constexpr uint64_t PTR_EMPTY = (uint64_t(1) << 61);
+
+static inline void __mpmc_init(__atomic_fifo *fifo, uint64_t *arr, unsigned int size)
+{
+    fifo->mask = size - 1;
+    fifo->size = size;
+    fifo->buffer = arr;
+    fifo->in = 1;
+    fifo->out = 0;
+
+    arr[fifo->in] = PTR_IN;
+    arr[fifo->out] = (PTR_OUT | fifo->out);
+    for (unsigned int i = 2; i < size; i++)
+        arr[i] = (PTR_EMPTY | i);
+
+    __STATS_INIT(fifo);
+    __TRACE_INIT(fifo);
+}
+
+template <typename T, unsigned int capacity>
+__mpmc_queue<T, capacity>::__mpmc_queue()
+{
+    __mpmc_init(&fifo_, arr_, capacity);
+    __TRACE_CREATE(&fifo_, capacity);
+}
+
+template <typename T, unsigned int capacity>
+__mpmc_queue<T, capacity>::~__mpmc_queue()
+{
+    WORKER::clear(&fifo_);
+    __TRACE_DESTROY(&fifo_);
+}
+
+template <typename T, unsigned int capacity>
+bool __mpmc_queue<T, capacity>::empty() const
+{
+    return fifo_.in - fifo_.out == 1;
+}
+
+template <typename T, unsigned int capacity>
+size_t __mpmc_queue<T, capacity>::size() const
+{
+    return fifo_.in - fifo_.out - 1;
+}
+
+// two slots always hold the PTR_IN and PTR_OUT marks
+template <typename T, unsigned int capacity>
+bool __mpmc_queue<T, capacity>::full() const
+{
+    return fifo_.in - fifo_.out - 1 >= fifo_.size - 2;
+}
+
+template <typename T, unsigned int capacity>
+bool __mpmc_queue<T, capacity>::push(const T& t)
+{
+    return WORKER::push(&fifo_, t);
+}
+
+template <typename T, unsigned int capacity>
+bool __mpmc_queue<T, capacity>::push(T&& t)
+{
+    return WORKER::push(&fifo_, std::move(t));
+}
+
+template <typename T, unsigned int capacity>
+bool __mpmc_queue<T, capacity>::pop(T& t)
+{
+    return WORKER::pop(&fifo_, t);
+}
+
+template <typename T, unsigned int capacity>
+int __mpmc_queue<T, capacity>::push(const T *ret, int n)
+{
+    return WORKER::push(&fifo_, ret, n);
+}
+
+template <typename T, unsigned int capacity>
+int __mpmc_queue<T, capacity>::pop(T *ret, int n)
+{
+    return WORKER::pop(&fifo_, ret, n);
+}
+
+template <typename T>
+__mpmc_queue<T, 0>::__mpmc_queue(unsigned int size)
+{
+    size = __round_up_power2(size, 4);
+    __mpmc_init(&fifo_, (uint64_t *)__aligned_alloc(size * sizeof (uint64_t)), size);
+    __TRACE_CREATE(&fifo_, size);
+}
+
+template <typename T>
+__mpmc_queue<T, 0>::~__mpmc_queue()
+{
+    WORKER::clear(&fifo_);
+    free(fifo_.buffer);
+    __TRACE_DESTROY(&fifo_);
+}
+
+template <typename T>
+bool __mpmc_queue<T, 0>::empty() const
+{
+    return fifo_.in - fifo_.out == 1;
+}
+
+template <typename T>
+size_t __mpmc_queue<T, 0>::size() const
+{
+    return fifo_.in - fifo_.out - 1;
+}
+
+// two slots always hold the PTR_IN and PTR_OUT marks
+template <typename T>
+bool __mpmc_queue<T, 0>::full() const
+{
+    return fifo_.in - fifo_.out - 1 >= fifo_.size - 2;
+}
+
+template <typename T>
+bool __mpmc_queue<T, 0>::push(const T& t)
+{
+    return WORKER::push(&fifo_, t);
+}
+
+template <typename T>
+bool __mpmc_queue<T, 0>::push(T&& t)
+{
+    return WORKER::push(&fifo_, std::move(t));
+}
+
+template <typename T>
+bool __mpmc_queue<T, 0>::pop(T& t)
+{
+    return WORKER::pop(&fifo_, t);
+}
+
+template <typename T>
+int __mpmc_queue<T, 0>::push(const T *ret, int n)
+{
+    return WORKER::push(&fifo_, ret, n);
+}
+
+template <typename T>
+int __mpmc_queue<T, 0>::pop(T *ret, int n)
+{
+    return WORKER::pop(&fifo_, ret, n);
+}
+
+static inline bool __mpmc_push(__atomic_fifo *fifo, void *ptr)
+{
+    unsigned int cur;
+    unsigned int next;
+    uint64_t *pNext;
+
+    do
+    {
+        cur = fifo->in;
+        next = cur + 1;
+        pNext = fifo->buffer + (next & fifo->mask);
+        if ((*pNext) & PTR_OUT)
+        {
+            __STATS_INC(fifo, push_full);
+            return false;
+        }
+
+    } while (!__STATS_CAS(fifo, __sync_bool_compare_and_swap(pNext, PTR_EMPTY | next, PTR_IN)));
+
+    __STATS_OCCUPANCY(fifo, _min(cur - fifo->out, fifo->size - 2));
+
+    __TRACE_PUSH(fifo, cur, 1);
+    fifo->buffer[cur & fifo->mask] = (uint64_t)ptr;
+    ++fifo->in;
+    return true;
+}
+
+static inline bool __mpmc_pop(__atomic_fifo *fifo, uint64_t& res)
+{
+    unsigned int cur;
+    unsigned int next;
+    uint64_t *pNext;
+    uint64_t ptr;
+
+    do
+    {
+        cur = fifo->out;
+        next = cur + 1;
+        pNext = fifo->buffer + (next & fifo->mask);
+        ptr = *pNext;
+        if (ptr == PTR_IN)
+        {
+            __STATS_INC(fifo, pop_empty);
+            return false;
+        }
+
+    } while (!__STATS_CAS(fifo, __sync_bool_compare_and_swap(fifo->buffer + (cur & fifo->mask),
+                                                             PTR_OUT | cur,
+                                                             PTR_EMPTY | (cur + fifo->size))));
+
+    __TRACE_POP(fifo, next, 1);
+    *pNext = (PTR_OUT | next);
+    ++fifo->out;
+    res = ptr;
+    return true;
+}
+
+static inline bool __mpmc_try_push(__atomic_fifo *fifo, unsigned int& res)
+{
+    unsigned int cur;
+    unsigned int next;
+    uint64_t *pNext;
+
+    do
+    {
+        cur = fifo->in;
+        next = cur + 1;
+        pNext = fifo->buffer + (next & fifo->mask);
+        if ((*pNext) & PTR_OUT)
+        {
+            __STATS_INC(fifo, push_full);
+            return false;
+        }
+
+    } while (!__STATS_CAS(fifo, __sync_bool_compare_and_swap(pNext, PTR_EMPTY | next, PTR_IN)));
+
+    __STATS_OCCUPANCY(fifo, _min(cur - fifo->out, fifo->size - 2));
+
+    res = cur;
+    return true;
+}
+
+static inline void __mpmc_push_rollback(__atomic_fifo *fifo, unsigned int cur)
+{
+    fifo->buffer[(cur + 1) & fifo->mask] = (PTR_EMPTY | (cur + 1));
+}
+
+// claim at most n slots from cur with one CAS.
+// the CAS marks slot cur + 1 as PTR_IN, no other producer can go on until
+// fifo->in is moved, so the following free slots are owned by plain loads
+static inline unsigned int __mpmc_try_push_bulk(__atomic_fifo *fifo,
+                                                unsigned int n,
+                                                unsigned int& res)
+{
+    unsigned int cur;
+    unsigned int next;
+    unsigned int len;
+    uint64_t *pNext;
+
+    do
+    {
+        cur = fifo->in;
+        next = cur + 1;
+        pNext = fifo->buffer + (next & fifo->mask);
+        if (__atomic_load_n(pNext, __ATOMIC_ACQUIRE) & PTR_OUT)
+        {
+            __STATS_INC(fifo, push_full);
+            return 0;
+        }
+
+    } while (!__STATS_CAS(fifo, __sync_bool_compare_and_swap(pNext, PTR_EMPTY | next, PTR_IN)));
+
+    len = 1;
+    while (len < n && __atomic_load_n(fifo->buffer + ((next + len) & fifo->mask),
+                                      __ATOMIC_ACQUIRE) == (PTR_EMPTY | (next + len)))
+        len++;
+
+    __STATS_OCCUPANCY(fifo, _min(cur + len - fifo->out, fifo->size - 2));
+
+    res = cur;
+    return len;
+}
+
+// PTR_IN always moves ahead before the slot behind it is filled,
+// so consumers never read a slot in the run which is not filled yet
+template <typename P>
+static inline void __mpmc_push_bulk_commit(__atomic_fifo *fifo, unsigned int cur,
+                                           const P *ptr, unsigned int len)
+{
+    __TRACE_PUSH(fifo, cur, len);
+    for (unsigned int i = 0; i < len; i++)
+    {
+        if (i > 0)
+            __atomic_store_n(fifo->buffer + ((cur + i + 1) & fifo->mask),
+                             PTR_IN, __ATOMIC_RELEASE);
+
+        __atomic_store_n(fifo->buffer + ((cur + i) & fifo->mask),
+                         (uint64_t)ptr[i], __ATOMIC_RELEASE);
+    }
+
+    fifo->in += len;
+}
+
+// read at most n filled slots after fifo->out, then take them all by the
+// CAS on the PTR_OUT slot, which is the same one as __mpmc_pop
+template <typename P>
+static inline unsigned int __mpmc_pop_bulk(__atomic_fifo *fifo, P *res, unsigned int n)
+{
+    unsigned int cur;
+    unsigned int len;
+    uint64_t ptr;
+
+    do
+    {
+        cur = fifo->out;
+        for (len = 0; len < n; len++)
+        {
+            ptr = __atomic_load_n(fifo->buffer + ((cur + 1 + len) & fifo->mask),
+                                  __ATOMIC_ACQUIRE);
+            if (ptr == PTR_IN)
+                break;
+
+            res[len] = (P)ptr;
+        }
+
+        if (len == 0)
+        {
+            __STATS_INC(fifo, pop_empty);
+            return 0;
+        }
+
+    } while (!__STATS_CAS(fifo, __sync_bool_compare_and_swap(fifo->buffer + (cur & fifo->mask),
+                                                             PTR_OUT | cur,
+                                                             PTR_EMPTY | (cur + fifo->size))));
+
+    __TRACE_POP(fifo, cur + 1, len);
+    for (unsigned int i = 1; i < len; i++)
+        __atomic_store_n(fifo->buffer + ((cur + i) & fifo->mask),
+                         PTR_EMPTY | (cur + i + fifo->size), __ATOMIC_RELEASE);
+
+    __atomic_store_n(fifo->buffer + ((cur + len) & fifo->mask),
+                     PTR_OUT | (cur + len), __ATOMIC_RELEASE);
+    fifo->out += len;
+    return len;
+}
+
+template <typename T>
+class __mpmc_worker<T, true>
+{
+public:
+    static bool push(__atomic_fifo *fifo, const T& t)
+    {
+        return __mpmc_push(fifo, t);
+    }
+
+    static bool push(__atomic_fifo *fifo, T&& t)
+    {
+        return __mpmc_push(fifo, t);
+    }
+
+    static bool pop(__atomic_fifo *fifo, T& t)
+    {
+        uint64_t ptr;
+        bool succ = __mpmc_pop(fifo, ptr);
+
+        if (succ)
+            t = (T)ptr;
+
+        return succ;
+    }
+
+    static int push(__atomic_fifo *fifo, const T *ret, int n)
+    {
+        unsigned int cur;
+        unsigned int len;
+
+        if (n <= 0)
+            return 0;
+
+        len = __mpmc_try_push_bulk(fifo, n, cur);
+        if (len > 0)
+            __mpmc_push_bulk_commit(fifo, cur, ret, len);
+
+        return len;
+    }
+
+    static int pop(__atomic_fifo *fifo, T *ret, int n)
+    {
+        if (n <= 0)
+            return 0;
+
+        return __mpmc_pop_bulk(fifo, ret, n);
+    }
+
+    static void clear(__atomic_fifo *fifo) { }
+};
+
+template <typename T>
+class __Holder
+{
+public:
+    __Holder(const T& t) : val(t) { }
+    __Holder(T&& t) : val(std::move(t)) { }
+
+public:
+    T val;
+};
+
+// free blocks of __holder_pool, a magazine is a list of them,
+// only the head of a magazine uses next_mag and count
+struct __pool_node
+{
+    __pool_node *next;
+    __pool_node *next_mag;
+    unsigned int count;
+};
+
+// every thread keeps a magazine of free holders, so new/delete of holders
+// never reach malloc in steady state. a full magazine goes to a shared
+// lock-free stack, an empty one is refilled from there (or from a new chunk).
+// chunks are never freed, so a stale next_mag read by pop_mag() is harmless,
+// and ABA is solved by a counter in the high 16 bits of the stack head
+template <typename T>
+class __holder_pool
+{
+    static constexpr unsigned int MAG_SIZE = 64;
+    static constexpr size_t BLOCK_ALIGN = alignof (__Holder<T>) > alignof (__pool_node) ?
+                                          alignof (__Holder<T>) : alignof (__pool_node);
+    static constexpr size_t BLOCK_SIZE = ((sizeof (__Holder<T>) > sizeof (__pool_node) ?
+                                           sizeof (__Holder<T>) : sizeof (__pool_node)) +
+                                          BLOCK_ALIGN - 1) / BLOCK_ALIGN * BLOCK_ALIGN;
+    // user space pointers fit in the low 48 bits (x86_64 with 4-level paging,
+    // aarch64 with 48-bit VA and no pointer tags), the counter takes the rest
+    static constexpr uint64_t PTR_MASK = (uint64_t(1) << 48) - 1;
+    static_assert(sizeof (void *) <= sizeof (uint64_t), "pointer does not fit the stack head");
+
+    // a static queue may free holders after the thread_local cache of its
+    // thread is destroyed, then the shared stack is used directly
+    struct cache
+    {
+        __pool_node *head = NULL;
+        unsigned int count = 0;
+
+        ~cache()
+        {
+            if (head)
+            {
+                head->count = count;
+                push_mag(head);
+            }
+
+            head = NULL;
+            count = 0;
+            gone() = true;
+        }
+    };
+
+public:
+    template <typename... ARGS>
+    static __Holder<T> *create(ARGS&&... args)
+    {
+        void *block = alloc();
+
+        if (!block)
+            return NULL;
+
+        try
+        {
+            return new (block) __Holder<T>(std::forward<ARGS>(args)...);
+        }
+        catch (...)
+        {
+            dealloc(block);
+            throw;
+        }
+    }
+
+    static void destroy(__Holder<T> *p)
+    {
+        p->~__Holder<T>();
+        dealloc(p);
+    }
+
+private:
+    // NULL once the cache of this thread is destroyed
+    static cache *local()
+    {
+        if (gone())
+            return NULL;
+
+        static thread_local cache c;
+        return &c;
+    }
+
+    // trivially destructible, still valid after the cache is destroyed
+    static bool& gone()
+    {
+        static thread_local bool g = false;
+        return g;
+    }
+
+    static std::atomic<uint64_t>& shared()
+    {
+        static std::atomic<uint64_t> head(0);
+        return head;
+    }
+
+    // every chunk starts with a pointer to the previous chunk
+    static std::atomic<void *>& chunks()
+    {
+        static std::atomic<void *> head(NULL);
+        return head;
+    }
+
+    static void push_mag(__pool_node *mag)
+    {
+        std::atomic<uint64_t>& head = shared();
+        uint64_t old = head.load(std::memory_order_relaxed);
+        uint64_t val;
+
+        do
+        {
+            mag->next_mag = (__pool_node *)(old & PTR_MASK);
+            val = (uint64_t)mag | ((old & ~PTR_MASK) + (PTR_MASK + 1));
+        } while (!head.compare_exchange_weak(old, val, std::memory_order_release,
+                                             std::memory_order_relaxed));
+    }
+
+    static __pool_node *pop_mag()
+    {
+        std::atomic<uint64_t>& head = shared();
+        uint64_t old = head.load(std::memory_order_acquire);
+        __pool_node *mag;
+        uint64_t val;
+
+        do
+        {
+            mag = (__pool_node *)(old & PTR_MASK);
+            if (!mag)
+                return NULL;
+
+            val = (uint64_t)mag->next_mag | ((old & ~PTR_MASK) + (PTR_MASK + 1));
+        } while (!head.compare_exchange_weak(old, val, std::memory_order_acquire,
+                                             std::memory_order_acquire));
+
+        return mag;
+    }
+
+    static __pool_node *new_mag()
+    {
+        size_t offset = (sizeof (void *) + BLOCK_ALIGN - 1) / BLOCK_ALIGN * BLOCK_ALIGN;
+        char *chunk = new (std::nothrow) char[offset + BLOCK_SIZE * MAG_SIZE + BLOCK_ALIGN];
+        void *prev;
+
+        if (!chunk)
+            return NULL;
+
+        prev = chunks().load(std::memory_order_relaxed);
+        do
+        {
+            *(void **)chunk = prev;
+        } while (!chunks().compare_exchange_weak(prev, chunk));
+
+        // new char[] is only aligned to alignof (max_align_t)
+        char *base = chunk + offset;
+        base += (BLOCK_ALIGN - (uintptr_t)base % BLOCK_ALIGN) % BLOCK_ALIGN;
+
+        for (unsigned int i = 0; i < MAG_SIZE; i++)
+            ((__pool_node *)(base + i * BLOCK_SIZE))->next =
+                i + 1 < MAG_SIZE ? (__pool_node *)(base + (i + 1) * BLOCK_SIZE) : NULL;
+
+        ((__pool_node *)base)->count = MAG_SIZE;
+        return (__pool_node *)base;
+    }
+
+    static void *alloc()
+    {
+        cache *c = local();
+        __pool_node *node;
+
+        if (!c)
+            return alloc_shared();
+
+        if (!c->head)
+        {
+            c->head = pop_mag();
+            if (!c->head)
+                c->head = new_mag();
+
+            if (!c->head)
+                return NULL;
+
+            c->count = c->head->count;
+        }
+
+        node = c->head;
+        c->head = node->next;
+        c->count--;
+        return node;
+    }
+
+    // keep at most 2 magazines locally, give back one when exceeded
+    static void dealloc(void *block)
+    {
+        cache *c = local();
+        __pool_node *node = (__pool_node *)block;
+
+        if (!c)
+            return dealloc_shared(node);
+
+        node->next = c->head;
+        c->head = node;
+        if (++c->count < MAG_SIZE * 2)
+            return;
+
+        __pool_node *mag = c->head;
+        __pool_node *tail = mag;
+
+        for (unsigned int i = 1; i < MAG_SIZE; i++)
+            tail = tail->next;
+
+        c->head = tail->next;
+        c->count -= MAG_SIZE;
+        tail->next = NULL;
+        mag->count = MAG_SIZE;
+        push_mag(mag);
+    }
+
+    // without a cache, take one block of a magazine and give back the rest
+    static void *alloc_shared()
+    {
+        __pool_node *mag = pop_mag();
+
+        if (!mag)
+            mag = new_mag();
+
+        if (!mag)
+            return NULL;
+
+        if (mag->next)
+        {
+            mag->next->count = mag->count - 1;
+            push_mag(mag->next);
+        }
+
+        return mag;
+    }
+
+    // without a cache, the block goes back as a magazine of its own
+    static void dealloc_shared(__pool_node *node)
+    {
+        node->next = NULL;
+        node->count = 1;
+        push_mag(node);
+    }
+};
+
+template <typename T>
+class __mpmc_worker<T, false>
+{
+    static constexpr unsigned int BULK_CHUNK = 64;
+
+public:
+    static bool push(__atomic_fifo *fifo, const T& t)
+    {
+        unsigned int cur;
+
+        if (!__mpmc_try_push(fifo, cur))
+            return false;
+
+        auto *p = __holder_pool<T>::create(t);
+
+        if (!p)
+        {
+            __mpmc_push_rollback(fifo, cur);
+            return false;
+        }
+
+        __TRACE_PUSH(fifo, cur, 1);
+        fifo->buffer[cur & fifo->mask] = (uint64_t)p;
+        ++fifo->in;
+        return true;
+    }
+
+    static bool push(__atomic_fifo *fifo, T&& t)
+    {
+        unsigned int cur;
+
+        if (!__mpmc_try_push(fifo, cur))
+            return false;
+
+        auto *p = __holder_pool<T>::create(std::move(t));
+
+        if (!p)
+        {
+            __mpmc_push_rollback(fifo, cur);
+            return false;
+        }
+
+        __TRACE_PUSH(fifo, cur, 1);
+        fifo->buffer[cur & fifo->mask] = (uint64_t)p;
+        ++fifo->in;
+        return true;
+    }
+
+    static bool pop(__atomic_fifo *fifo, T& t)
+    {
+        uint64_t ptr;
+
+        if (!__mpmc_pop(fifo, ptr))
+            return false;
+
+        auto *p = (__Holder<T> *)(ptr);
+
+        t = std::move(p->val);
+        __holder_pool<T>::destroy(p);
+        return true;
+    }
+
+    // holders are allocated before claiming, the ones not used are freed
+    static int push(__atomic_fifo *fifo, const T *ret, int n)
+    {
+        __Holder<T> *arr[BULK_CHUNK];
+        unsigned int cur;
+        unsigned int cnt;
+        unsigned int len;
+        int total = 0;
+
+        while (total < n)
+        {
+            cnt = _min(n - total, BULK_CHUNK);
+            for (len = 0; len < cnt; len++)
+            {
+                arr[len] = __holder_pool<T>::create(ret[total + len]);
+                if (!arr[len])
+                    break;
+            }
+
+            cnt = len;
+            len = cnt > 0 ? __mpmc_try_push_bulk(fifo, cnt, cur) : 0;
+            if (len > 0)
+                __mpmc_push_bulk_commit(fifo, cur, arr, len);
+
+            for (unsigned int i = len; i < cnt; i++)
+                __holder_pool<T>::destroy(arr[i]);
+
+            total += len;
+            if (len < BULK_CHUNK)
+                break;
+        }
+
+        return total;
+    }
+
+    static int pop(__atomic_fifo *fifo, T *ret, int n)
+    {
+        __Holder<T> *arr[BULK_CHUNK];
+        unsigned int len;
+        int total = 0;
+
+        while (total < n)
+        {
+            len = __mpmc_pop_bulk(fifo, arr, _min(n - total, BULK_CHUNK));
+            for (unsigned int i = 0; i < len; i++)
+            {
+                ret[total + i] = std::move(arr[i]->val);
+                __holder_pool<T>::destroy(arr[i]);
+            }
+
+            total += len;
+            if (len < BULK_CHUNK)
+                break;
+        }
+
+        return total;
+    }
+
+    static void clear(__atomic_fifo *fifo)
+    {
+        uint64_t ptr;
+
+        while (__mpmc_pop(fifo, ptr))
+            __holder_pool<T>::destroy((__Holder<T> *)(ptr));
+    }
+};
+
+// every slot has a sequence number instead of PTR_IN/PTR_OUT/PTR_EMPTY tag,
+// slot of position pos is writable when seq == pos,
+// and readable when seq == pos + 1
+template <typename T>
+struct __seq_slot
+{
+    std::atomic<unsigned int> seq;
+    typename std::aligned_storage<sizeof (T), alignof (T)>::type val;
+};
+
+template <typename T>
+struct __seq_fifo
+{
+    unsigned int mask;
+    unsigned int size;
+    __seq_slot<T> *buffer;
+
+    alignas(__CACHELINE_SIZE) std::atomic<unsigned int> in;
+    alignas(__CACHELINE_SIZE) std::atomic<unsigned int> out;
+#ifdef QUEUE62_STATS
+    __mpmc_stats stats;
+#endif
+#ifdef QUEUE62_TRACE
+    __trace *trace;
+#endif
+};
+
+template <typename T>
+static inline void __seq_init(__seq_fifo<T> *fifo, __seq_slot<T> *arr, unsigned int size)
+{
+    fifo->mask = size - 1;
+    fifo->size = size;
+    fifo->buffer = arr;
+    fifo->in = 0;
+    fifo->out = 0;
+
+    for (unsigned int i = 0; i < size; i++)
+        new (&arr[i].seq) std::atomic<unsigned int>(i);
+
+    __STATS_INIT(fifo);
+    __TRACE_INIT(fifo);
+}
+
+template <typename T, typename U>
+static inline bool __seq_push(__seq_fifo<T> *fifo, U&& t)
+{
+    unsigned int cur = fifo->in.load(std::memory_order_relaxed);
+    __seq_slot<T> *slot;
+    int diff;
+
+    do
+    {
+        slot = fifo->buffer + (cur & fifo->mask);
+        diff = (int)(slot->seq.load(std::memory_order_acquire) - cur);
+        if (diff < 0)
+        {
+            __STATS_INC(fifo, push_full);
+            return false;
+        }
+
+        if (diff > 0)
+            cur = fifo->in.load(std::memory_order_relaxed);
+
+    } while (diff > 0 || !__STATS_CAS(fifo, fifo->in.compare_exchange_weak(cur, cur + 1,
+                                                                          std::memory_order_relaxed)));
+
+    __STATS_OCCUPANCY(fifo, cur + 1 - fifo->out.load(std::memory_order_relaxed));
+
+    new (&slot->val) T(std::forward<U>(t));
+    __TRACE_PUSH(fifo, cur, 1);
+    slot->seq.store(cur + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T>
+static inline bool __seq_pop(__seq_fifo<T> *fifo, T& t)
+{
+    unsigned int cur = fifo->out.load(std::memory_order_relaxed);
+    __seq_slot<T> *slot;
+    int diff;
+
+    do
+    {
+        slot = fifo->buffer + (cur & fifo->mask);
+        diff = (int)(slot->seq.load(std::memory_order_acquire) - (cur + 1));
+        if (diff < 0)
+        {
+            __STATS_INC(fifo, pop_empty);
+            return false;
+        }
+
+        if (diff > 0)
+            cur = fifo->out.load(std::memory_order_relaxed);
+
+    } while (diff > 0 || !__STATS_CAS(fifo, fifo->out.compare_exchange_weak(cur, cur + 1,
+                                                                           std::memory_order_relaxed)));
+
+    memcpy(&t, &slot->val, sizeof (T));
+    __TRACE_POP(fifo, cur, 1);
+    slot->seq.store(cur + fifo->size, std::memory_order_release);
+    return true;
+}
+
+// check the slots from cur one by one, the ready ones are taken with one CAS
+template <typename T>
+static inline int __seq_push_bulk(__seq_fifo<T> *fifo, const T *ret, int n)
+{
+    unsigned int cur = fifo->in.load(std::memory_order_relaxed);
+    unsigned int len;
+    int diff;
+
+    if (n <= 0)
+        return 0;
+
+    do
+    {
+        for (len = 0; len < (unsigned int)n; len++)
+        {
+            diff = (int)(fifo->buffer[(cur + len) & fifo->mask].seq.load(std::memory_order_acquire) -
+                         (cur + len));
+            if (diff != 0)
+                break;
+        }
+
+        if (len == 0)
+        {
+            if (diff < 0)
+            {
+                __STATS_INC(fifo, push_full);
+                return 0;
+            }
+
+            cur = fifo->in.load(std::memory_order_relaxed);
+        }
+
+    } while (len == 0 || !__STATS_CAS(fifo, fifo->in.compare_exchange_weak(cur, cur + len,
+                                                                          std::memory_order_relaxed)));
+
+    __STATS_OCCUPANCY(fifo, cur + len - fifo->out.load(std::memory_order_relaxed));
+
+    __TRACE_PUSH(fifo, cur, len);
+    for (unsigned int i = 0; i < len; i++)
+    {
+        __seq_slot<T> *slot = fifo->buffer + ((cur + i) & fifo->mask);
+
+        new (&slot->val) T(ret[i]);
+        slot->seq.store(cur + i + 1, std::memory_order_release);
+    }
+
+    return len;
+}
+
+template <typename T>
+static inline int __seq_pop_bulk(__seq_fifo<T> *fifo, T *ret, int n)
+{
+    unsigned int cur = fifo->out.load(std::memory_order_relaxed);
+    unsigned int len;
+    int diff;
+
+    if (n <= 0)
+        return 0;
+
+    do
+    {
+        for (len = 0; len < (unsigned int)n; len++)
+        {
+            diff = (int)(fifo->buffer[(cur + len) & fifo->mask].seq.load(std::memory_order_acquire) -
+                         (cur + len + 1));
+            if (diff != 0)
+                break;
+        }
+
+        if (len == 0)
+        {
+            if (diff < 0)
+            {
+                __STATS_INC(fifo, pop_empty);
+                return 0;
+            }
+
+            cur = fifo->out.load(std::memory_order_relaxed);
+        }
+
+    } while (len == 0 || !__STATS_CAS(fifo, fifo->out.compare_exchange_weak(cur, cur + len,
+                                                                           std::memory_order_relaxed)));
+
+    __TRACE_POP(fifo, cur, len);
+    for (unsigned int i = 0; i < len; i++)
+    {
+        __seq_slot<T> *slot = fifo->buffer + ((cur + i) & fifo->mask);
+
+        memcpy(ret + i, &slot->val, sizeof (T));
+        slot->seq.store(cur + i + fifo->size, std::memory_order_release);
+    }
+
+    return len;
+}
+
+template <typename T, unsigned int capacity>
+class __mpmc_seq_queue
+{
+public:
+    __mpmc_seq_queue();
+    ~__mpmc_seq_queue() { __TRACE_DESTROY(&fifo_); }
+    __mpmc_seq_queue(const __mpmc_seq_queue&) = delete;
+    __mpmc_seq_queue(__mpmc_seq_queue&&) = delete;
+    __mpmc_seq_queue& operator=(const __mpmc_seq_queue&) = delete;
+    __mpmc_seq_queue& operator=(__mpmc_seq_queue&&) = delete;
+
+public:
+    bool empty() const;
+    size_t size() const;
+    bool full() const;
+
+    bool push(const T& t) { return __seq_push(&fifo_, t); }
+    bool pop(T& ret) { return __seq_pop(&fifo_, ret); }
+
+    int push(const T *ret, int n) { return __seq_push_bulk(&fifo_, ret, n); }
+    int pop(T *ret, int n) { return __seq_pop_bulk(&fifo_, ret, n); }
+
+#ifdef QUEUE62_STATS
+    mpmc_stats stats() const { return __stats_snapshot(&fifo_.stats); }
+#endif
+
+#ifdef QUEUE62_TRACE
+    queue_latency latency() const { return __trace_snapshot(fifo_.trace); }
+#endif
+
+private:
+    __seq_fifo<T> fifo_;
+    __seq_slot<T> arr_[capacity];
+
+    static_assert(__CHECK_POWER_OF_2(capacity), "Capacity MUST power of 2");
+};
+
+// heap storage, sized at runtime
+template <typename T>
+class __mpmc_seq_queue<T, 0>
+{
+public:
+    explicit __mpmc_seq_queue(unsigned int size);
+    ~__mpmc_seq_queue();
+    __mpmc_seq_queue(const __mpmc_seq_queue&) = delete;
+    __mpmc_seq_queue(__mpmc_seq_queue&&) = delete;
+    __mpmc_seq_queue& operator=(const __mpmc_seq_queue&) = delete;
+    __mpmc_seq_queue& operator=(__mpmc_seq_queue&&) = delete;
+
+public:
+    bool empty() const;
+    size_t size() const;
+    bool full() const;
+
+    bool push(const T& t) { return __seq_push(&fifo_, t); }
+    bool pop(T& ret) { return __seq_pop(&fifo_, ret); }
+
+    int push(const T *ret, int n) { return __seq_push_bulk(&fifo_, ret, n); }
+    int pop(T *ret, int n) { return __seq_pop_bulk(&fifo_, ret, n); }
+
+#ifdef QUEUE62_STATS
+    mpmc_stats stats() const { return __stats_snapshot(&fifo_.stats); }
+#endif
+
+#ifdef QUEUE62_TRACE
+    queue_latency latency() const { return __trace_snapshot(fifo_.trace); }
+#endif
+
+private:
+    __seq_fifo<T> fifo_;
+};
+
+template <typename T, unsigned int capacity>
+__mpmc_seq_queue<T, capacity>::__mpmc_seq_queue()
+{
+    __seq_init(&fifo_, arr_, capacity);
+    __TRACE_CREATE(&fifo_, capacity);
+}
+
+template <typename T, unsigned int capacity>
+bool __mpmc_seq_queue<T, capacity>::empty() const
+{
+    return fifo_.in == fifo_.out;
+}
+
+template <typename T, unsigned int capacity>
+size_t __mpmc_seq_queue<T, capacity>::size() const
+{
+    return fifo_.in - fifo_.out;
+}
+
+template <typename T, unsigned int capacity>
+bool __mpmc_seq_queue<T, capacity>::full() const
+{
+    return fifo_.in - fifo_.out >= fifo_.size;
+}
+
+template <typename T>
+__mpmc_seq_queue<T, 0>::__mpmc_seq_queue(unsigned int size)
+{
+    size = __round_up_power2(size, 2);
+    __seq_init(&fifo_, (__seq_slot<T> *)__aligned_alloc(size * sizeof (__seq_slot<T>)), size);
+    __TRACE_CREATE(&fifo_, size);
+}
+
+template <typename T>
+__mpmc_seq_queue<T, 0>::~__mpmc_seq_queue()
+{
+    free(fifo_.buffer);
+    __TRACE_DESTROY(&fifo_);
+}
+
+template <typename T>
+bool __mpmc_seq_queue<T, 0>::empty() const
+{
+    return fifo_.in == fifo_.out;
+}
+
+template <typename T>
+size_t __mpmc_seq_queue<T, 0>::size() const
+{
+    return fifo_.in - fifo_.out;
+}
+
+template <typename T>
+bool __mpmc_seq_queue<T, 0>::full() const
+{
+    return fifo_.in - fifo_.out >= fifo_.size;
+}
+
+// a slot is claimed before T is constructed in it, a constructor throwing
+// there would leave a slot never ready and wedge the consumer. so T is
+// constructed in place only if that can not throw, otherwise it is built
+// outside the ring first, then moved in with a noexcept move
+template <typename T, typename U>
+static inline bool __mpsc_push(__seq_fifo<T> *fifo, U&& t, std::true_type)
+{
+    return __seq_push(fifo, std::forward<U>(t));
+}
+
+template <typename T, typename U>
+static inline bool __mpsc_push(__seq_fifo<T> *fifo, U&& t, std::false_type)
+{
+    static_assert(std::is_nothrow_move_constructible<T>::value,
+                  "mpsc_queue: T MUST be nothrow move constructible");
+
+    if (fifo->in.load(std::memory_order_relaxed) - fifo->out.load(std::memory_order_relaxed) >=
+        fifo->size)
     {
-        unsigned int len = _min(n, fifo->size - fifo->in + fifo->out);
-        if (len == 0)
-            return 0;
+        __STATS_INC(fifo, push_full);
+        return false;
+    }
+
+    T tmp(std::forward<U>(t));
+    return __seq_push(fifo, std::move(tmp));
+}
+
+template <typename T, typename U>
+static inline bool __mpsc_push(__seq_fifo<T> *fifo, U&& t)
+{
+    return __mpsc_push(fifo, std::forward<U>(t),
+                       std::integral_constant<bool, std::is_nothrow_constructible<T, U&&>::value>());
+}
+
+// the slots of a bulk are claimed together, one by one for a throwing copy
+template <typename T>
+static inline int __mpsc_push_bulk(__seq_fifo<T> *fifo, const T *ret, int n)
+{
+    int len;
+
+    if (std::is_nothrow_copy_constructible<T>::value)
+        return __seq_push_bulk(fifo, ret, n);
+
+    for (len = 0; len < n; len++)
+    {
+        if (!__mpsc_push(fifo, ret[len]))
+            break;
+    }
+
+    return len;
+}
+
+// the only consumer owns fifo->out, so it is loaded and stored without CAS
+template <typename T>
+static inline bool __mpsc_pop(__seq_fifo<T> *fifo, T& t)
+{
+    unsigned int cur = fifo->out.load(std::memory_order_relaxed);
+    __seq_slot<T> *slot = fifo->buffer + (cur & fifo->mask);
+    T *p = (T *)&slot->val;
+
+    if (slot->seq.load(std::memory_order_acquire) != cur + 1)
+    {
+        __STATS_INC(fifo, pop_empty);
+        return false;
+    }
+
+    t = std::move(*p);
+    p->~T();
+    slot->seq.store(cur + fifo->size, std::memory_order_release);
+    fifo->out.store(cur + 1, std::memory_order_relaxed);
+    return true;
+}
+
+template <typename T>
+static inline int __mpsc_pop_bulk(__seq_fifo<T> *fifo, T *ret, int n)
+{
+    unsigned int cur = fifo->out.load(std::memory_order_relaxed);
+    int len;
+
+    for (len = 0; len < n; len++)
+    {
+        __seq_slot<T> *slot = fifo->buffer + ((cur + len) & fifo->mask);
+        T *p = (T *)&slot->val;
+
+        if (slot->seq.load(std::memory_order_acquire) != cur + len + 1)
+            break;
+
+        ret[len] = std::move(*p);
+        p->~T();
+        slot->seq.store(cur + len + fifo->size, std::memory_order_release);
+    }
+
+    if (len == 0)
+        __STATS_INC(fifo, pop_empty);
+
+    fifo->out.store(cur + len, std::memory_order_relaxed);
+    return len;
+}
+
+// called by destructor, no producer is running
+template <typename T>
+static inline void __mpsc_clear(__seq_fifo<T> *fifo)
+{
+    unsigned int cur = fifo->out.load(std::memory_order_relaxed);
+
+    if (std::is_trivially_destructible<T>::value)
+        return;
+
+    for (; cur != fifo->in.load(std::memory_order_relaxed); cur++)
+        ((T *)&fifo->buffer[cur & fifo->mask].val)->~T();
+}
+
+template <typename T, unsigned int capacity>
+class __mpsc_queue
+{
+public:
+    __mpsc_queue();
+    ~__mpsc_queue();
+    __mpsc_queue(const __mpsc_queue&) = delete;
+    __mpsc_queue(__mpsc_queue&&) = delete;
+    __mpsc_queue& operator=(const __mpsc_queue&) = delete;
+    __mpsc_queue& operator=(__mpsc_queue&&) = delete;
+
+public:
+    bool empty() const;
+    size_t size() const;
+    bool full() const;
+
+    bool push(const T& t) { return __mpsc_push(&fifo_, t); }
+    bool push(T&& t) { return __mpsc_push(&fifo_, std::move(t)); }
+    bool pop(T& ret) { return __mpsc_pop(&fifo_, ret); }
+
+    int push(const T *ret, int n) { return __mpsc_push_bulk(&fifo_, ret, n); }
+    int pop(T *ret, int n) { return __mpsc_pop_bulk(&fifo_, ret, n); }
+
+#ifdef QUEUE62_STATS
+    mpmc_stats stats() const { return __stats_snapshot(&fifo_.stats); }
+#endif
+
+private:
+    __seq_fifo<T> fifo_;
+    __seq_slot<T> arr_[capacity];
+
+    static_assert(__CHECK_POWER_OF_2(capacity), "Capacity MUST power of 2");
+};
+
+// heap storage, sized at runtime
+template <typename T>
+class __mpsc_queue<T, 0>
+{
+public:
+    explicit __mpsc_queue(unsigned int size);
+    ~__mpsc_queue();
+    __mpsc_queue(const __mpsc_queue&) = delete;
+    __mpsc_queue(__mpsc_queue&&) = delete;
+    __mpsc_queue& operator=(const __mpsc_queue&) = delete;
+    __mpsc_queue& operator=(__mpsc_queue&&) = delete;
+
+public:
+    bool empty() const;
+    size_t size() const;
+    bool full() const;
+
+    bool push(const T& t) { return __mpsc_push(&fifo_, t); }
+    bool push(T&& t) { return __mpsc_push(&fifo_, std::move(t)); }
+    bool pop(T& ret) { return __mpsc_pop(&fifo_, ret); }
+
+    int push(const T *ret, int n) { return __mpsc_push_bulk(&fifo_, ret, n); }
+    int pop(T *ret, int n) { return __mpsc_pop_bulk(&fifo_, ret, n); }
+
+#ifdef QUEUE62_STATS
+    mpmc_stats stats() const { return __stats_snapshot(&fifo_.stats); }
+#endif
+
+private:
+    __seq_fifo<T> fifo_;
+};
+
+template <typename T, unsigned int capacity>
+__mpsc_queue<T, capacity>::__mpsc_queue()
+{
+    __seq_init(&fifo_, arr_, capacity);
+}
+
+template <typename T, unsigned int capacity>
+__mpsc_queue<T, capacity>::~__mpsc_queue()
+{
+    __mpsc_clear(&fifo_);
+}
+
+template <typename T, unsigned int capacity>
+bool __mpsc_queue<T, capacity>::empty() const
+{
+    return fifo_.in == fifo_.out;
+}
+
+template <typename T, unsigned int capacity>
+size_t __mpsc_queue<T, capacity>::size() const
+{
+    return fifo_.in - fifo_.out;
+}
+
+template <typename T, unsigned int capacity>
+bool __mpsc_queue<T, capacity>::full() const
+{
+    return fifo_.in - fifo_.out >= fifo_.size;
+}
+
+template <typename T>
+__mpsc_queue<T, 0>::__mpsc_queue(unsigned int size)
+{
+    size = __round_up_power2(size, 2);
+    __seq_init(&fifo_, (__seq_slot<T> *)__aligned_alloc(size * sizeof (__seq_slot<T>)), size);
+}
+
+template <typename T>
+__mpsc_queue<T, 0>::~__mpsc_queue()
+{
+    __mpsc_clear(&fifo_);
+    free(fifo_.buffer);
+}
+
+template <typename T>
+bool __mpsc_queue<T, 0>::empty() const
+{
+    return fifo_.in == fifo_.out;
+}
+
+template <typename T>
+size_t __mpsc_queue<T, 0>::size() const
+{
+    return fifo_.in - fifo_.out;
+}
+
+template <typename T>
+bool __mpsc_queue<T, 0>::full() const
+{
+    return fifo_.in - fifo_.out >= fifo_.size;
+}
+
+// every consumer cursor is on its own cache line, in_cache is its private
+// copy of the producer index, the same as __fifo
+struct alignas(__CACHELINE_SIZE) __bcast_cursor
+{
+    std::atomic<unsigned int> out;
+    unsigned int in_cache;
+    std::atomic<uint64_t> dropped;
+};
+
+// out_cache is where the slowest cursor was, last seen by the producer
+struct __bcast_fifo
+{
+    unsigned int mask;
+    unsigned int size;
+    void *buffer;
+    __bcast_cursor *cursors;
+    unsigned int consumers;
+
+    alignas(__CACHELINE_SIZE) std::atomic<unsigned int> in;
+    unsigned int out_cache;
+};
+
+static inline void __bcast_init(__bcast_fifo *fifo, void *buffer, unsigned int size,
+                                unsigned int consumers)
+{
+    if (consumers == 0)
+        throw std::length_error("broadcast_queue needs at least one consumer");
+
+    fifo->mask = size - 1;
+    fifo->size = size;
+    fifo->buffer = buffer;
+    fifo->cursors = (__bcast_cursor *)__aligned_alloc(consumers * sizeof (__bcast_cursor));
+    fifo->consumers = consumers;
+    fifo->in = 0;
+    fifo->out_cache = 0;
+
+    for (unsigned int i = 0; i < consumers; i++)
+        new (&fifo->cursors[i]) __bcast_cursor();
+}
+
+static inline unsigned int __bcast_writable(__bcast_fifo *fifo, unsigned int n)
+{
+    unsigned int in = fifo->in.load(std::memory_order_relaxed);
+    unsigned int len = fifo->size - (in - fifo->out_cache);
+
+    if (len >= n)
+        return len;
+
+    unsigned int lag = 0;
+
+    for (unsigned int i = 0; i < fifo->consumers; i++)
+    {
+        unsigned int l = in - fifo->cursors[i].out.load(std::memory_order_acquire);
+
+        if (l > lag)
+            lag = l;
+    }
+
+    fifo->out_cache = in - lag;
+    return fifo->size - lag;
+}
+
+static inline unsigned int __bcast_readable(__bcast_fifo *fifo, __bcast_cursor *c, unsigned int n)
+{
+    unsigned int out = c->out.load(std::memory_order_relaxed);
+    unsigned int len = c->in_cache - out;
+
+    if (len >= n)
+        return len;
+
+    c->in_cache = fifo->in.load(std::memory_order_acquire);
+    return c->in_cache - out;
+}
+
+// the seq of a slot is 2 * (pos + 1) after pos is written,
+// and it is odd while the producer is overwriting it
+template <typename T>
+struct __bcast_slot
+{
+    std::atomic<unsigned int> seq;
+    T val;
+};
+
+template <typename T, bool lossy>
+class __bcast_worker;
+
+// the producer is gated by the slowest cursor
+template <typename T>
+class __bcast_worker<T, false>
+{
+public:
+    using slot_type = T;
+
+    static int push(__bcast_fifo *fifo, T *arr, const T *ret, int n)
+    {
+        unsigned int in = fifo->in.load(std::memory_order_relaxed);
+        unsigned int len = n > 0 ? _min(n, __bcast_writable(fifo, n)) : 0;
+
+        for (unsigned int i = 0; i < len; i++)
+            arr[(in + i) & fifo->mask] = ret[i];
+
+        fifo->in.store(in + len, std::memory_order_release);
+        return len;
+    }
+
+    static int pop(__bcast_fifo *fifo, T *arr, unsigned int id, T *ret, int n)
+    {
+        __bcast_cursor *c = fifo->cursors + id;
+        unsigned int out = c->out.load(std::memory_order_relaxed);
+        unsigned int len = n > 0 ? _min(n, __bcast_readable(fifo, c, n)) : 0;
+
+        for (unsigned int i = 0; i < len; i++)
+            ret[i] = arr[(out + i) & fifo->mask];
+
+        c->out.store(out + len, std::memory_order_release);
+        return len;
+    }
+
+    static ring_span<T> reserve(__bcast_fifo *fifo, T *arr, int n)
+    {
+        unsigned int len = n > 0 ? _min(n, __bcast_writable(fifo, n)) : 0;
+
+        return __fifo_span(fifo, arr, fifo->in.load(std::memory_order_relaxed) & fifo->mask, len);
+    }
+
+    static void commit(__bcast_fifo *fifo, int n)
+    {
+        fifo->in.store(fifo->in.load(std::memory_order_relaxed) + n, std::memory_order_release);
+    }
+
+    static ring_span<const T> peek(__bcast_fifo *fifo, T *arr, unsigned int id, int n)
+    {
+        __bcast_cursor *c = fifo->cursors + id;
+        unsigned int len = n > 0 ? _min(n, __bcast_readable(fifo, c, n)) : 0;
+
+        return __fifo_span(fifo, (const T *)arr,
+                           c->out.load(std::memory_order_relaxed) & fifo->mask, len);
+    }
+
+    static void consume(__bcast_fifo *fifo, unsigned int id, int n)
+    {
+        __bcast_cursor *c = fifo->cursors + id;
+
+        c->out.store(c->out.load(std::memory_order_relaxed) + n, std::memory_order_release);
+    }
+};
+
+// the producer never waits, a consumer checks the seq of a slot before and
+// after copying it out, the same as a seqlock
+template <typename T>
+class __bcast_worker<T, true>
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "T MUST be trivially copyable when lossy");
+
+public:
+    using slot_type = __bcast_slot<T>;
+
+    static int push(__bcast_fifo *fifo, slot_type *arr, const T *ret, int n)
+    {
+        unsigned int in = fifo->in.load(std::memory_order_relaxed);
+
+        for (int i = 0; i < n; i++)
+        {
+            slot_type *slot = arr + ((in + i) & fifo->mask);
+
+            slot->seq.store(2 * (in + i) + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            memcpy(&slot->val, ret + i, sizeof (T));
+            slot->seq.store(2 * (in + i + 1), std::memory_order_release);
+        }
+
+        fifo->in.store(in + (n > 0 ? n : 0), std::memory_order_release);
+        return n > 0 ? n : 0;
+    }
+
+    static int pop(__bcast_fifo *fifo, slot_type *arr, unsigned int id, T *ret, int n)
+    {
+        __bcast_cursor *c = fifo->cursors + id;
+        unsigned int out = c->out.load(std::memory_order_relaxed);
+        int len = 0;
+
+        while (len < n)
+        {
+            if (c->in_cache == out)
+            {
+                c->in_cache = fifo->in.load(std::memory_order_acquire);
+                if (c->in_cache == out)
+                    break;
+            }
+
+            slot_type *slot = arr + (out & fifo->mask);
+            unsigned int seq = slot->seq.load(std::memory_order_acquire);
+
+            if (seq == 2 * (out + 1))
+            {
+                // may race with the producer, a torn copy is dropped below
+                memcpy(ret + len, &slot->val, sizeof (T));
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (slot->seq.load(std::memory_order_relaxed) == seq)
+                {
+                    out++;
+                    len++;
+                    continue;
+                }
+            }
+
+            // overwritten, skip to the oldest one which is not being overwritten.
+            // a batch push publishes in only at the end, so in may not cover the
+            // slot being rewritten yet, skip at least that one to move on
+            unsigned int in = fifo->in.load(std::memory_order_acquire);
+            unsigned int next = in - fifo->size + 1;
+
+            c->in_cache = in;
+            if ((int)(next - out) <= 0)
+                next = out + 1;
+
+            c->dropped.store(c->dropped.load(std::memory_order_relaxed) + (next - out),
+                             std::memory_order_relaxed);
+            out = next;
+        }
+
+        c->out.store(out, std::memory_order_release);
+        return len;
+    }
+};
 
-        unsigned int idx_in = fifo->in & fifo->mask;
-        unsigned int l = _min(len, fifo->size - idx_in);
-        T *arr = (T *)fifo->buffer;
+template <typename T, unsigned int capacity, bool lossy>
+class __bcast_queue
+{
+    using WORKER = __bcast_worker<T, lossy>;
+    using SLOT = typename WORKER::slot_type;
 
-        memcpy(arr + idx_in, ret, l * sizeof (T));
-        memcpy(arr, ret + l, (len - l) * sizeof (T));
+public:
+    explicit __bcast_queue(unsigned int consumers) : arr_() { __bcast_init(&fifo_, arr_, capacity, consumers); }
+    ~__bcast_queue() { free(fifo_.cursors); }
+    __bcast_queue(const __bcast_queue&) = delete;
+    __bcast_queue(__bcast_queue&&) = delete;
+    __bcast_queue& operator=(const __bcast_queue&) = delete;
+    __bcast_queue& operator=(__bcast_queue&&) = delete;
+
+public:
+    unsigned int consumers() const { return fifo_.consumers; }
 
-        asm volatile("sfence" ::: "memory");
+    int push(const T *ret, int n) { return WORKER::push(&fifo_, arr_, ret, n); }
+    ring_span<T> reserve(int n) { return WORKER::reserve(&fifo_, arr_, n); }
+    void commit(int n) { WORKER::commit(&fifo_, n); }
 
-        fifo->in += len;
+    int read_available(unsigned int id) const;
+    int pop(unsigned int id, T *ret, int n) { return WORKER::pop(&fifo_, arr_, id, ret, n); }
+    ring_span<const T> peek(unsigned int id, int n) { return WORKER::peek(&fifo_, arr_, id, n); }
+    void consume(unsigned int id, int n) { WORKER::consume(&fifo_, id, n); }
+    uint64_t dropped(unsigned int id) const { return fifo_.cursors[id].dropped; }
 
-        return len;
+private:
+    __bcast_fifo fifo_;
+    SLOT arr_[capacity];
+
+    static_assert(__CHECK_POWER_OF_2(capacity), "Capacity MUST power of 2");
+    static_assert(capacity > 1, "Capacity MUST larger than 1");
+};
+
+// heap storage, sized at runtime
+template <typename T, bool lossy>
+class __bcast_queue<T, 0, lossy>
+{
+    using WORKER = __bcast_worker<T, lossy>;
+    using SLOT = typename WORKER::slot_type;
+
+public:
+    __bcast_queue(unsigned int size, unsigned int consumers);
+    ~__bcast_queue();
+    __bcast_queue(const __bcast_queue&) = delete;
+    __bcast_queue(__bcast_queue&&) = delete;
+    __bcast_queue& operator=(const __bcast_queue&) = delete;
+    __bcast_queue& operator=(__bcast_queue&&) = delete;
+
+public:
+    unsigned int consumers() const { return fifo_.consumers; }
+
+    int push(const T *ret, int n) { return WORKER::push(&fifo_, (SLOT *)fifo_.buffer, ret, n); }
+    ring_span<T> reserve(int n) { return WORKER::reserve(&fifo_, (SLOT *)fifo_.buffer, n); }
+    void commit(int n) { WORKER::commit(&fifo_, n); }
+
+    int read_available(unsigned int id) const;
+    int pop(unsigned int id, T *ret, int n) { return WORKER::pop(&fifo_, (SLOT *)fifo_.buffer, id, ret, n); }
+    ring_span<const T> peek(unsigned int id, int n) { return WORKER::peek(&fifo_, (SLOT *)fifo_.buffer, id, n); }
+    void consume(unsigned int id, int n) { WORKER::consume(&fifo_, id, n); }
+    uint64_t dropped(unsigned int id) const { return fifo_.cursors[id].dropped; }
+
+private:
+    __bcast_fifo fifo_;
+};
+
+// may be more than capacity for a lagging consumer when lossy
+template <typename T, unsigned int capacity, bool lossy>
+int __bcast_queue<T, capacity, lossy>::read_available(unsigned int id) const
+{
+    return fifo_.in - fifo_.cursors[id].out;
+}
+
+template <typename T, bool lossy>
+__bcast_queue<T, 0, lossy>::__bcast_queue(unsigned int size, unsigned int consumers)
+{
+    SLOT *arr;
+
+    size = __round_up_power2(size, 2);
+    arr = (SLOT *)__aligned_alloc(size * sizeof (SLOT));
+    for (unsigned int i = 0; i < size; i++)
+        new (arr + i) SLOT();
+
+    try
+    {
+        __bcast_init(&fifo_, arr, size, consumers);
+    }
+    catch (...)
+    {
+        for (unsigned int i = 0; i < size; i++)
+            arr[i].~SLOT();
+
+        free(arr);
+        throw;
     }
+}
+
+template <typename T, bool lossy>
+__bcast_queue<T, 0, lossy>::~__bcast_queue()
+{
+    SLOT *arr = (SLOT *)fifo_.buffer;
+
+    for (unsigned int i = 0; i < fifo_.size; i++)
+        arr[i].~SLOT();
+
+    free(fifo_.buffer);
+    free(fifo_.cursors);
+}
+
+template <typename T, bool lossy>
+int __bcast_queue<T, 0, lossy>::read_available(unsigned int id) const
+{
+    return fifo_.in - fifo_.cursors[id].out;
+}
+
+// a ring of the work-stealing deque, prev is the smaller one it replaced
+struct __ws_array
+{
+    unsigned int mask;
+    unsigned int size;
+    std::atomic<uint64_t> *buffer;
+    __ws_array *prev;
+};
+
+// top is taken by thieves with CAS, bottom is only written by the owner.
+// both never wrap in practice, they are signed so that bottom - 1 < top
+// can be told when the owner pops from an empty deque
+struct __ws_fifo
+{
+    alignas(__CACHELINE_SIZE) std::atomic<int64_t> top;
+    alignas(__CACHELINE_SIZE) std::atomic<int64_t> bottom;
+    std::atomic<__ws_array *> array;
+};
+
+static inline void __ws_init(__ws_fifo *fifo, __ws_array *array)
+{
+    fifo->top = 0;
+    fifo->bottom = 0;
+    fifo->array = array;
+}
 
-    static int pop(__fifo *fifo, T *ret, int n)
+// the owner copies the live elements to a ring twice as large,
+// thieves reading the old ring still get the same elements
+static inline __ws_array *__ws_grow(__ws_fifo *fifo, __ws_array *a, int64_t top, int64_t bottom)
+{
+    unsigned int size = __round_up_power2(a->size * 2, 2);
+    __ws_array *na = (__ws_array *)__aligned_alloc(sizeof (__ws_array) + size * sizeof (uint64_t));
+
+    na->mask = size - 1;
+    na->size = size;
+    na->buffer = (std::atomic<uint64_t> *)(na + 1);
+    na->prev = a;
+    for (int64_t i = top; i < bottom; i++)
+        new (&na->buffer[i & na->mask]) std::atomic<uint64_t>(
+            a->buffer[i & a->mask].load(std::memory_order_relaxed));
+
+    fifo->array.store(na, std::memory_order_release);
+    return na;
+}
+
+static inline bool __ws_push(__ws_fifo *fifo, uint64_t ptr, bool growable)
+{
+    int64_t b = fifo->bottom.load(std::memory_order_relaxed);
+    int64_t t = fifo->top.load(std::memory_order_acquire);
+    __ws_array *a = fifo->array.load(std::memory_order_relaxed);
+
+    if (b - t > (int64_t)a->size - 1)
     {
-        unsigned int len = _min(n, fifo->in - fifo->out);
-        if (len == 0)
-            return 0;
+        if (!growable)
+            return false;
 
-        unsigned int idx_out = fifo->out & fifo->mask;
-        unsigned int l = _min(len, fifo->size - idx_out);
-        T *arr = (T *)fifo->buffer;
+        a = __ws_grow(fifo, a, t, b);
+    }
 
-        memcpy(ret, arr + idx_out, l * sizeof (T));
-        memcpy(ret + l, arr, (len - l) * sizeof (T));
+    a->buffer[b & a->mask].store(ptr, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    fifo->bottom.store(b + 1, std::memory_order_relaxed);
+    return true;
+}
 
-        asm volatile("sfence" ::: "memory");
+static inline bool __ws_pop(__ws_fifo *fifo, uint64_t& res)
+{
+    int64_t b = fifo->bottom.load(std::memory_order_relaxed) - 1;
+    __ws_array *a = fifo->array.load(std::memory_order_relaxed);
+    int64_t t;
 
-        fifo->out += len;
+    fifo->bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    t = fifo->top.load(std::memory_order_relaxed);
 
-        return len;
+    if (t > b)
+    {
+        // empty
+        fifo->bottom.store(b + 1, std::memory_order_relaxed);
+        return false;
     }
+
+    res = a->buffer[b & a->mask].load(std::memory_order_relaxed);
+    if (t < b)
+        return true;
+
+    // the last one, race with thieves
+    bool succ = fifo->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                                  std::memory_order_relaxed);
+
+    fifo->bottom.store(b + 1, std::memory_order_relaxed);
+    return succ;
+}
+
+static inline bool __ws_steal(__ws_fifo *fifo, uint64_t& res)
+{
+    int64_t t = fifo->top.load(std::memory_order_acquire);
+    int64_t b;
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    b = fifo->bottom.load(std::memory_order_acquire);
+    if (t >= b)
+        return false;
+
+    __ws_array *a = fifo->array.load(std::memory_order_acquire);
+
+    res = a->buffer[t & a->mask].load(std::memory_order_relaxed);
+    return fifo->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                             std::memory_order_relaxed);
+}
+
+static inline size_t __ws_size(const __ws_fifo *fifo)
+{
+    int64_t b = fifo->bottom.load(std::memory_order_relaxed);
+    int64_t t = fifo->top.load(std::memory_order_relaxed);
+
+    return b > t ? b - t : 0;
+}
+
+template <typename T, unsigned int capacity>
+class __ws_deque
+{
+public:
+    __ws_deque();
+    ~__ws_deque() { }
+    __ws_deque(const __ws_deque&) = delete;
+    __ws_deque(__ws_deque&&) = delete;
+    __ws_deque& operator=(const __ws_deque&) = delete;
+    __ws_deque& operator=(__ws_deque&&) = delete;
+
+public:
+    size_t size() const { return __ws_size(&fifo_); }
+
+    bool push(uint64_t ptr) { return __ws_push(&fifo_, ptr, false); }
+    bool pop(uint64_t& res) { return __ws_pop(&fifo_, res); }
+    bool steal(uint64_t& res) { return __ws_steal(&fifo_, res); }
+
+private:
+    __ws_fifo fifo_;
+    __ws_array array_;
+    std::atomic<uint64_t> arr_[capacity];
+
+    static_assert(__CHECK_POWER_OF_2(capacity), "Capacity MUST power of 2");
 };
 
+// heap storage, growable
 template <typename T>
-class __spsc_worker<T, false>
+class __ws_deque<T, 0>
 {
 public:
-    static int push(__fifo *fifo, const T *ret, int n)
+    explicit __ws_deque(unsigned int size);
+    ~__ws_deque();
+    __ws_deque(const __ws_deque&) = delete;
+    __ws_deque(__ws_deque&&) = delete;
+    __ws_deque& operator=(const __ws_deque&) = delete;
+    __ws_deque& operator=(__ws_deque&&) = delete;
+
+public:
+    size_t size() const { return __ws_size(&fifo_); }
+
+    bool push(uint64_t ptr) { return __ws_push(&fifo_, ptr, true); }
+    bool pop(uint64_t& res) { return __ws_pop(&fifo_, res); }
+    bool steal(uint64_t& res) { return __ws_steal(&fifo_, res); }
+
+private:
+    __ws_fifo fifo_;
+};
+
+template <typename T, unsigned int capacity>
+__ws_deque<T, capacity>::__ws_deque()
+{
+    array_.mask = capacity - 1;
+    array_.size = capacity;
+    array_.buffer = arr_;
+    array_.prev = NULL;
+    __ws_init(&fifo_, &array_);
+}
+
+template <typename T>
+__ws_deque<T, 0>::__ws_deque(unsigned int size)
+{
+    __ws_array *a;
+
+    size = __round_up_power2(size, 2);
+    a = (__ws_array *)__aligned_alloc(sizeof (__ws_array) + size * sizeof (uint64_t));
+    a->mask = size - 1;
+    a->size = size;
+    a->buffer = (std::atomic<uint64_t> *)(a + 1);
+    a->prev = NULL;
+    for (unsigned int i = 0; i < size; i++)
+        new (&a->buffer[i]) std::atomic<uint64_t>(0);
+
+    __ws_init(&fifo_, a);
+}
+
+template <typename T>
+__ws_deque<T, 0>::~__ws_deque()
+{
+    __ws_array *a = fifo_.array.load(std::memory_order_relaxed);
+
+    while (a)
     {
-        unsigned int len = _min(n, fifo->size - fifo->in + fifo->out);
-        if (len == 0)
-            return 0;
+        __ws_array *prev = a->prev;
 
-        unsigned int idx_in = fifo->in & fifo->mask;
-        unsigned int l = _min(len, fifo->size - idx_in);
-        T *arr = (T *)fifo->buffer;
+        free(a);
+        a = prev;
+    }
+}
 
-        for (unsigned int i = 0; i < l; i++)
-            arr[idx_in + i] = ret[i];
 
-        for (unsigned int i = 0; i < len - l; i++)
-            arr[i] = ret[l + i];
+// a segment is a __spsc_queue plus the link to the next one,
+// the producer never goes back to a segment after linking the next one
+template <typename T>
+struct __seg_node
+{
+    __spsc_queue<T, 0> ring;
+    std::atomic<__seg_node *> next;
 
-        asm volatile("sfence" ::: "memory");
+    explicit __seg_node(unsigned int size) : ring(size), next(NULL) { }
+};
 
-        fifo->in += len;
+template <typename T>
+static inline __seg_node<T> *__seg_create(unsigned int size)
+{
+    void *ptr = __aligned_alloc(sizeof (__seg_node<T>));
 
-        return len;
+    try
+    {
+        return new (ptr) __seg_node<T>(size);
     }
+    catch (...)
+    {
+        free(ptr);
+        throw;
+    }
+}
 
-    static int pop(__fifo *fifo, T *ret, int n)
+template <typename T>
+static inline void __seg_destroy(__seg_node<T> *node)
+{
+    if (node)
     {
-        unsigned int len = _min(n, fifo->in - fifo->out);
-        if (len == 0)
-            return 0;
+        node->~__seg_node<T>();
+        free(node);
+    }
+}
 
-        unsigned int idx_out = fifo->out & fifo->mask;
-        unsigned int l = _min(len, fifo->size - idx_out);
-        T *arr = (T *)fifo->buffer;
+template <typename T>
+class __seg_spsc_queue
+{
+public:
+    explicit __seg_spsc_queue(unsigned int size);
+    ~__seg_spsc_queue();
+    __seg_spsc_queue(const __seg_spsc_queue&) = delete;
+    __seg_spsc_queue(__seg_spsc_queue&&) = delete;
+    __seg_spsc_queue& operator=(const __seg_spsc_queue&) = delete;
+    __seg_spsc_queue& operator=(__seg_spsc_queue&&) = delete;
 
-        for (unsigned int i = 0; i < l; i++)
-            ret[i] = std::move(arr[idx_out + i]);
+public:
+    bool empty() const;
 
-        for (unsigned int i = 0; i < len - l; i++)
-            ret[l + i] = std::move(arr[i]);
+    bool push(const T& t);
+    bool push(T&& t);
+    bool pop(T& ret);
+
+    int push(const T *ret, int n);
+    int pop(T *ret, int n);
 
-        asm volatile("sfence" ::: "memory");
+private:
+    __seg_node<T> *grow();
+    void link(__seg_node<T> *node);
+    bool advance();
+
+    unsigned int size_;
+    // producer
+    alignas(__CACHELINE_SIZE) __seg_node<T> *tail_;
+    // consumer
+    alignas(__CACHELINE_SIZE) __seg_node<T> *head_;
+    // a drained segment handed back from the consumer to the producer
+    alignas(__CACHELINE_SIZE) std::atomic<__seg_node<T> *> spare_;
+};
 
-        fifo->out += len;
+template <typename T>
+__seg_spsc_queue<T>::__seg_spsc_queue(unsigned int size)
+{
+    size_ = __round_up_power2(size, 2);
+    head_ = tail_ = __seg_create<T>(size_);
+    spare_.store(NULL, std::memory_order_relaxed);
+}
 
-        return len;
+template <typename T>
+__seg_spsc_queue<T>::~__seg_spsc_queue()
+{
+    while (head_)
+    {
+        __seg_node<T> *next = head_->next.load(std::memory_order_relaxed);
+
+        __seg_destroy(head_);
+        head_ = next;
     }
-};
 
-struct __atomic_fifo
+    __seg_destroy(spare_.load(std::memory_order_relaxed));
+}
+
+// an empty segment for the producer, the spare one if there is,
+// NULL when out of memory
+template <typename T>
+__seg_node<T> *__seg_spsc_queue<T>::grow()
 {
-    unsigned int mask;
-    unsigned int size;
-    uint64_t *buffer;
-    std::atomic<unsigned int> in;
-    std::atomic<unsigned int> out;
-};
+    __seg_node<T> *node = spare_.exchange(NULL, std::memory_order_acquire);
+
+    if (node)
+        return node;
+
+    try
+    {
+        return __seg_create<T>(size_);
+    }
+    catch (const std::bad_alloc&)
+    {
+        return NULL;
+    }
+}
+
+// node has been filled before, the consumer never sees an empty new segment
+template <typename T>
+void __seg_spsc_queue<T>::link(__seg_node<T> *node)
+{
+    tail_->next.store(node, std::memory_order_release);
+    tail_ = node;
+}
+
+// the first segment is empty, return false if it is the last one, too.
+// the producer may have filled it between the failed pop and the load of
+// next, so it is drained only when it is still empty after that
+template <typename T>
+bool __seg_spsc_queue<T>::advance()
+{
+    __seg_node<T> *next = head_->next.load(std::memory_order_acquire);
+
+    if (next == NULL)
+        return false;
+
+    if (head_->ring.read_available() == 0)
+    {
+        head_->next.store(NULL, std::memory_order_relaxed);
+        __seg_destroy(spare_.exchange(head_, std::memory_order_acq_rel));
+        head_ = next;
+    }
+
+    return true;
+}
+
+template <typename T>
+bool __seg_spsc_queue<T>::empty() const
+{
+    return head_->ring.read_available() == 0 &&
+           head_->next.load(std::memory_order_acquire) == NULL;
+}
+
+template <typename T>
+bool __seg_spsc_queue<T>::push(const T& t)
+{
+    __seg_node<T> *node;
+
+    if (tail_->ring.push(t))
+        return true;
+
+    node = grow();
+    if (!node)
+        return false;
+
+    node->ring.push(t);
+    link(node);
+    return true;
+}
+
+template <typename T>
+bool __seg_spsc_queue<T>::push(T&& t)
+{
+    __seg_node<T> *node;
+
+    if (tail_->ring.push(std::move(t)))
+        return true;
+
+    node = grow();
+    if (!node)
+        return false;
+
+    node->ring.push(std::move(t));
+    link(node);
+    return true;
+}
+
+template <typename T>
+bool __seg_spsc_queue<T>::pop(T& t)
+{
+    do
+    {
+        if (head_->ring.pop(t))
+            return true;
+    } while (advance());
+
+    return false;
+}
+
+template <typename T>
+int __seg_spsc_queue<T>::push(const T *ret, int n)
+{
+    int cnt = tail_->ring.push(ret, n);
+
+    while (cnt < n)
+    {
+        __seg_node<T> *node = grow();
+
+        if (!node)
+            break;
+
+        cnt += node->ring.push(ret + cnt, n - cnt);
+        link(node);
+    }
+
+    return cnt;
+}
+
+template <typename T>
+int __seg_spsc_queue<T>::pop(T *ret, int n)
+{
+    int cnt = 0;
+
+    do
+    {
+        cnt += head_->ring.pop(ret + cnt, n - cnt);
+    } while (cnt < n && advance());
+
+    return cnt;
+}
+
+
+// every thread gets its own number once, shards are picked by it
+static inline unsigned int __shard_home()
+{
+    static std::atomic<unsigned int> next(0);
+    static thread_local unsigned int home = next.fetch_add(1, std::memory_order_relaxed);
 
-template <typename T, bool is_pointer = std::is_pointer<T>::value>
-class __mpmc_worker;
+    return home;
+}
 
-template <typename T, unsigned int capacity>
-class __mpmc_queue
+template <typename T>
+class __sharded_queue
 {
+    using SHARD = typename std::conditional<__mpmc_inline<T>::value,
+                                            __mpmc_seq_queue<T, 0>,
+                                            __mpmc_queue<T, 0>>::type;
+
 public:
-    __mpmc_queue();
-    ~__mpmc_queue();
-    __mpmc_queue(const __mpmc_queue&) = delete;
-    __mpmc_queue(__mpmc_queue&&) = delete;
-    __mpmc_queue& operator=(const __mpmc_queue&) = delete;
-    __mpmc_queue& operator=(__mpmc_queue&&) = delete;
+    __sharded_queue(unsigned int size, unsigned int shards);
+    ~__sharded_queue();
+    __sharded_queue(const __sharded_queue&) = delete;
+    __sharded_queue(__sharded_queue&&) = delete;
+    __sharded_queue& operator=(const __sharded_queue&) = delete;
+    __sharded_queue& operator=(__sharded_queue&&) = delete;
 
 public:
+    unsigned int shards() const { return count_; }
     bool empty() const;
     size_t size() const;
 
@@ -398,246 +4095,398 @@ public:
     bool push(T&& t);
     bool pop(T& ret);
 
-private:
-    __atomic_fifo fifo_;
-    uint64_t arr_[capacity];
+    int push(const T *ret, int n);
+    int pop(T *ret, int n);
 
-    using WORKER = __mpmc_worker<T, std::is_pointer<T>::value>;
-    static_assert(__CHECK_POWER_OF_2(capacity), "Capacity MUST power of 2");
-    static_assert(capacity > 2, "Capacity MUST larger than 2");
-};
+#ifdef QUEUE62_STATS
+    mpmc_stats stats() const;
+#endif
 
-static constexpr uint64_t PTR_IN = (uint64_t(1) << 63);
-static constexpr uint64_t PTR_OUT = (uint64_t(1) << 62);
-static constexpr uint64_t PTR_EMPTY = (uint64_t(1) << 61);
+private:
+    SHARD *shards_;
+    unsigned int count_;
+};
 
-template <typename T, unsigned int capacity>
-__mpmc_queue<T, capacity>::__mpmc_queue()
+template <typename T>
+__sharded_queue<T>::__sharded_queue(unsigned int size, unsigned int shards)
 {
-    fifo_.mask = capacity - 1;
-    fifo_.size = capacity;
-    fifo_.buffer = arr_;
-    fifo_.in = 1;
-    fifo_.out = 0;
+    unsigned int i = 0;
 
-    arr_[fifo_.in] = PTR_IN;
-    arr_[fifo_.out] = (PTR_OUT | fifo_.out);
-    for (unsigned int i = 2; i < capacity; i++)
-        arr_[i] = (PTR_EMPTY | i);
-}
+    if (shards == 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        shards = cpus > 0 ? (unsigned int)cpus : 1;
+    }
 
-template <typename T, unsigned int capacity>
-__mpmc_queue<T, capacity>::~__mpmc_queue()
-{
-    WORKER::clear(&fifo_);
+    shards_ = (SHARD *)__aligned_alloc(shards * sizeof (SHARD));
+    try
+    {
+        for (; i < shards; i++)
+            new (shards_ + i) SHARD(size);
+    }
+    catch (...)
+    {
+        while (i > 0)
+            shards_[--i].~SHARD();
+
+        free(shards_);
+        throw;
+    }
+
+    count_ = shards;
 }
 
-template <typename T, unsigned int capacity>
-bool __mpmc_queue<T, capacity>::empty() const
+template <typename T>
+__sharded_queue<T>::~__sharded_queue()
 {
-    return fifo_.in - fifo_.out == 1;
+    for (unsigned int i = 0; i < count_; i++)
+        shards_[i].~SHARD();
+
+    free(shards_);
 }
 
-template <typename T, unsigned int capacity>
-size_t __mpmc_queue<T, capacity>::size() const
+template <typename T>
+bool __sharded_queue<T>::empty() const
 {
-    return fifo_.in - fifo_.out - 1;
+    for (unsigned int i = 0; i < count_; i++)
+    {
+        if (!shards_[i].empty())
+            return false;
+    }
+
+    return true;
 }
 
-template <typename T, unsigned int capacity>
-bool __mpmc_queue<T, capacity>::push(const T& t)
+template <typename T>
+size_t __sharded_queue<T>::size() const
 {
-    return WORKER::push(&fifo_, t);
+    size_t res = 0;
+
+    for (unsigned int i = 0; i < count_; i++)
+        res += shards_[i].size();
+
+    return res;
 }
 
-template <typename T, unsigned int capacity>
-bool __mpmc_queue<T, capacity>::push(T&& t)
+template <typename T>
+bool __sharded_queue<T>::push(const T& t)
 {
-    return WORKER::push(&fifo_, std::move(t));
+    unsigned int home = __shard_home();
+
+    for (unsigned int i = 0; i < count_; i++)
+    {
+        if (shards_[(home + i) % count_].push(t))
+            return true;
+    }
+
+    return false;
 }
 
-template <typename T, unsigned int capacity>
-bool __mpmc_queue<T, capacity>::pop(T& t)
+template <typename T>
+bool __sharded_queue<T>::push(T&& t)
 {
-    return WORKER::pop(&fifo_, t);
+    unsigned int home = __shard_home();
+
+    // a failed push does not move from t
+    for (unsigned int i = 0; i < count_; i++)
+    {
+        if (shards_[(home + i) % count_].push(std::move(t)))
+            return true;
+    }
+
+    return false;
 }
 
-static inline bool __mpmc_push(__atomic_fifo *fifo, void *ptr)
+template <typename T>
+bool __sharded_queue<T>::pop(T& t)
 {
-    unsigned int cur;
-    unsigned int next;
-    uint64_t *pNext;
+    unsigned int home = __shard_home();
 
-    do
+    for (unsigned int i = 0; i < count_; i++)
     {
-        cur = fifo->in;
-        next = cur + 1;
-        pNext = fifo->buffer + (next & fifo->mask);
-        if ((*pNext) & PTR_OUT)
-            return false;
-
-    } while (!__sync_bool_compare_and_swap(pNext, PTR_EMPTY | next, PTR_IN));
+        if (shards_[(home + i) % count_].pop(t))
+            return true;
+    }
 
-    fifo->buffer[cur & fifo->mask] = (uint64_t)ptr;
-    ++fifo->in;
-    return true;
+    return false;
 }
 
-static inline bool __mpmc_pop(__atomic_fifo *fifo, uint64_t& res)
+template <typename T>
+int __sharded_queue<T>::push(const T *ret, int n)
 {
-    unsigned int cur;
-    unsigned int next;
-    uint64_t *pNext;
-    uint64_t ptr;
+    unsigned int home = __shard_home();
+    int cnt = 0;
 
-    do
-    {
-        cur = fifo->out;
-        next = cur + 1;
-        pNext = fifo->buffer + (next & fifo->mask);
-        ptr = *pNext;
-        if (ptr == PTR_IN)
-            return false;
+    for (unsigned int i = 0; i < count_ && cnt < n; i++)
+        cnt += shards_[(home + i) % count_].push(ret + cnt, n - cnt);
 
-    } while (!__sync_bool_compare_and_swap(fifo->buffer + (cur & fifo->mask),
-                                           PTR_OUT | cur,
-                                           PTR_EMPTY | (cur + fifo->size)));
+    return cnt;
+}
 
-    *pNext = (PTR_OUT | next);
-    ++fifo->out;
-    res = ptr;
-    return true;
+template <typename T>
+int __sharded_queue<T>::pop(T *ret, int n)
+{
+    unsigned int home = __shard_home();
+    int cnt = 0;
+
+    for (unsigned int i = 0; i < count_ && cnt < n; i++)
+        cnt += shards_[(home + i) % count_].pop(ret + cnt, n - cnt);
+
+    return cnt;
 }
 
-static inline bool __mpmc_try_push(__atomic_fifo *fifo, unsigned int& res)
+#ifdef QUEUE62_STATS
+template <typename T>
+mpmc_stats __sharded_queue<T>::stats() const
 {
-    unsigned int cur;
-    unsigned int next;
-    uint64_t *pNext;
+    mpmc_stats res = {0, 0, 0, 0, 0};
 
-    do
+    for (unsigned int i = 0; i < count_; i++)
     {
-        cur = fifo->in;
-        next = cur + 1;
-        pNext = fifo->buffer + (next & fifo->mask);
-        if ((*pNext) & PTR_OUT)
-            return false;
+        mpmc_stats st = shards_[i].stats();
+
+        res.cas_attempts += st.cas_attempts;
+        res.cas_failures += st.cas_failures;
+        res.push_full += st.push_full;
+        res.pop_empty += st.pop_empty;
+        if (st.high_water > res.high_water)
+            res.high_water = st.high_water;
+    }
 
-    } while (!__sync_bool_compare_and_swap(pNext, PTR_EMPTY | next, PTR_IN));
+    return res;
+}
+#endif
 
-    res = cur;
-    return true;
+
+template <typename T>
+static inline bool __lane_empty(const __spsc_queue<T, 0> *lane)
+{
+    return lane->read_available() == 0;
 }
 
-static inline void __mpmc_push_rollback(__atomic_fifo *fifo, unsigned int cur)
+template <typename LANE>
+static inline bool __lane_empty(const LANE *lane)
 {
-    fifo->buffer[(cur + 1) & fifo->mask] = (PTR_EMPTY | (cur + 1));
+    return lane->empty();
 }
 
-template <typename T>
-class __mpmc_worker<T, true>
+// a producer sets the bit of its lane after pushing, if it is not set yet.
+// a consumer clears it when the lane is found empty, then checks the lane
+// again, a push racing with the clear sets it back. both sides make a full
+// fence between the lane and the bitmap, so one of them sees the other
+template <typename T, unsigned int lanes, typename LANE>
+class __prio_queue
 {
 public:
-    static bool push(__atomic_fifo *fifo, const T& t)
+    __prio_queue(unsigned int size, const unsigned int *weights);
+    ~__prio_queue();
+    __prio_queue(const __prio_queue&) = delete;
+    __prio_queue(__prio_queue&&) = delete;
+    __prio_queue& operator=(const __prio_queue&) = delete;
+    __prio_queue& operator=(__prio_queue&&) = delete;
+
+public:
+    bool empty() const { return bitmap_.load(std::memory_order_acquire) == 0; }
+
+    bool push(unsigned int lane, const T& t);
+    bool push(unsigned int lane, T&& t);
+    int push(unsigned int lane, const T *ret, int n);
+
+    int pop(T *ret, int n, unsigned int& lane);
+
+private:
+    void mark(unsigned int lane);
+    int take(unsigned int lane, int n);
+    void refund(unsigned int lane, int n);
+    void refill();
+
+    LANE *lanes_;
+    alignas(__CACHELINE_SIZE) std::atomic<uint64_t> bitmap_;
+
+    // weighted mode only, lanes which still have credits in this round
+    alignas(__CACHELINE_SIZE) std::atomic<uint64_t> credit_mask_;
+    std::atomic<int> credits_[lanes];
+    unsigned int weights_[lanes];
+    bool weighted_;
+
+    static_assert(lanes > 0 && lanes <= 64, "lanes MUST be 1 .. 64");
+};
+
+template <typename T, unsigned int lanes, typename LANE>
+__prio_queue<T, lanes, LANE>::__prio_queue(unsigned int size, const unsigned int *weights)
+{
+    unsigned int i = 0;
+
+    lanes_ = (LANE *)__aligned_alloc(lanes * sizeof (LANE));
+    try
     {
-        return __mpmc_push(fifo, t);
+        for (; i < lanes; i++)
+            new (lanes_ + i) LANE(size);
     }
-
-    static bool push(__atomic_fifo *fifo, T&& t)
+    catch (...)
     {
-        return __mpmc_push(fifo, t);
+        while (i > 0)
+            lanes_[--i].~LANE();
+
+        free(lanes_);
+        throw;
     }
 
-    static bool pop(__atomic_fifo *fifo, T& t)
-    {
-        uint64_t ptr;
-        bool succ = __mpmc_pop(fifo, ptr);
+    weighted_ = weights != NULL;
+    for (i = 0; i < lanes; i++)
+        weights_[i] = weights ? weights[i] : 0;
 
-        if (succ)
-            t = (T)ptr;
+    bitmap_.store(0, std::memory_order_relaxed);
+    refill();
+}
 
-        return succ;
-    }
+template <typename T, unsigned int lanes, typename LANE>
+__prio_queue<T, lanes, LANE>::~__prio_queue()
+{
+    for (unsigned int i = 0; i < lanes; i++)
+        lanes_[i].~LANE();
 
-    static void clear(__atomic_fifo *fifo) { }
-};
+    free(lanes_);
+}
 
-template <typename T>
-class __Holder
+template <typename T, unsigned int lanes, typename LANE>
+void __prio_queue<T, lanes, LANE>::mark(unsigned int lane)
 {
-public:
-    __Holder(const T& t) : val(t) { }
-    __Holder(T&& t) : val(std::move(t)) { }
+    uint64_t bit = (uint64_t)1 << lane;
 
-public:
-    T val;
-};
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if ((bitmap_.load(std::memory_order_relaxed) & bit) == 0)
+        bitmap_.fetch_or(bit, std::memory_order_release);
+}
 
-template <typename T>
-class __mpmc_worker<T, false>
+template <typename T, unsigned int lanes, typename LANE>
+void __prio_queue<T, lanes, LANE>::refill()
 {
-public:
-    static bool push(__atomic_fifo *fifo, const T& t)
-    {
-        unsigned int cur;
+    for (unsigned int i = 0; i < lanes; i++)
+        credits_[i].store(weights_[i], std::memory_order_relaxed);
 
-        if (!__mpmc_try_push(fifo, cur))
-            return false;
+    credit_mask_.store(lanes == 64 ? ~(uint64_t)0 : ((uint64_t)1 << lanes) - 1,
+                       std::memory_order_relaxed);
+}
 
-        auto *p = new (std::nothrow) __Holder<T>(t);
+// take at most n credits of lane, return how many
+template <typename T, unsigned int lanes, typename LANE>
+int __prio_queue<T, lanes, LANE>::take(unsigned int lane, int n)
+{
+    int left = credits_[lane].fetch_sub(n, std::memory_order_relaxed);
+    int got = left > 0 ? _min(left, n) : 0;
 
-        if (!p)
-        {
-            __mpmc_push_rollback(fifo, cur);
-            return false;
-        }
+    if (left <= n)
+        credit_mask_.fetch_and(~((uint64_t)1 << lane), std::memory_order_relaxed);
 
-        fifo->buffer[cur & fifo->mask] = (uint64_t)p;
-        ++fifo->in;
-        return true;
-    }
+    // only got credits are used, the rest goes back so credits stay >= 0
+    if (got < n)
+        credits_[lane].fetch_add(n - got, std::memory_order_relaxed);
 
-    static bool push(__atomic_fifo *fifo, T&& t)
-    {
-        unsigned int cur;
+    return got;
+}
 
-        if (!__mpmc_try_push(fifo, cur))
-            return false;
+// give back n credits taken but not used, the lane is ready again
+template <typename T, unsigned int lanes, typename LANE>
+void __prio_queue<T, lanes, LANE>::refund(unsigned int lane, int n)
+{
+    if (credits_[lane].fetch_add(n, std::memory_order_relaxed) + n > 0)
+        credit_mask_.fetch_or((uint64_t)1 << lane, std::memory_order_relaxed);
+}
 
-        auto *p = new (std::nothrow) __Holder<T>(std::move(t));
+template <typename T, unsigned int lanes, typename LANE>
+bool __prio_queue<T, lanes, LANE>::push(unsigned int lane, const T& t)
+{
+    if (!lanes_[lane].push(t))
+        return false;
 
-        if (!p)
-        {
-            __mpmc_push_rollback(fifo, cur);
-            return false;
-        }
+    mark(lane);
+    return true;
+}
 
-        fifo->buffer[cur & fifo->mask] = (uint64_t)p;
-        ++fifo->in;
-        return true;
-    }
+template <typename T, unsigned int lanes, typename LANE>
+bool __prio_queue<T, lanes, LANE>::push(unsigned int lane, T&& t)
+{
+    if (!lanes_[lane].push(std::move(t)))
+        return false;
 
-    static bool pop(__atomic_fifo *fifo, T& t)
-    {
-        uint64_t ptr;
+    mark(lane);
+    return true;
+}
 
-        if (!__mpmc_pop(fifo, ptr))
-            return false;
+template <typename T, unsigned int lanes, typename LANE>
+int __prio_queue<T, lanes, LANE>::push(unsigned int lane, const T *ret, int n)
+{
+    int cnt = lanes_[lane].push(ret, n);
 
-        auto *p = (__Holder<T> *)(ptr);
+    if (cnt > 0)
+        mark(lane);
 
-        t = std::move(p->val);
-        delete p;
-        return true;
-    }
+    return cnt;
+}
 
-    static void clear(__atomic_fifo *fifo)
+template <typename T, unsigned int lanes, typename LANE>
+int __prio_queue<T, lanes, LANE>::pop(T *ret, int n, unsigned int& lane)
+{
+    uint64_t mask;
+
+    if (n <= 0)
+        return 0;
+
+    while ((mask = bitmap_.load(std::memory_order_acquire)) != 0)
     {
-        uint64_t ptr;
+        uint64_t bit;
+        int cnt = n;
+        int popped;
 
-        while (__mpmc_pop(fifo, ptr))
-            delete (__Holder<T> *)(ptr);
+        if (weighted_)
+        {
+            uint64_t ready = mask & credit_mask_.load(std::memory_order_relaxed);
+
+            // every waiting lane has used up its credits, a new round
+            if (ready == 0)
+            {
+                refill();
+                ready = mask;
+            }
+
+            lane = __builtin_ctzll(ready);
+            cnt = take(lane, n);
+            if (cnt == 0)
+                continue;
+        }
+        else
+            lane = __builtin_ctzll(mask);
+
+        popped = cnt == 1 ? lanes_[lane].pop(*ret) : lanes_[lane].pop(ret, cnt);
+
+        // credits are taken before the pop, the ones not used go back
+        if (weighted_ && popped < cnt)
+            refund(lane, cnt - popped);
+
+        if (popped > 0)
+            return popped;
+
+        bit = (uint64_t)1 << lane;
+        bitmap_.fetch_and(~bit, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!__lane_empty(&lanes_[lane]))
+            bitmap_.fetch_or(bit, std::memory_order_release);
     }
-};
 
+    return 0;
+}
+
+// for the adapters over any queue, empty() or read_available() == 0
+template <typename Q>
+static inline auto __queue_empty(const Q& que, int) -> decltype(que.empty())
+{
+    return que.empty();
+}
+
+template <typename Q>
+static inline auto __queue_empty(const Q& que, long) -> decltype(que.read_available() == 0)
+{
+    return que.read_available() == 0;
+}
 }
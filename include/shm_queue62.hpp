@@ -0,0 +1,309 @@
+/*
+  Copyright (c) 2021 wujiaxu <void00@foxmail.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#pragma once
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "queue62.hpp"
+
+namespace { // not for user
+struct __shm_header;
+}
+
+// The shm_spsc_queue class provides a single-producer/single-consumer fifo
+// queue between processes, ring and indices live in POSIX shared memory.
+// One process creates it, the other one attaches to it by name.
+// pushing and popping is wait-free, exactly the same as spsc_queue
+template <typename T>
+class shm_spsc_queue
+{
+public:
+    shm_spsc_queue() : header_(NULL), arr_(NULL), map_size_(0) { }
+    ~shm_spsc_queue() { detach(); }
+    shm_spsc_queue(const shm_spsc_queue&) = delete;
+    shm_spsc_queue(shm_spsc_queue&&) = delete;
+    shm_spsc_queue& operator=(const shm_spsc_queue&) = delete;
+    shm_spsc_queue& operator=(shm_spsc_queue&&) = delete;
+
+public:
+    // name is the same as shm_open, size will round up to power of 2
+    // return false and set errno if failed, EEXIST if name is in use
+    bool create(const char *name, unsigned int size, mode_t mode = 0600);
+    // return false and set errno if failed
+    // EAGAIN means the creator has not finished initialization, try again
+    // EPROTO means the creator is built with another version of this header
+    bool attach(const char *name);
+    // unmap only, the other process can go on using the queue
+    void detach();
+    // the queue is freed after every process has detached
+    static int remove(const char *name) { return shm_unlink(name); }
+
+    int read_available() const;
+
+    bool push(const T& t);
+    bool pop(T& ret);
+
+    int push(const T *ret, int n);
+    int pop(T *ret, int n);
+
+    ring_span<T> reserve(int n);
+    void commit(int n);
+    ring_span<T> peek(int n);
+    void consume(int n);
+
+private:
+    __shm_header *header_;
+    T *arr_;
+    size_t map_size_;
+
+    using WORKER = __spsc_worker<T, true>;
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "T MUST be trivially copyable to be shared between processes");
+};
+
+namespace { // not for user
+static constexpr uint32_t __SHM_MAGIC = 0x51363253; // "Q62S"
+static constexpr uint32_t __SHM_VERSION = 1;
+
+// fifo.buffer is not used, each process has its own address of the ring,
+// which always starts at data_offset of the mapping
+struct __shm_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t elem_size;
+    uint32_t size;
+    uint64_t data_offset;
+    std::atomic<uint32_t> ready;
+    __fifo fifo;
+};
+
+static constexpr size_t __SHM_DATA_OFFSET = (sizeof (__shm_header) + __CACHELINE_SIZE - 1) /
+                                            __CACHELINE_SIZE * __CACHELINE_SIZE;
+
+// ready is stored last, the other side checks it first
+static inline void __shm_init(__shm_header *header, uint32_t elem_size, unsigned int size,
+                              size_t data_offset)
+{
+    header->magic = __SHM_MAGIC;
+    header->version = __SHM_VERSION;
+    header->elem_size = elem_size;
+    header->size = size;
+    header->data_offset = data_offset;
+    __fifo_init(&header->fifo, NULL, size);
+    header->ready.store(1, std::memory_order_release);
+}
+
+// return 0, or the error number why the mapping is not a usable queue
+static inline int __shm_check(const __shm_header *header, uint32_t elem_size, size_t map_size)
+{
+    if (header->ready.load(std::memory_order_acquire) == 0)
+        return EAGAIN;
+    else if (header->magic != __SHM_MAGIC)
+        return EINVAL;
+    else if (header->version != __SHM_VERSION)
+        return EPROTO;
+    else if (header->elem_size != elem_size ||
+             header->data_offset + (size_t)header->size * elem_size > map_size)
+        return EINVAL;
+
+    return 0;
+}
+}
+
+////
+// template inl, not for user
+template <typename T>
+bool shm_spsc_queue<T>::create(const char *name, unsigned int size, mode_t mode)
+{
+    size_t map_size;
+    void *ptr;
+    int fd;
+    int err;
+
+    detach();
+    size = __round_up_power2(size, 2);
+    map_size = __SHM_DATA_OFFSET + (size_t)size * sizeof (T);
+
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, mode);
+    if (fd < 0)
+        return false;
+
+    if (ftruncate(fd, map_size) != 0)
+    {
+        err = errno;
+        close(fd);
+        shm_unlink(name);
+        errno = err;
+        return false;
+    }
+
+    ptr = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    err = errno;
+    close(fd);
+    if (ptr == MAP_FAILED)
+    {
+        shm_unlink(name);
+        errno = err;
+        return false;
+    }
+
+    header_ = (__shm_header *)ptr;
+    __shm_init(header_, sizeof (T), size, __SHM_DATA_OFFSET);
+
+    arr_ = (T *)((char *)ptr + __SHM_DATA_OFFSET);
+    map_size_ = map_size;
+    return true;
+}
+
+template <typename T>
+bool shm_spsc_queue<T>::attach(const char *name)
+{
+    struct stat st;
+    __shm_header *header;
+    void *ptr;
+    int fd;
+    int err = 0;
+
+    detach();
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+        return false;
+
+    if (fstat(fd, &st) != 0)
+    {
+        err = errno;
+        close(fd);
+        errno = err;
+        return false;
+    }
+
+    if ((size_t)st.st_size < __SHM_DATA_OFFSET)
+    {
+        close(fd);
+        errno = EAGAIN;
+        return false;
+    }
+
+    ptr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    err = errno;
+    close(fd);
+    if (ptr == MAP_FAILED)
+    {
+        errno = err;
+        return false;
+    }
+
+    header = (__shm_header *)ptr;
+    err = __shm_check(header, sizeof (T), st.st_size);
+    if (err != 0)
+    {
+        munmap(ptr, st.st_size);
+        errno = err;
+        return false;
+    }
+
+    header_ = header;
+    arr_ = (T *)((char *)ptr + header->data_offset);
+    map_size_ = st.st_size;
+    return true;
+}
+
+template <typename T>
+void shm_spsc_queue<T>::detach()
+{
+    if (header_)
+    {
+        munmap(header_, map_size_);
+        header_ = NULL;
+        arr_ = NULL;
+        map_size_ = 0;
+    }
+}
+
+template <typename T>
+int shm_spsc_queue<T>::read_available() const
+{
+    return header_->fifo.in - header_->fifo.out;
+}
+
+template <typename T>
+bool shm_spsc_queue<T>::push(const T& t)
+{
+    __fifo *fifo = &header_->fifo;
+
+    if (__fifo_writable(fifo, 1) == 0)
+        return false;
+
+    arr_[fifo->in.load(std::memory_order_relaxed) & fifo->mask] = t;
+
+    __spsc_commit(fifo, 1);
+
+    return true;
+}
+
+template <typename T>
+bool shm_spsc_queue<T>::pop(T& t)
+{
+    __fifo *fifo = &header_->fifo;
+
+    if (__fifo_readable(fifo, 1) == 0)
+        return false;
+
+    t = arr_[fifo->out.load(std::memory_order_relaxed) & fifo->mask];
+
+    __spsc_consume(fifo, 1);
+
+    return true;
+}
+
+template <typename T>
+int shm_spsc_queue<T>::push(const T *ret, int n)
+{
+    return WORKER::push(&header_->fifo, arr_, ret, n);
+}
+
+template <typename T>
+int shm_spsc_queue<T>::pop(T *ret, int n)
+{
+    return WORKER::pop(&header_->fifo, arr_, ret, n);
+}
+
+template <typename T>
+ring_span<T> shm_spsc_queue<T>::reserve(int n)
+{
+    return __spsc_reserve(&header_->fifo, arr_, n);
+}
+
+template <typename T>
+void shm_spsc_queue<T>::commit(int n)
+{
+    __spsc_commit(&header_->fifo, n);
+}
+
+template <typename T>
+ring_span<T> shm_spsc_queue<T>::peek(int n)
+{
+    return __spsc_peek(&header_->fifo, arr_, n);
+}
+
+template <typename T>
+void shm_spsc_queue<T>::consume(int n)
+{
+    __spsc_consume(&header_->fifo, n);
+}
@@ -30,9 +30,11 @@ extern "C" {
 #ifndef _KFIFO_H_62
 #define _KFIFO_H_62
 
+#include <errno.h>
 #include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
 
 struct kfifo {
     pthread_spinlock_t lock; /* protects concurrent modifications */
@@ -61,6 +63,22 @@ static unsigned int kfifo_get(struct kfifo *fifo,
 static unsigned int kfifo_put(struct kfifo *fifo,
                               const void *buffer, unsigned int len);
 
+// records, length-prefixed, never mixed with the byte functions above
+static unsigned int __kfifo_rec_put(struct kfifo *fifo,
+                                    const void *buffer, unsigned int len);
+static unsigned int __kfifo_rec_peek(struct kfifo *fifo, void **ptr);
+static void __kfifo_rec_skip(struct kfifo *fifo);
+static unsigned int __kfifo_rec_get(struct kfifo *fifo,
+                                    void *buffer, unsigned int size);
+static unsigned int kfifo_rec_put(struct kfifo *fifo,
+                                  const void *buffer, unsigned int len);
+static unsigned int kfifo_rec_get(struct kfifo *fifo,
+                                  void *buffer, unsigned int size);
+
+// file descriptors, no spinlock version: never make a syscall with it held
+static ssize_t __kfifo_read_fd(struct kfifo *fifo, int fd, unsigned int len);
+static ssize_t __kfifo_write_fd(struct kfifo *fifo, int fd, unsigned int len);
+
 /**
  * __kfifo_reset - removes the entire FIFO contents, no locking version
  * @fifo: the fifo to be emptied.
@@ -294,6 +312,298 @@ static inline unsigned int __kfifo_get(struct kfifo *fifo,
     return len;
 }
 
+/*
+ * A record is a 4 bytes header of its length followed by the data, padded
+ * to 4 bytes. A record never wraps, so it can be read in place: when there
+ * is no room for it before the end of the buffer, the rest of the buffer is
+ * marked by a KFIFO_REC_PAD header and the record starts from offset 0.
+ */
+#define KFIFO_REC_HDR   4u
+#define KFIFO_REC_PAD   0xffffffffu
+#define KFIFO_REC_ALIGN(len) (((len) + KFIFO_REC_HDR - 1) & ~(KFIFO_REC_HDR - 1))
+
+/**
+ * __kfifo_rec_put - puts a record into the FIFO, no locking version
+ * @fifo: the fifo to be used, its size must be at least 16.
+ * @buffer: the data of the record.
+ * @len: the length of the record, at most size / 2 - KFIFO_REC_HDR.
+ *
+ * This function copies the whole record or nothing, and returns @len
+ * or 0 if there is not enough free space. A longer record is always
+ * rejected: it may not fit before the end of the buffer nor before the
+ * reader's offset, so it could never be put even when the FIFO is empty.
+ *
+ * Note that with only one concurrent reader and one concurrent
+ * writer, you don't need extra locking to use these functions.
+ */
+static inline unsigned int __kfifo_rec_put(struct kfifo *fifo,
+                                           const void *buffer,
+                                           unsigned int len)
+{
+    unsigned int off = fifo->in & (fifo->size - 1);
+    unsigned int tail = fifo->size - off;
+    unsigned int need = KFIFO_REC_HDR + KFIFO_REC_ALIGN(len);
+    unsigned int avail = fifo->size - fifo->in + fifo->out;
+    unsigned int pad = 0;
+
+    if (len == 0 || len > fifo->size / 2 || need > fifo->size / 2)
+        return 0;
+
+    if (need > tail)
+        pad = tail;
+
+    if (pad + need > avail)
+        return 0;
+
+    if (pad)
+    {
+        *(unsigned int *)((char *)fifo->buffer + off) = KFIFO_REC_PAD;
+        off = 0;
+    }
+
+    *(unsigned int *)((char *)fifo->buffer + off) = len;
+    memcpy((char *)fifo->buffer + off + KFIFO_REC_HDR, buffer, len);
+
+    /*
+     * Ensure that we add the record to the kfifo -before-
+     * we update the fifo->in index.
+     */
+
+    asm volatile("sfence" ::: "memory");
+
+    fifo->in += pad + need;
+
+    return len;
+}
+
+/**
+ * __kfifo_rec_peek - gets the next record in place, no locking version
+ * @fifo: the fifo to be used.
+ * @ptr: where the address of the record data is stored.
+ *
+ * This function returns the length of the next record, or 0 if the FIFO
+ * is empty. The record stays in the FIFO until __kfifo_rec_skip().
+ */
+static inline unsigned int __kfifo_rec_peek(struct kfifo *fifo, void **ptr)
+{
+    unsigned int off;
+    unsigned int len;
+
+    if (fifo->in == fifo->out)
+        return 0;
+
+    off = fifo->out & (fifo->size - 1);
+    len = *(unsigned int *)((char *)fifo->buffer + off);
+    if (len == KFIFO_REC_PAD)
+    {
+        /* the padding is always followed by a record */
+        fifo->out += fifo->size - off;
+        off = 0;
+        len = *(unsigned int *)fifo->buffer;
+    }
+
+    *ptr = (char *)fifo->buffer + off + KFIFO_REC_HDR;
+    return len;
+}
+
+/**
+ * __kfifo_rec_skip - removes the next record, no locking version
+ * @fifo: the fifo to be used.
+ *
+ * The FIFO must not be empty, usually it is called after __kfifo_rec_peek().
+ */
+static inline void __kfifo_rec_skip(struct kfifo *fifo)
+{
+    void *ptr;
+    unsigned int len = __kfifo_rec_peek(fifo, &ptr);
+
+    /*
+     * Ensure that we have done with the record -before-
+     * we update the fifo->out index.
+     */
+
+    asm volatile("sfence" ::: "memory");
+
+    fifo->out += KFIFO_REC_HDR + KFIFO_REC_ALIGN(len);
+}
+
+/**
+ * __kfifo_rec_get - gets a record from the FIFO, no locking version
+ * @fifo: the fifo to be used.
+ * @buffer: where the record must be copied.
+ * @size: the size of the destination buffer.
+ *
+ * This function copies the next record into the @buffer and returns its
+ * length, or 0 if the FIFO is empty. If the record is larger than @size,
+ * nothing is removed and the length of the record is still returned.
+ */
+static inline unsigned int __kfifo_rec_get(struct kfifo *fifo,
+                                           void *buffer, unsigned int size)
+{
+    void *ptr;
+    unsigned int len = __kfifo_rec_peek(fifo, &ptr);
+
+    if (len == 0 || len > size)
+        return len;
+
+    memcpy(buffer, ptr, len);
+    __kfifo_rec_skip(fifo);
+
+    return len;
+}
+
+/**
+ * kfifo_rec_put - puts a record into the FIFO
+ * @fifo: the fifo to be used.
+ * @buffer: the data of the record.
+ * @len: the length of the record.
+ *
+ * This function copies the whole record or nothing, and returns @len
+ * or 0 if there is not enough free space.
+ */
+static inline unsigned int kfifo_rec_put(struct kfifo *fifo,
+                                         const void *buffer, unsigned int len)
+{
+    unsigned int ret;
+
+    pthread_spin_lock(&fifo->lock);
+
+    ret = __kfifo_rec_put(fifo, buffer, len);
+
+    pthread_spin_unlock(&fifo->lock);
+
+    return ret;
+}
+
+/**
+ * kfifo_rec_get - gets a record from the FIFO
+ * @fifo: the fifo to be used.
+ * @buffer: where the record must be copied.
+ * @size: the size of the destination buffer.
+ *
+ * Same as __kfifo_rec_get(), a record larger than @size is left in the FIFO.
+ */
+static inline unsigned int kfifo_rec_get(struct kfifo *fifo,
+                                         void *buffer, unsigned int size)
+{
+    unsigned int ret;
+
+    pthread_spin_lock(&fifo->lock);
+
+    ret = __kfifo_rec_get(fifo, buffer, size);
+
+    /*
+     * optimization: if the FIFO is empty, set the indices to 0
+     * so we don't wrap the next time
+     */
+    if (fifo->in == fifo->out)
+        fifo->in = fifo->out = 0;
+
+    pthread_spin_unlock(&fifo->lock);
+
+    return ret;
+}
+
+/**
+ * __kfifo_read_fd - reads data from a file descriptor into the FIFO, no locking version
+ * @fifo: the fifo to be used.
+ * @fd: the file descriptor to read from.
+ * @len: the most bytes to be read.
+ *
+ * This function reads at most @len bytes by one readv() straight into
+ * the (up to two) free regions of the FIFO, without a buffer in between.
+ * It returns the number of bytes read, 0 at end of file or if @len is 0,
+ * or -1 with errno set by readv(), or ENOBUFS if the FIFO is full.
+ *
+ * Note that with only one concurrent reader and one concurrent
+ * writer, you don't need extra locking to use these functions.
+ */
+static inline ssize_t __kfifo_read_fd(struct kfifo *fifo, int fd, unsigned int len)
+{
+    struct iovec iov[2];
+    unsigned int l;
+    ssize_t ret;
+
+    if (len == 0)
+        return 0;
+
+    len = _min(len, fifo->size - fifo->in + fifo->out);
+    if (len == 0)
+    {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    /* first the region from fifo->in to buffer end, then the beginning */
+    l = _min(len, fifo->size - (fifo->in & (fifo->size - 1)));
+    iov[0].iov_base = (char *)fifo->buffer + (fifo->in & (fifo->size - 1));
+    iov[0].iov_len = l;
+    iov[1].iov_base = fifo->buffer;
+    iov[1].iov_len = len - l;
+
+    ret = readv(fd, iov, len > l ? 2 : 1);
+    if (ret <= 0)
+        return ret;
+
+    /*
+     * Ensure that we add the bytes to the kfifo -before-
+     * we update the fifo->in index.
+     */
+
+    asm volatile("sfence" ::: "memory");
+
+    fifo->in += ret;
+
+    return ret;
+}
+
+/**
+ * __kfifo_write_fd - writes data from the FIFO to a file descriptor, no locking version
+ * @fifo: the fifo to be used.
+ * @fd: the file descriptor to write to.
+ * @len: the most bytes to be written.
+ *
+ * This function writes at most @len bytes by one writev() straight from
+ * the (up to two) used regions of the FIFO, and removes the written ones.
+ * It returns the number of bytes written, 0 if the FIFO is empty, or -1
+ * with errno set by writev().
+ *
+ * Note that with only one concurrent reader and one concurrent
+ * writer, you don't need extra locking to use these functions.
+ */
+static inline ssize_t __kfifo_write_fd(struct kfifo *fifo, int fd, unsigned int len)
+{
+    struct iovec iov[2];
+    unsigned int l;
+    ssize_t ret;
+
+    len = _min(len, fifo->in - fifo->out);
+    if (len == 0)
+        return 0;
+
+    /* first the region from fifo->out to buffer end, then the beginning */
+    l = _min(len, fifo->size - (fifo->out & (fifo->size - 1)));
+    iov[0].iov_base = (char *)fifo->buffer + (fifo->out & (fifo->size - 1));
+    iov[0].iov_len = l;
+    iov[1].iov_base = fifo->buffer;
+    iov[1].iov_len = len - l;
+
+    ret = writev(fd, iov, len > l ? 2 : 1);
+    if (ret <= 0)
+        return ret;
+
+    /*
+     * Ensure that we remove the bytes from the kfifo -before-
+     * we update the fifo->out index.
+     */
+
+    asm volatile("sfence" ::: "memory");
+
+    fifo->out += ret;
+
+    return ret;
+}
+
 #endif
 
 #if defined (__cplusplus)
@@ -0,0 +1,263 @@
+/*
+  Copyright (c) 2021 wujiaxu <void00@foxmail.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+/*
+ * A byte FIFO for many writers and many readers, without the spinlock of
+ * kfifo_put/kfifo_get. The same API shape as kfifo.h, mpkfifo_* instead of
+ * kfifo_*, so C callers can switch.
+ *
+ * Each side has two indices. A writer reserves a byte range by CAS on
+ * in_head, copies its data while other writers copy theirs, then waits for
+ * the writers before it and publishes in = end of its range. Readers do the
+ * same with out_head and out. A reader sees only the bytes before in, which
+ * are complete, and in the order they were reserved.
+ *
+ * A writer (or reader) preempted between reserve and publish holds up the
+ * ones after it on the same side, but never the other side. They spin
+ * MPKFIFO_SPIN times, then sched_yield until it publishes.
+ */
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#ifndef _MPKFIFO_H_62
+#define _MPKFIFO_H_62
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MPKFIFO_CACHELINE 64
+#define MPKFIFO_SPIN 128
+
+struct mpkfifo {
+    void *buffer;            /* the buffer holding the data */
+    unsigned int size;       /* the size of the allocated buffer */
+
+    /* writers, data is reserved up to in_head and readable up to in */
+    unsigned int in_head __attribute__((aligned(MPKFIFO_CACHELINE)));
+    unsigned int in;
+
+    /* readers, data is reserved up to out_head and freed up to out */
+    unsigned int out_head __attribute__((aligned(MPKFIFO_CACHELINE)));
+    unsigned int out;
+};
+
+static struct mpkfifo *mpkfifo_alloc(unsigned int size);
+static void mpkfifo_free(struct mpkfifo *fifo);
+
+/* any number of writers and readers, each publishes in reserve order */
+static unsigned int mpkfifo_len(const struct mpkfifo *fifo);
+static unsigned int mpkfifo_put(struct mpkfifo *fifo,
+                                const void *buffer, unsigned int len);
+static unsigned int mpkfifo_get(struct mpkfifo *fifo,
+                                void *buffer, unsigned int len);
+
+static inline unsigned int mpkfifo_min(unsigned int a, unsigned int b)
+{
+    return (a < b) ? a : b;
+}
+
+static inline void mpkfifo_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __asm__ __volatile__("pause" ::: "memory");
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield" ::: "memory");
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+/*
+ * Wait until the ones before this writer (or reader) publish @idx up to
+ * @head. Spin a while, then yield the CPU, the one holding us up may have
+ * been preempted and need the CPU we are spinning on.
+ */
+static inline void mpkfifo_wait(const unsigned int *idx, unsigned int head)
+{
+    int spin = 0;
+
+    while (__atomic_load_n(idx, __ATOMIC_ACQUIRE) != head)
+    {
+        if (++spin < MPKFIFO_SPIN)
+            mpkfifo_relax();
+        else
+            sched_yield();
+    }
+}
+
+/**
+ * mpkfifo_alloc - allocates a new FIFO and its internal buffer
+ * @size: the size of the internal buffer to be allocated.
+ *
+ * size MUST be a power of 2
+ */
+static inline struct mpkfifo *mpkfifo_alloc(unsigned int size)
+{
+    void *buffer;
+    void *ptr;
+    struct mpkfifo *fifo;
+
+    /* size must be a power of 2 */
+    if ((size < 2) || (size & (size - 1)))
+        return NULL;
+
+    buffer = malloc(size);
+    if (!buffer)
+        return NULL;
+
+    if (posix_memalign(&ptr, MPKFIFO_CACHELINE, sizeof(struct mpkfifo)) != 0)
+    {
+        free(buffer);
+        return NULL;
+    }
+
+    fifo = (struct mpkfifo *)ptr;
+    fifo->buffer = buffer;
+    fifo->size = size;
+    fifo->in_head = fifo->in = 0;
+    fifo->out_head = fifo->out = 0;
+
+    return fifo;
+}
+
+/**
+ * mpkfifo_free - frees the FIFO
+ * @fifo: the fifo to be freed.
+ */
+static inline void mpkfifo_free(struct mpkfifo *fifo)
+{
+    free(fifo->buffer);
+    free(fifo);
+}
+
+/**
+ * mpkfifo_len - returns the number of bytes available in the FIFO
+ * @fifo: the fifo to be used.
+ *
+ * Bytes still being copied by a writer are not counted.
+ */
+static inline unsigned int mpkfifo_len(const struct mpkfifo *fifo)
+{
+    return __atomic_load_n(&fifo->in, __ATOMIC_ACQUIRE) -
+           __atomic_load_n(&fifo->out, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * mpkfifo_put - puts some data into the FIFO
+ * @fifo: the fifo to be used.
+ * @buffer: the data to be added.
+ * @len: the length of the data to be added.
+ *
+ * Unlike kfifo_put(), this function copies all of the @len bytes or
+ * nothing, and returns @len or 0 if there is not enough free space, so
+ * the data of one call is never split by another writer.
+ */
+static inline unsigned int mpkfifo_put(struct mpkfifo *fifo,
+                                       const void *buffer, unsigned int len)
+{
+    unsigned int head;
+    unsigned int off;
+    unsigned int l;
+
+    if (len == 0)
+        return 0;
+
+    head = __atomic_load_n(&fifo->in_head, __ATOMIC_RELAXED);
+    do
+    {
+        /* out is loaded after head, so the free space is never overrated */
+        l = fifo->size - head + __atomic_load_n(&fifo->out, __ATOMIC_ACQUIRE);
+        if (l < len)
+            return 0;
+    } while (!__atomic_compare_exchange_n(&fifo->in_head, &head, head + len, 1,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    /* first put the data starting from head to buffer end */
+    off = head & (fifo->size - 1);
+    l = mpkfifo_min(len, fifo->size - off);
+    memcpy((char *)fifo->buffer + off, buffer, l);
+
+    /* then put the rest (if any) at the beginning of the buffer */
+    memcpy(fifo->buffer, (const char *)buffer + l, len - l);
+
+    /* the writers before this one publish first, their data comes with it */
+    mpkfifo_wait(&fifo->in, head);
+
+    /*
+     * Ensure that we add the bytes to the mpkfifo -before-
+     * we update the fifo->in index.
+     */
+    __atomic_store_n(&fifo->in, head + len, __ATOMIC_RELEASE);
+
+    return len;
+}
+
+/**
+ * mpkfifo_get - gets some data from the FIFO
+ * @fifo: the fifo to be used.
+ * @buffer: where the data must be copied.
+ * @len: the size of the destination buffer.
+ *
+ * This function copies at most @len bytes from the FIFO into the
+ * @buffer and returns the number of copied bytes.
+ */
+static inline unsigned int mpkfifo_get(struct mpkfifo *fifo,
+                                       void *buffer, unsigned int len)
+{
+    unsigned int head;
+    unsigned int off;
+    unsigned int n;
+    unsigned int l;
+
+    head = __atomic_load_n(&fifo->out_head, __ATOMIC_RELAXED);
+    do
+    {
+        l = __atomic_load_n(&fifo->in, __ATOMIC_ACQUIRE) - head;
+        n = mpkfifo_min(len, l);
+        if (n == 0)
+            return 0;
+    } while (!__atomic_compare_exchange_n(&fifo->out_head, &head, head + n, 1,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    len = n;
+
+    /* first get the data from head until the end of the buffer */
+    off = head & (fifo->size - 1);
+    l = mpkfifo_min(len, fifo->size - off);
+    memcpy(buffer, (char *)fifo->buffer + off, l);
+
+    /* then get the rest (if any) from the beginning of the buffer */
+    memcpy((char *)buffer + l, fifo->buffer, len - l);
+
+    /* the readers before this one publish first */
+    mpkfifo_wait(&fifo->out, head);
+
+    /*
+     * Ensure that we remove the bytes from the mpkfifo -before-
+     * we update the fifo->out index.
+     */
+    __atomic_store_n(&fifo->out, head + len, __ATOMIC_RELEASE);
+
+    return len;
+}
+
+#endif
+
+#if defined (__cplusplus)
+}
+#endif
@@ -13,12 +13,30 @@
   See the License for the specific language governing permissions and
   limitations under the License.
 */
+#include <algorithm>
 #include <atomic>
 #include <map>
+#include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
 #include <gtest/gtest.h>
+// kfifo.h first, its global _min is hidden by the one of queue62.hpp
+#include "../optional/kfifo.h"
+#include "../optional/mpkfifo.h"
 #include "queue62.hpp"
+#include "blocking_queue62.hpp"
+#include "shm_queue62.hpp"
+#include "executor62.hpp"
+#include "fd_queue62.hpp"
+#include "mmap_queue62.hpp"
+#include "eventfd_queue62.hpp"
+#include "coro_queue62.hpp"
 
 void check1(int range, int n, std::map<int, int>& counter)
 {
@@ -308,3 +326,1957 @@ TEST(unittest, case5)
     EXPECT_EQ(que.size(), 0);
     check2(2048, 8, counter1, counter2);
 }
+
+TEST(unittest, case6)
+{
+    spsc_queue<std::string> que(1000);
+    mpmc_queue<int> _q(3);
+    std::string str;
+    int res;
+    int cnt = 0;
+
+    while (que.push(std::to_string(cnt)))
+        cnt++;
+
+    EXPECT_EQ(cnt, 1024);
+    EXPECT_EQ(que.read_available(), 1024);
+    for (int i = 0; i < cnt; i++)
+    {
+        EXPECT_TRUE(que.pop(str));
+        EXPECT_EQ(str, std::to_string(i));
+    }
+    EXPECT_FALSE(que.pop(str));
+
+    cnt = 0;
+    while (_q.push(cnt))
+        cnt++;
+
+    EXPECT_EQ(cnt, 4);
+    EXPECT_EQ(_q.size(), 4);
+    for (int i = 0; i < cnt; i++)
+    {
+        EXPECT_TRUE(_q.pop(res));
+        EXPECT_EQ(res, i);
+    }
+    EXPECT_TRUE(_q.empty());
+}
+
+TEST(unittest, case7)
+{
+    spsc_queue<int, 64> que;
+    std::atomic<int> pusher(1);
+    std::map<int, int> counter1;
+
+    auto&& push = [&que, &pusher]() {
+        int i = 0;
+        while (i < 2048)
+        {
+            ring_span<int> span = que.reserve(std::min(7, 2048 - i));
+            if (span.size() == 0)
+            {
+                // full
+                std::this_thread::yield();
+                continue;
+            }
+
+            for (int k = 0; k < 2; k++)
+                for (int j = 0; j < span.len[k]; j++)
+                    span.data[k][j] = i++;
+
+            que.commit(span.size());
+        }
+        --pusher;
+    };
+
+    auto&& pop = [&que, &pusher](std::map<int, int>& counter) {
+        int expect = 0;
+        while (que.read_available() > 0 || pusher > 0)
+        {
+            ring_span<int> span = que.peek(5);
+            if (span.size() == 0)
+            {
+                // empty
+                std::this_thread::yield();
+                continue;
+            }
+
+            for (int k = 0; k < 2; k++)
+            {
+                for (int j = 0; j < span.len[k]; j++)
+                {
+                    EXPECT_EQ(span.data[k][j], expect++);
+                    counter[span.data[k][j]]++;
+                }
+            }
+
+            que.consume(span.size());
+        }
+    };
+
+    std::thread in1(push);
+    std::thread out1(pop, std::ref(counter1));
+    in1.join();
+    out1.join();
+    EXPECT_EQ(que.read_available(), 0);
+    check1(2048, 1, counter1);
+}
+
+struct Order
+{
+    int64_t id;
+    int64_t price;
+    int64_t qty;
+    char symbol[24];
+};
+
+TEST(unittest, case8)
+{
+    static_assert(sizeof (Order) == 48, "Order is 48 bytes");
+    mpmc_queue<Order, 64> que;
+    std::atomic<int> pusher(4);
+    std::map<int, int> counter1;
+    std::map<int, int> counter2;
+
+    auto&& push = [&que, &pusher]() {
+        Order order;
+        int i = 0;
+        while (i < 2048)
+        {
+            order.id = i;
+            order.price = i * 2;
+            order.qty = i * 3;
+            snprintf(order.symbol, sizeof order.symbol, "%d", i);
+            bool succ = que.push(order);
+            if (!succ)
+            {
+                // full
+                std::this_thread::yield();
+                continue;
+            }
+            i++;
+        }
+        --pusher;
+    };
+
+    auto&& pop = [&que, &pusher](std::map<int, int>& counter) {
+        Order order;
+        while (!que.empty() || pusher > 0)
+        {
+            bool succ = que.pop(order);
+            if (!succ)
+            {
+                // empty
+                std::this_thread::yield();
+                continue;
+            }
+            int res = (int)order.id;
+            EXPECT_LE(0, res);
+            EXPECT_LT(res, 2048);
+            EXPECT_EQ(order.price, res * 2);
+            EXPECT_EQ(order.qty, res * 3);
+            EXPECT_EQ(atoi(order.symbol), res);
+            counter[res]++;
+        }
+    };
+
+    std::thread in1(push);
+    std::thread in2(push);
+    std::thread in3(push);
+    std::thread in4(push);
+    std::thread out1(pop, std::ref(counter1));
+    std::thread out2(pop, std::ref(counter2));
+    in1.join();
+    in2.join();
+    in3.join();
+    in4.join();
+    out1.join();
+    out2.join();
+    EXPECT_EQ(que.size(), 0);
+    check2(2048, 4, counter1, counter2);
+}
+
+template <typename T, typename MAKE, typename PARSE>
+void batch_mpmc(MAKE make, PARSE parse)
+{
+    mpmc_queue<T, 64> que;
+    std::atomic<int> pusher(4);
+    std::map<int, int> counter1;
+    std::map<int, int> counter2;
+
+    auto&& push = [&que, &pusher, make]() {
+        T arr[32];
+        int i = 0;
+        while (i < 2048)
+        {
+            int n = std::min(1 + i % 32, 2048 - i);
+            for (int k = 0; k < n; k++)
+                arr[k] = make(i + k);
+
+            for (int sz = 0; sz < n; )
+            {
+                int cnt = que.push(arr + sz, n - sz);
+                if (cnt == 0)
+                {
+                    // full
+                    std::this_thread::yield();
+                }
+                sz += cnt;
+            }
+            i += n;
+        }
+        --pusher;
+    };
+
+    auto&& pop = [&que, &pusher, parse](std::map<int, int>& counter) {
+        T arr[16];
+        while (!que.empty() || pusher > 0)
+        {
+            int sz = que.pop(arr, 16);
+            if (sz == 0)
+            {
+                // empty
+                std::this_thread::yield();
+                continue;
+            }
+            for (int k = 0; k < sz; k++)
+            {
+                int res = parse(arr[k]);
+                EXPECT_LE(0, res);
+                EXPECT_LT(res, 2048);
+                counter[res]++;
+            }
+        }
+    };
+
+    std::thread in1(push);
+    std::thread in2(push);
+    std::thread in3(push);
+    std::thread in4(push);
+    std::thread out1(pop, std::ref(counter1));
+    std::thread out2(pop, std::ref(counter2));
+    in1.join();
+    in2.join();
+    in3.join();
+    in4.join();
+    out1.join();
+    out2.join();
+    EXPECT_EQ(que.size(), 0);
+    check2(2048, 4, counter1, counter2);
+}
+
+TEST(unittest, case9)
+{
+    // inline slots
+    batch_mpmc<int>([](int i) { return i; },
+                    [](int res) { return res; });
+
+    // pointer
+    batch_mpmc<std::string *>([](int i) { return new std::string(std::to_string(i)); },
+                              [](std::string *p) { int res = atoi(p->c_str()); delete p; return res; });
+
+    // holder
+    batch_mpmc<std::string>([](int i) { return std::to_string(i); },
+                            [](const std::string& str) { return atoi(str.c_str()); });
+}
+
+TEST(unittest, case10)
+{
+    blocking_queue<spsc_queue<std::string, 4>> que;
+    blocking_queue<mpmc_queue<int, 4>> _q;
+    std::atomic<int> pusher(2);
+    std::map<int, int> counter1;
+    std::map<int, int> counter2;
+    std::string str;
+    int res;
+
+    EXPECT_FALSE(que.pop_wait_for(str, std::chrono::milliseconds(10)));
+    EXPECT_FALSE(_q.pop_wait_for(res, std::chrono::milliseconds(10)));
+
+    auto&& push1 = [&que]() {
+        for (int i = 0; i < 2048; i++)
+        {
+            if (i % 512 == 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+            que.push_wait(std::to_string(i));
+        }
+    };
+
+    auto&& pop1 = [&que](std::map<int, int>& counter) {
+        std::string str;
+        for (int i = 0; i < 2048; i++)
+        {
+            que.pop_wait(str);
+            EXPECT_EQ(atoi(str.c_str()), i);
+            counter[i]++;
+        }
+    };
+
+    auto&& push2 = [&_q, &pusher]() {
+        for (int i = 0; i < 2048; i++)
+            _q.push_wait(i);
+
+        --pusher;
+    };
+
+    auto&& pop2 = [&_q, &pusher](std::map<int, int>& counter) {
+        int res;
+        while (!_q.queue().empty() || pusher > 0)
+        {
+            if (!_q.pop_wait_for(res, std::chrono::milliseconds(1)))
+                continue;
+
+            EXPECT_LE(0, res);
+            EXPECT_LT(res, 2048);
+            counter[res]++;
+        }
+    };
+
+    std::thread in1(push1);
+    std::thread out1(pop1, std::ref(counter1));
+    in1.join();
+    out1.join();
+    EXPECT_EQ(que.queue().read_available(), 0);
+    check1(2048, 1, counter1);
+
+    counter1.clear();
+    std::thread in2(push2);
+    std::thread in3(push2);
+    std::thread out2(pop2, std::ref(counter1));
+    std::thread out3(pop2, std::ref(counter2));
+    in2.join();
+    in3.join();
+    out2.join();
+    out3.join();
+    EXPECT_TRUE(_q.queue().empty());
+    check2(2048, 2, counter1, counter2);
+}
+
+TEST(unittest, case11)
+{
+    std::string name = "/queue62_unittest_" + std::to_string(getpid());
+    shm_spsc_queue<int> que;
+    std::map<int, int> counter1;
+    int arr[16];
+
+    shm_spsc_queue<int>::remove(name.c_str());
+    ASSERT_TRUE(que.create(name.c_str(), 60));
+    EXPECT_FALSE(shm_spsc_queue<int>().create(name.c_str(), 64));
+    EXPECT_EQ(errno, EEXIST);
+    EXPECT_FALSE(shm_spsc_queue<long>().attach(name.c_str()));
+    EXPECT_EQ(errno, EINVAL);
+
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0)
+    {
+        shm_spsc_queue<int> child;
+        int i = 0;
+
+        if (!child.attach(name.c_str()))
+            _exit(1);
+
+        while (i < 2048)
+        {
+            int n = std::min(1 + i % 16, 2048 - i);
+            for (int k = 0; k < n; k++)
+                arr[k] = i + k;
+
+            int sz = n == 1 ? child.push(arr[0]) : child.push(arr, n);
+            if (sz == 0)
+            {
+                // full
+                std::this_thread::yield();
+                continue;
+            }
+            i += sz;
+        }
+        _exit(0);
+    }
+
+    // the child may exit right after its last push, so it is reaped only
+    // once at the end, a dead child is caught by the deadline instead
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    int expect = 0;
+    int status;
+    while (expect < 2048 && std::chrono::steady_clock::now() < deadline)
+    {
+        int sz = que.pop(arr, 16);
+        if (sz == 0)
+        {
+            // empty
+            std::this_thread::yield();
+            continue;
+        }
+        for (int k = 0; k < sz; k++)
+        {
+            EXPECT_EQ(arr[k], expect++);
+            counter1[arr[k]]++;
+        }
+    }
+
+    EXPECT_EQ(expect, 2048);
+    EXPECT_EQ(waitpid(pid, &status, 0), pid);
+    EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    EXPECT_EQ(que.read_available(), 0);
+    EXPECT_EQ(shm_spsc_queue<int>::remove(name.c_str()), 0);
+    check1(2048, 1, counter1);
+}
+
+TEST(unittest, case12)
+{
+    struct kfifo *fifo = kfifo_alloc(64);
+    char buf[64] = {0};
+    void *ptr = NULL;
+
+    // 4 bytes header, data padded to 4 bytes
+    EXPECT_EQ(__kfifo_rec_put(fifo, "hello", 5), 5u);
+    EXPECT_EQ(__kfifo_rec_put(fifo, "protobuf frame", 14), 14u);
+    EXPECT_EQ(__kfifo_len(fifo), 12u + 20u);
+    EXPECT_EQ(__kfifo_rec_put(fifo, buf, 29), 0u);    // all or nothing
+    EXPECT_EQ(__kfifo_rec_put(fifo, buf, 28), 28u);
+
+    EXPECT_EQ(__kfifo_rec_peek(fifo, &ptr), 5u);
+    EXPECT_EQ(memcmp(ptr, "hello", 5), 0);
+    __kfifo_rec_skip(fifo);
+    EXPECT_EQ(__kfifo_rec_get(fifo, buf, 4), 14u);    // too small, still there
+    EXPECT_EQ(__kfifo_rec_get(fifo, buf, sizeof (buf)), 14u);
+    EXPECT_EQ(memcmp(buf, "protobuf frame", 14), 0);
+
+    EXPECT_EQ(__kfifo_rec_get(fifo, buf, sizeof (buf)), 28u);
+    EXPECT_EQ(__kfifo_rec_peek(fifo, &ptr), 0u);
+    EXPECT_EQ(__kfifo_rec_put(fifo, buf, 61), 0u);
+    EXPECT_EQ(__kfifo_rec_put(fifo, buf, 29), 0u);    // at most size / 2 - 4
+
+    // only 16 bytes before the end, the record moves to offset 0
+    EXPECT_EQ(__kfifo_rec_put(fifo, buf, 24), 24u);
+    EXPECT_EQ(__kfifo_rec_get(fifo, buf, sizeof (buf)), 24u);
+    EXPECT_EQ(__kfifo_rec_put(fifo, buf, 16), 16u);
+    EXPECT_EQ(__kfifo_rec_get(fifo, buf, sizeof (buf)), 16u);
+    EXPECT_EQ(__kfifo_rec_put(fifo, "0123456789abcdefghij", 20), 20u);
+    EXPECT_EQ(__kfifo_len(fifo), 16u + 24u);
+    EXPECT_EQ(__kfifo_rec_peek(fifo, &ptr), 20u);
+    EXPECT_EQ(ptr, (char *)fifo->buffer + 4);
+    EXPECT_EQ(memcmp(ptr, "0123456789abcdefghij", 20), 0);
+    __kfifo_rec_skip(fifo);
+    EXPECT_EQ(__kfifo_len(fifo), 0u);
+
+    // in = out = 32 after a 28 bytes record, 56 bytes would never fit
+    EXPECT_EQ(__kfifo_rec_put(fifo, buf, 28), 28u);
+    EXPECT_EQ(__kfifo_rec_get(fifo, buf, sizeof (buf)), 28u);
+    EXPECT_EQ(__kfifo_rec_put(fifo, buf, 56), 0u);
+
+    // the longest record always fits an empty fifo, at any offset
+    for (int i = 0; i < 16; i++)
+    {
+        EXPECT_EQ(__kfifo_rec_put(fifo, buf, 28), 28u);
+        EXPECT_EQ(__kfifo_rec_get(fifo, buf, sizeof (buf)), 28u);
+        EXPECT_EQ(__kfifo_rec_put(fifo, buf, 1 + i % 4), 1u + i % 4);
+        EXPECT_EQ(__kfifo_rec_get(fifo, buf, sizeof (buf)), 1u + i % 4);
+    }
+
+    kfifo_free(fifo);
+
+    fifo = kfifo_alloc(1024);
+    std::thread producer([fifo]() {
+        char rec[300];
+        for (int i = 0; i < 20000; )
+        {
+            int len = 1 + i % 300;
+            memset(rec, (char)i, len);
+            if (__kfifo_rec_put(fifo, rec, len) == 0)
+                std::this_thread::yield();
+            else
+                i++;
+        }
+    });
+
+    for (int i = 0; i < 20000; )
+    {
+        unsigned int len = __kfifo_rec_peek(fifo, &ptr);
+        if (len == 0)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        ASSERT_EQ(len, (unsigned int)(1 + i % 300));
+        for (unsigned int k = 0; k < len; k++)
+            ASSERT_EQ(((char *)ptr)[k], (char)i);
+
+        __kfifo_rec_skip(fifo);
+        i++;
+    }
+
+    producer.join();
+    EXPECT_EQ(__kfifo_len(fifo), 0u);
+    kfifo_free(fifo);
+}
+
+// every producer's elements come out in its own order
+template <typename QUEUE, typename MAKE, typename PARSE>
+void order_mpsc(QUEUE& que, MAKE make, PARSE parse)
+{
+    std::vector<std::thread> threads;
+    std::vector<int> last(4, -1);
+    std::map<int, int> counter1;
+    decltype(make(0)) arr[8];
+    int total = 0;
+
+    for (int p = 0; p < 4; p++)
+    {
+        threads.emplace_back([&que, &make, p]() {
+            decltype(make(0)) two[2];
+            for (int i = 0; i < 4096; )
+            {
+                int n = i % 3 == 0 && i + 1 < 4096 ? 2 : 1;
+                two[0] = make(p * 4096 + i);
+                two[1] = make(p * 4096 + i + 1);
+
+                int sz = n == 1 ? que.push(std::move(two[0])) : que.push(two, n);
+                if (sz == 0)
+                    std::this_thread::yield();
+
+                i += sz;
+            }
+        });
+    }
+
+    while (total < 4 * 4096)
+    {
+        int sz = total % 2 ? que.pop(arr, 8) : que.pop(arr[0]);
+        if (sz == 0)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        for (int k = 0; k < sz; k++)
+        {
+            int res = parse(arr[k]);
+            EXPECT_GT(res % 4096, last[res / 4096]);
+            last[res / 4096] = res % 4096;
+            counter1[res]++;
+        }
+
+        total += sz;
+    }
+
+    for (auto& th : threads)
+        th.join();
+
+    EXPECT_TRUE(que.empty());
+    check1(4 * 4096, 1, counter1);
+}
+
+// copy of a negative val throws, move never throws
+struct throw_copy
+{
+    throw_copy(int v = 0) : val(v) { }
+    throw_copy(const throw_copy& other) : val(other.val)
+    {
+        if (val < 0)
+            throw std::runtime_error("throw_copy");
+    }
+    throw_copy(throw_copy&& other) noexcept : val(other.val) { }
+    throw_copy& operator=(const throw_copy& other) = default;
+    throw_copy& operator=(throw_copy&& other) = default;
+
+    int val;
+};
+
+TEST(unittest, case13)
+{
+    mpsc_queue<int, 64> que;
+    mpsc_queue<std::string> _q(60);
+    std::string str;
+    int res;
+
+    EXPECT_FALSE(que.pop(res));
+    for (int i = 0; i < 64; i++)
+        EXPECT_TRUE(que.push(i));
+
+    EXPECT_FALSE(que.push(64));
+    EXPECT_EQ(que.size(), 64u);
+    EXPECT_EQ(que.pop(&res, 1), 1);
+    EXPECT_EQ(res, 0);
+    while (que.pop(res))
+        ;
+
+    EXPECT_TRUE(que.empty());
+    order_mpsc(que, [](int i) { return i; },
+               [](int res) { return res; });
+
+    order_mpsc(_q, [](int i) { return std::to_string(i); },
+               [](const std::string& str) { return atoi(str.c_str()); });
+
+    // freed by destructor
+    EXPECT_TRUE(_q.push("abc"));
+    EXPECT_TRUE(_q.push(std::string(100, 'x')));
+    EXPECT_TRUE(_q.pop(str));
+    EXPECT_EQ(str, "abc");
+
+    // a throwing copy takes no slot, the consumer is not wedged
+    mpsc_queue<throw_copy, 4> tq;
+    throw_copy arr[3] = {1, -1, 3};
+    throw_copy t;
+
+    EXPECT_THROW(tq.push(arr[1]), std::runtime_error);
+    EXPECT_TRUE(tq.push(throw_copy(2)));
+    EXPECT_THROW(tq.push(arr, 3), std::runtime_error);
+    EXPECT_TRUE(tq.pop(t));
+    EXPECT_EQ(t.val, 2);
+    EXPECT_TRUE(tq.pop(t));
+    EXPECT_EQ(t.val, 1);
+    EXPECT_FALSE(tq.pop(t));
+    EXPECT_EQ(tq.push(arr, 1), 1);
+    EXPECT_TRUE(tq.pop(t));
+    EXPECT_EQ(t.val, 1);
+}
+
+TEST(unittest, case14)
+{
+    broadcast_queue<int, 64> que(3);
+    broadcast_queue<long, 0, true> _q(64, 2);
+    std::vector<std::thread> threads;
+    int res;
+
+    EXPECT_FALSE(que.pop(0, res));
+    for (int i = 0; i < 64; i++)
+        EXPECT_TRUE(que.push(i));
+
+    // gated by the slowest one
+    EXPECT_FALSE(que.push(64));
+    EXPECT_TRUE(que.pop(0, res) && que.pop(1, res));
+    EXPECT_FALSE(que.push(64));
+    EXPECT_TRUE(que.pop(2, res));
+    EXPECT_TRUE(que.push(64));
+    EXPECT_EQ(que.read_available(2), 64);
+    for (unsigned int id = 0; id < 3; id++)
+    {
+        while (que.pop(id, res))
+            ;
+    }
+
+    threads.emplace_back([&que]() {
+        for (int i = 65; i < 65 + 8192; )
+        {
+            ring_span<int> span = que.reserve(7);
+            int n = 0;
+
+            for (int k = 0; k < 2; k++)
+                for (int j = 0; j < span.len[k]; j++)
+                    span.data[k][j] = i + n++;
+
+            que.commit(n);
+            if (n == 0)
+                std::this_thread::yield();
+
+            i += n;
+        }
+    });
+
+    for (unsigned int id = 0; id < 3; id++)
+    {
+        threads.emplace_back([&que, id]() {
+            int arr[5];
+            for (int expect = 65; expect < 65 + 8192; )
+            {
+                int sz;
+                if (id == 2)
+                {
+                    ring_span<const int> span = que.peek(id, 5);
+                    sz = span.size();
+                    for (int k = 0; k < 2; k++)
+                        for (int j = 0; j < span.len[k]; j++)
+                            EXPECT_EQ(span.data[k][j], expect++);
+
+                    que.consume(id, sz);
+                }
+                else
+                {
+                    sz = id == 0 ? que.pop(id, arr[0]) : que.pop(id, arr, 5);
+                    for (int k = 0; k < sz; k++)
+                        EXPECT_EQ(arr[k], expect++);
+                }
+
+                if (sz == 0)
+                    std::this_thread::yield();
+            }
+        });
+    }
+
+    for (auto& th : threads)
+        th.join();
+
+    EXPECT_EQ(que.read_available(0), 0);
+    EXPECT_EQ(que.dropped(0), 0u);
+
+    // lossy, the producer never waits for consumer 1
+    threads.clear();
+    threads.emplace_back([&_q]() {
+        for (long i = 0; i < 100000; i++)
+            EXPECT_TRUE(_q.push(i));
+    });
+
+    for (unsigned int id = 0; id < 2; id++)
+    {
+        threads.emplace_back([&_q, id]() {
+            long arr[4];
+            long last = -1;
+            long received = 0;
+
+            while (last < 100000 - 1)
+            {
+                int sz = _q.pop(id, arr, 4);
+                for (int k = 0; k < sz; k++)
+                {
+                    EXPECT_GT(arr[k], last);
+                    last = arr[k];
+                }
+
+                received += sz;
+                if (id == 1 && received % 1000 < 4)
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+
+            EXPECT_EQ(received + (long)_q.dropped(id), 100000);
+        });
+    }
+
+    for (auto& th : threads)
+        th.join();
+
+    // overrun, the slot being overwritten next is skipped too
+    broadcast_queue<long, 64, true> lossy(1);
+    long arr[64];
+    for (long i = 0; i < 100; i++)
+        lossy.push(i);
+
+    EXPECT_EQ(lossy.read_available(0), 100);
+    EXPECT_EQ(lossy.pop(0, arr, 64), 63);
+    EXPECT_EQ(arr[0], 37);
+    EXPECT_EQ(arr[62], 99);
+    EXPECT_EQ(lossy.dropped(0), 37u);
+
+    // a batch push laps the reader, pop moves on before in is published
+    __bcast_fifo fifo;
+    __bcast_slot<long> slots[8] = {};
+    long batch[3] = {8, 9, 10};
+    __bcast_init(&fifo, slots, 8, 1);
+    for (long i = 0; i < 8; i++)
+        __bcast_worker<long, true>::push(&fifo, slots, &i, 1);
+
+    __bcast_worker<long, true>::push(&fifo, slots, batch, 3);
+    fifo.in = 8;    // 8 .. 10 are written, in is not published yet
+    EXPECT_EQ((__bcast_worker<long, true>::pop(&fifo, slots, 0, arr, 8)), 5);
+    EXPECT_EQ(arr[0], 3);
+    EXPECT_EQ(arr[4], 7);
+    EXPECT_EQ(fifo.cursors[0].dropped.load(), 3u);
+    free(fifo.cursors);
+}
+
+TEST(unittest, case15)
+{
+    ws_deque<int *, 4> que;
+    ws_deque<int *> _q(2);
+    std::vector<int> tasks(100000);
+    std::vector<std::atomic<int>> taken(tasks.size());
+    std::atomic<bool> done(false);
+    std::vector<std::thread> thieves;
+    int *p;
+
+    for (int i = 0; i < 4; i++)
+        EXPECT_TRUE(que.push(&tasks[i]));
+
+    EXPECT_FALSE(que.push(&tasks[4]));
+    EXPECT_EQ(que.size(), 4u);
+    EXPECT_TRUE(que.pop(p));      // bottom, LIFO
+    EXPECT_EQ(p, &tasks[3]);
+    EXPECT_TRUE(que.steal(p));    // top, FIFO
+    EXPECT_EQ(p, &tasks[0]);
+    EXPECT_TRUE(que.pop(p) && que.pop(p));
+    EXPECT_EQ(p, &tasks[1]);
+    EXPECT_FALSE(que.pop(p));
+    EXPECT_FALSE(que.steal(p));
+    EXPECT_TRUE(que.empty());
+
+    // grows from 2, every task is taken exactly once
+    for (int k = 0; k < 3; k++)
+    {
+        thieves.emplace_back([&_q, &tasks, &taken, &done]() {
+            int *p;
+            while (!done || !_q.empty())
+            {
+                if (_q.steal(p))
+                    taken[p - tasks.data()]++;
+                else
+                    std::this_thread::yield();
+            }
+        });
+    }
+
+    for (size_t i = 0; i < tasks.size(); i++)
+    {
+        EXPECT_TRUE(_q.push(&tasks[i]));
+        if (i % 3 == 0 && _q.pop(p))
+            taken[p - tasks.data()]++;
+    }
+
+    while (_q.pop(p))
+        taken[p - tasks.data()]++;
+
+    done = true;
+    for (auto& th : thieves)
+        th.join();
+
+    for (size_t i = 0; i < tasks.size(); i++)
+        EXPECT_EQ(taken[i], 1);
+}
+
+TEST(unittest, case16)
+{
+    std::vector<std::atomic<int>> ran(30000);
+    std::vector<std::thread> submitters;
+
+    {
+        // small inboxes and overflow, so both of them get full
+        executor<> ex(4, 8, 16);
+
+        EXPECT_EQ(ex.workers(), 4);
+        EXPECT_EQ(ex.pin({0}), 0);
+        EXPECT_EQ(ex.submit((executor<>::task *)NULL, 0), 0);
+        EXPECT_EQ(ex.submit((executor<>::task *)NULL, -1), 0);
+
+        for (int k = 0; k < 3; k++)
+        {
+            submitters.emplace_back([&ex, &ran, k]() {
+                int begin = k * 10000;
+                int end = begin + 10000;
+
+                if (k == 0)
+                {
+                    for (int i = begin; i < end; i++)
+                    {
+                        while (!ex.submit([&ran, i]() { ran[i]++; }))
+                            std::this_thread::yield();
+                    }
+
+                    return;
+                }
+
+                for (int i = begin; i < end; )
+                {
+                    executor<>::task arr[7];
+                    int n = std::min(7, end - i);
+                    int sz = 0;
+
+                    for (int j = 0; j < n; j++)
+                    {
+                        int id = i + j;
+                        arr[j] = [&ran, id]() { ran[id]++; };
+                    }
+
+                    while (sz < n)
+                    {
+                        int cnt = ex.submit(arr + sz, n - sz);
+                        if (cnt == 0)
+                            std::this_thread::yield();
+
+                        sz += cnt;
+                    }
+
+                    i += n;
+                }
+            });
+        }
+
+        for (auto& th : submitters)
+            th.join();
+
+        // every worker sleeps, then is woken up again
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        std::atomic<int> late(0);
+        for (int i = 0; i < 16; i++)
+            EXPECT_TRUE(ex.submit([&late]() { late++; }));
+
+        ex.shutdown();
+        EXPECT_EQ(late, 16);
+    }
+
+    for (size_t i = 0; i < ran.size(); i++)
+        EXPECT_EQ(ran[i], 1);
+}
+
+TEST(unittest, case17)
+{
+    unbounded_spsc_queue<int> que(4);
+    unbounded_spsc_queue<std::string> _q(16);
+    int arr[10];
+    int v;
+
+    // never full, segments of 4 are linked and drained in order
+    for (int i = 0; i < 1000; i++)
+        EXPECT_TRUE(que.push(i));
+
+    for (int i = 0; i < 1000; i++)
+    {
+        EXPECT_TRUE(que.pop(v));
+        EXPECT_EQ(v, i);
+    }
+
+    EXPECT_FALSE(que.pop(v));
+    EXPECT_TRUE(que.empty());
+
+    for (int i = 0; i < 10; i++)
+        arr[i] = i;
+
+    EXPECT_EQ(que.push(arr, 10), 10);
+    EXPECT_TRUE(que.push(10));
+    EXPECT_FALSE(que.empty());
+    EXPECT_EQ(que.pop(arr, 10), 10);
+    EXPECT_EQ(arr[9], 9);
+    EXPECT_EQ(que.pop(arr, 10), 1);
+    EXPECT_EQ(arr[0], 10);
+
+    // the consumer races the producer across segment boundaries
+    std::thread producer([&_q]() {
+        std::string batch[5];
+
+        for (int i = 0; i < 100000; )
+        {
+            if (i % 7 == 0 && i + 5 <= 100000)
+            {
+                for (int k = 0; k < 5; k++)
+                    batch[k] = std::to_string(i + k);
+
+                EXPECT_EQ(_q.push(batch, 5), 5);
+                i += 5;
+            }
+            else
+                EXPECT_TRUE(_q.push(std::to_string(i++)));
+        }
+    });
+
+    std::string batch[3];
+    int expect = 0;
+
+    while (expect < 100000)
+    {
+        int n = _q.pop(batch, expect % 2 ? 3 : 1);
+
+        if (n == 0)
+            std::this_thread::yield();
+
+        for (int k = 0; k < n; k++)
+            EXPECT_EQ(batch[k], std::to_string(expect++));
+    }
+
+    producer.join();
+    EXPECT_TRUE(_q.empty());
+}
+
+TEST(unittest, case18)
+{
+    sharded_mpmc_queue<int> que(4, 2);
+    sharded_mpmc_queue<std::string> _q(64, 4);
+    std::atomic<int> pusher(8);
+    std::map<int, int> counter1;
+    std::map<int, int> counter2;
+    std::vector<std::thread> threads;
+    int arr[8];
+    int sum = 0;
+
+    // a full home shard spills to the other one
+    EXPECT_EQ(que.shards(), 2u);
+    for (int i = 0; i < 8; i++)
+        EXPECT_TRUE(que.push(i));
+
+    EXPECT_FALSE(que.push(8));
+    EXPECT_EQ(que.size(), 8u);
+    EXPECT_EQ(que.pop(arr, 8), 8);
+    for (int i = 0; i < 8; i++)
+        sum += arr[i];
+
+    EXPECT_EQ(sum, 28);
+    EXPECT_TRUE(que.empty());
+
+    // the same load as case5, each value is popped once per producer
+    for (int k = 0; k < 8; k++)
+    {
+        threads.emplace_back([&_q, &pusher]() {
+            for (int i = 0; i < 2048; )
+            {
+                if (_q.push(std::to_string(i)))
+                    i++;
+                else
+                    std::this_thread::yield();
+            }
+
+            --pusher;
+        });
+    }
+
+    for (auto *counter : {&counter1, &counter2})
+    {
+        threads.emplace_back([&_q, &pusher, counter]() {
+            std::string s;
+
+            while (!_q.empty() || pusher > 0)
+            {
+                if (_q.pop(s))
+                    (*counter)[atoi(s.c_str())]++;
+                else
+                    std::this_thread::yield();
+            }
+        });
+    }
+
+    for (auto& th : threads)
+        th.join();
+
+    EXPECT_EQ(_q.size(), 0u);
+    check2(2048, 8, counter1, counter2);
+}
+
+TEST(unittest, case19)
+{
+    priority_mpmc_queue<int, 4> que(8);
+    priority_spsc_queue<int, 2> wque(64, {3, 1});
+    priority_mpmc_queue<std::string, 8> _q(64);
+    std::atomic<int> pusher(4);
+    std::map<int, int> counter1;
+    std::map<int, int> counter2;
+    std::vector<std::thread> threads;
+    unsigned int lane;
+    int arr[8];
+    int v;
+
+    // strict, the highest non-empty lane first
+    EXPECT_TRUE(que.empty());
+    EXPECT_TRUE(que.push(3, 30));
+    EXPECT_TRUE(que.push(3, 31));
+    EXPECT_TRUE(que.push(1, 10));
+    EXPECT_TRUE(que.push(0, 0));
+    EXPECT_TRUE(que.pop(v, lane));
+    EXPECT_EQ(v, 0);
+    EXPECT_EQ(lane, 0u);
+    EXPECT_TRUE(que.pop(v, lane));
+    EXPECT_EQ(v, 10);
+    EXPECT_EQ(lane, 1u);
+    EXPECT_EQ(que.pop(arr, 0), 0);
+    EXPECT_EQ(que.pop(arr, -1), 0);
+    EXPECT_EQ(que.pop(arr, 8), 2);
+    EXPECT_EQ(arr[0], 30);
+    EXPECT_EQ(arr[1], 31);
+    EXPECT_FALSE(que.pop(v));
+    EXPECT_TRUE(que.empty());
+
+    // weighted 3:1, lane 1 is not starved by a busy lane 0
+    for (int i = 0; i < 12; i++)
+    {
+        EXPECT_TRUE(wque.push(0, i));
+        EXPECT_TRUE(wque.push(1, 100 + i));
+    }
+
+    for (int i = 0; i < 16; i++)
+    {
+        EXPECT_TRUE(wque.pop(v, lane));
+        EXPECT_EQ(lane, i % 4 == 3 ? 1u : 0u);
+    }
+
+    // lane 0 is drained, lane 1 goes on alone
+    for (int i = 0; i < 8; i++)
+    {
+        EXPECT_TRUE(wque.pop(v, lane));
+        EXPECT_EQ(v, 104 + i);
+    }
+
+    EXPECT_FALSE(wque.pop(v));
+
+    // credits taken by a short batch and not used go back to the lane
+    priority_spsc_queue<int, 2> rque(64, {3, 1});
+    EXPECT_TRUE(rque.push(0, 0));
+    for (int i = 0; i < 4; i++)
+        EXPECT_TRUE(rque.push(1, 100 + i));
+
+    EXPECT_EQ(rque.pop(arr, 0), 0);
+    EXPECT_EQ(rque.pop(arr, -1), 0);
+    EXPECT_EQ(rque.pop(arr, 8), 1);
+    EXPECT_EQ(arr[0], 0);
+    EXPECT_TRUE(rque.push(0, 1));
+    EXPECT_TRUE(rque.push(0, 2));
+    for (int i = 0; i < 3; i++)
+    {
+        EXPECT_TRUE(rque.pop(v, lane));
+        EXPECT_EQ(lane, i < 2 ? 0u : 1u);
+    }
+
+    // no element is left behind a cleared bit
+    for (int k = 0; k < 4; k++)
+    {
+        threads.emplace_back([&_q, &pusher, k]() {
+            for (int i = 0; i < 2048; )
+            {
+                if (_q.push((i + k) % 8, std::to_string(i)))
+                    i++;
+                else
+                    std::this_thread::yield();
+            }
+
+            --pusher;
+        });
+    }
+
+    for (auto *counter : {&counter1, &counter2})
+    {
+        threads.emplace_back([&_q, &pusher, counter]() {
+            std::string s;
+
+            while (!_q.empty() || pusher > 0)
+            {
+                if (_q.pop(s))
+                    (*counter)[atoi(s.c_str())]++;
+                else
+                    std::this_thread::yield();
+            }
+        });
+    }
+
+    for (auto& th : threads)
+        th.join();
+
+    EXPECT_TRUE(_q.empty());
+    check2(2048, 4, counter1, counter2);
+}
+
+TEST(unittest, case20)
+{
+    struct mpkfifo *fifo = mpkfifo_alloc(64);
+    char buf[64] = {0};
+
+    EXPECT_EQ(mpkfifo_alloc(48), (struct mpkfifo *)NULL);
+    EXPECT_EQ(mpkfifo_put(fifo, "0123456789", 10), 10u);
+    EXPECT_EQ(mpkfifo_len(fifo), 10u);
+    EXPECT_EQ(mpkfifo_put(fifo, buf, 55), 0u);    // all or nothing
+    EXPECT_EQ(mpkfifo_put(fifo, buf, 54), 54u);
+    EXPECT_EQ(mpkfifo_get(fifo, buf, 4), 4u);
+    EXPECT_EQ(memcmp(buf, "0123", 4), 0);
+    EXPECT_EQ(mpkfifo_get(fifo, buf, sizeof (buf)), 60u);
+    EXPECT_EQ(memcmp(buf, "456789", 6), 0);
+    EXPECT_EQ(mpkfifo_get(fifo, buf, sizeof (buf)), 0u);
+
+    // wraps around the end of the buffer
+    EXPECT_EQ(mpkfifo_put(fifo, buf, 40), 40u);
+    EXPECT_EQ(mpkfifo_get(fifo, buf, 40), 40u);
+    EXPECT_EQ(mpkfifo_put(fifo, "abcdefghijklmnopqrstuvwxyz0123", 30), 30u);
+    EXPECT_EQ(mpkfifo_get(fifo, buf, sizeof (buf)), 30u);
+    EXPECT_EQ(memcmp(buf, "abcdefghijklmnopqrstuvwxyz0123", 30), 0);
+    mpkfifo_free(fifo);
+
+    // 4 writers of 8 bytes records {writer, seq}, 2 readers,
+    // each reader sees the records of a writer in order
+    fifo = mpkfifo_alloc(256);
+    std::vector<std::vector<int>> seen(4, std::vector<int>(2000, 0));
+    std::atomic<int> writers(4);
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+
+    for (int w = 0; w < 4; w++)
+    {
+        threads.emplace_back([fifo, &writers, w]() {
+            for (int i = 0; i < 2000; )
+            {
+                int rec[2] = {w, i};
+
+                if (mpkfifo_put(fifo, rec, sizeof (rec)) == sizeof (rec))
+                    i++;
+                else
+                    std::this_thread::yield();
+            }
+
+            --writers;
+        });
+    }
+
+    for (int r = 0; r < 2; r++)
+    {
+        threads.emplace_back([fifo, &writers, &seen, &mutex]() {
+            int last[4] = {-1, -1, -1, -1};
+            int recs[16][2];
+
+            while (writers > 0 || mpkfifo_len(fifo) > 0)
+            {
+                unsigned int len = mpkfifo_get(fifo, recs, sizeof (recs));
+
+                if (len == 0)
+                {
+                    std::this_thread::yield();
+                    continue;
+                }
+
+                ASSERT_EQ(len % sizeof (recs[0]), 0u);
+                std::lock_guard<std::mutex> lock(mutex);
+                for (unsigned int k = 0; k < len / sizeof (recs[0]); k++)
+                {
+                    ASSERT_GT(recs[k][1], last[recs[k][0]]);
+                    last[recs[k][0]] = recs[k][1];
+                    seen[recs[k][0]][recs[k][1]]++;
+                }
+            }
+        });
+    }
+
+    for (auto& th : threads)
+        th.join();
+
+    for (int w = 0; w < 4; w++)
+    {
+        for (int i = 0; i < 2000; i++)
+            EXPECT_EQ(seen[w][i], 1);
+    }
+
+    mpkfifo_free(fifo);
+}
+
+TEST(unittest, case21)
+{
+    const char *text = "abcdefghijklmnopqrstuvwxyz";
+    spsc_queue<char> que(16);
+    struct kfifo *fifo = kfifo_alloc(16);
+    char buf[32];
+    int in[2];
+    int out[2];
+
+    ASSERT_EQ(pipe(in), 0);
+    ASSERT_EQ(pipe(out), 0);
+    fcntl(in[0], F_SETFL, O_NONBLOCK);
+
+    // the second readv/writev wraps around the end of the ring
+    EXPECT_EQ(write(in[1], text, 12), 12);
+    EXPECT_EQ(ring_read_fd(que, in[0]), 12);
+    EXPECT_EQ(ring_write_fd(que, out[1], 10), 10);
+    EXPECT_EQ(read(out[0], buf, sizeof (buf)), 10);
+    EXPECT_EQ(memcmp(buf, text, 10), 0);
+    EXPECT_EQ(write(in[1], text + 12, 14), 14);
+    EXPECT_EQ(ring_read_fd(que, in[0]), 14);
+    EXPECT_EQ(ring_read_fd(que, in[0], 0), 0);
+    EXPECT_EQ(ring_read_fd(que, in[0]), -1);
+    EXPECT_EQ(errno, ENOBUFS);
+    EXPECT_EQ(ring_write_fd(que, out[1], -1), 0);
+    EXPECT_EQ(ring_write_fd(que, out[1]), 16);
+    EXPECT_EQ(read(out[0], buf, sizeof (buf)), 16);
+    EXPECT_EQ(memcmp(buf, text + 10, 16), 0);
+    EXPECT_EQ(ring_write_fd(que, out[1]), 0);
+    EXPECT_EQ(ring_read_fd(que, in[0]), -1);
+    EXPECT_EQ(errno, EAGAIN);
+
+    // the same with kfifo
+    EXPECT_EQ(write(in[1], text, 12), 12);
+    EXPECT_EQ(__kfifo_read_fd(fifo, in[0], 32), 12);
+    EXPECT_EQ(__kfifo_write_fd(fifo, out[1], 10), 10);
+    EXPECT_EQ(read(out[0], buf, sizeof (buf)), 10);
+    EXPECT_EQ(memcmp(buf, text, 10), 0);
+    EXPECT_EQ(write(in[1], text + 12, 14), 14);
+    EXPECT_EQ(__kfifo_read_fd(fifo, in[0], 32), 14);
+    EXPECT_EQ(__kfifo_read_fd(fifo, in[0], 0), 0);
+    EXPECT_EQ(__kfifo_read_fd(fifo, in[0], 32), -1);
+    EXPECT_EQ(errno, ENOBUFS);
+    EXPECT_EQ(__kfifo_write_fd(fifo, out[1], 32), 16);
+    EXPECT_EQ(read(out[0], buf, sizeof (buf)), 16);
+    EXPECT_EQ(memcmp(buf, text + 10, 16), 0);
+    EXPECT_EQ(__kfifo_write_fd(fifo, out[1], 32), 0);
+
+    close(in[1]);
+    EXPECT_EQ(ring_read_fd(que, in[0]), 0);
+    EXPECT_EQ(__kfifo_read_fd(fifo, in[0], 32), 0);
+    close(in[0]);
+    close(out[0]);
+    close(out[1]);
+    kfifo_free(fifo);
+
+    // socketpair to socketpair through a ring, one thread each side
+    spsc_queue<char> ring(4096);
+    std::atomic<bool> eof(false);
+    int src[2];
+    int dst[2];
+
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, src), 0);
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, dst), 0);
+
+    std::thread sender([&src]() {
+        char data[1000];
+
+        for (int i = 0; i < 1000; i++)
+        {
+            for (int k = 0; k < 1000; k++)
+                data[k] = (char)((i * 1000 + k) % 251);
+
+            ASSERT_EQ(write(src[0], data, sizeof (data)), (ssize_t)sizeof (data));
+        }
+
+        shutdown(src[0], SHUT_WR);
+    });
+
+    std::thread ingress([&ring, &src, &eof]() {
+        for (;;)
+        {
+            ssize_t ret = ring_read_fd(ring, src[1]);
+
+            if (ret == 0)
+                break;
+
+            if (ret < 0)
+            {
+                ASSERT_EQ(errno, ENOBUFS);
+                std::this_thread::yield();
+            }
+        }
+
+        eof = true;
+    });
+
+    std::thread egress([&ring, &dst, &eof]() {
+        for (;;)
+        {
+            bool done = eof.load();
+            ssize_t ret = ring_write_fd(ring, dst[0]);
+
+            ASSERT_GE(ret, 0);
+            if (ret == 0 && done)
+                break;
+
+            if (ret == 0)
+                std::this_thread::yield();
+        }
+
+        shutdown(dst[0], SHUT_WR);
+    });
+
+    long total = 0;
+    bool match = true;
+    ssize_t ret;
+
+    while ((ret = read(dst[1], buf, sizeof (buf))) > 0)
+    {
+        for (ssize_t k = 0; k < ret; k++, total++)
+            match = match && buf[k] == (char)(total % 251);
+    }
+
+    sender.join();
+    ingress.join();
+    egress.join();
+    EXPECT_EQ(total, 1000000);
+    EXPECT_TRUE(match);
+
+    close(src[0]);
+    close(src[1]);
+    close(dst[0]);
+    close(dst[1]);
+}
+
+TEST(unittest, case22)
+{
+    std::string path = "/tmp/queue62_unittest_" + std::to_string(getpid());
+    mmap_spsc_queue<int> que;
+    int arr[16];
+    int t;
+
+    unlink(path.c_str());
+    EXPECT_FALSE(que.sync());
+    EXPECT_EQ(errno, EBADF);
+    ASSERT_TRUE(que.open(path.c_str(), 12));
+    for (int i = 0; i < 10; i++)
+        EXPECT_TRUE(que.push(i));
+    EXPECT_EQ(que.pop(arr, 3), 3);
+    EXPECT_TRUE(que.sync());
+    que.close();
+
+    // reopened, size is ignored, the 7 elements left are still there
+    ASSERT_TRUE(que.open(path.c_str(), 1024, 4));
+    EXPECT_EQ(que.read_available(), 7);
+    EXPECT_EQ(que.push(arr, 16), 9);    // wraps, capacity is 16
+    EXPECT_EQ(que.pop(arr, 16), 16);
+    for (int i = 0; i < 7; i++)
+        EXPECT_EQ(arr[i], i + 3);
+    EXPECT_EQ(arr[7], 0);
+    EXPECT_FALSE(que.pop(t));
+    EXPECT_EQ(que.last_error(), 0);    // the sync_every checkpoints
+    EXPECT_FALSE(mmap_spsc_queue<long>().open(path.c_str(), 16));
+    EXPECT_EQ(errno, EINVAL);
+
+    // the child pushes then exits without close() or sync(), as if it crashed
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0)
+    {
+        mmap_spsc_queue<int> child;
+
+        if (!child.open(path.c_str(), 16))
+            _exit(1);
+
+        for (int i = 100; i < 105; i++)
+            child.push(i);
+
+        _exit(0);
+    }
+
+    int status;
+    EXPECT_EQ(waitpid(pid, &status, 0), pid);
+    EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    que.close();
+    ASSERT_TRUE(que.open(path.c_str(), 16));
+    EXPECT_EQ(que.read_available(), 5);
+    ring_span<int> span = que.peek(16);
+    ASSERT_EQ(span.size(), 5);
+    for (int i = 0; i < 5; i++)
+        EXPECT_EQ(i < span.len[0] ? span.data[0][i] : span.data[1][i - span.len[0]], 100 + i);
+    que.consume(5);
+    que.close();
+
+    // a file of something else
+    FILE *fp = fopen(path.c_str(), "r+");
+    ASSERT_TRUE(fp != NULL);
+    fputs("not a queue", fp);
+    fclose(fp);
+    EXPECT_FALSE(que.open(path.c_str(), 16));
+    EXPECT_EQ(errno, EINVAL);
+    unlink(path.c_str());
+}
+
+static bool readable(int fd)
+{
+    struct pollfd pfd = {fd, POLLIN, 0};
+
+    return poll(&pfd, 1, 0) == 1;
+}
+
+TEST(unittest, case23)
+{
+    eventfd_queue<spsc_queue<int>> que(16);
+    uint64_t cnt;
+    int arr[16];
+    int t;
+
+    // one signal for a burst
+    EXPECT_FALSE(readable(que.fd()));
+    EXPECT_TRUE(que.push(1));
+    EXPECT_TRUE(readable(que.fd()));
+    EXPECT_EQ(que.push(arr, 3), 3);
+    EXPECT_TRUE(que.push(2));
+    EXPECT_EQ(read(que.fd(), &cnt, sizeof (cnt)), (ssize_t)sizeof (cnt));
+    EXPECT_EQ(cnt, 1u);
+    EXPECT_EQ(que.pop(arr, 16), 5);
+    EXPECT_TRUE(que.rearm());
+    EXPECT_FALSE(readable(que.fd()));
+
+    // pushed after the queue is drained but before rearm, no signal
+    EXPECT_TRUE(que.push(3));
+    EXPECT_TRUE(readable(que.fd()));
+    EXPECT_TRUE(que.pop(t));
+    EXPECT_TRUE(que.push(4));
+    EXPECT_FALSE(que.rearm());
+    EXPECT_FALSE(readable(que.fd()));
+    EXPECT_TRUE(que.pop(t));
+    EXPECT_EQ(t, 4);
+    EXPECT_TRUE(que.rearm());
+
+    // an epoll loop consuming from 4 producers of a mpmc_queue
+    eventfd_queue<mpmc_queue<int>> _q(256);
+    std::vector<std::thread> producers;
+    std::map<int, int> counter1;
+    struct epoll_event ev;
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    int wakeups = 0;
+    int got = 0;
+
+    ASSERT_GE(epfd, 0);
+    ev.events = EPOLLIN;
+    ev.data.fd = _q.fd();
+    ASSERT_EQ(epoll_ctl(epfd, EPOLL_CTL_ADD, _q.fd(), &ev), 0);
+
+    for (int p = 0; p < 4; p++)
+    {
+        producers.emplace_back([&_q, p]() {
+            for (int i = p * 5000; i < (p + 1) * 5000; )
+            {
+                if (_q.push(i))
+                    i++;
+                else
+                    std::this_thread::yield();
+            }
+        });
+    }
+
+    while (got < 20000)
+    {
+        ASSERT_EQ(epoll_wait(epfd, &ev, 1, 5000), 1);
+        wakeups++;
+
+        do
+        {
+            while (_q.pop(t))
+            {
+                counter1[t]++;
+                got++;
+            }
+        } while (!_q.rearm());
+    }
+
+    for (auto& th : producers)
+        th.join();
+
+    EXPECT_LE(wakeups, got);
+    EXPECT_FALSE(readable(_q.fd()));
+    check1(20000, 1, counter1);
+    close(epfd);
+}
+
+#ifdef QUEUE62_HAVE_COROUTINE
+// starts at once, nobody awaits it
+struct detached_task
+{
+    struct promise_type
+    {
+        detached_task get_return_object() { return detached_task(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() { }
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+template <typename QUEUE>
+static detached_task coro_consume(coro_queue<QUEUE>& que, int n, std::atomic<long>& sum,
+                                  std::atomic<int>& done)
+{
+    for (int i = 0; i < n; i++)
+        sum += co_await que.async_pop();
+
+    done++;
+}
+
+template <typename QUEUE>
+static detached_task coro_produce(coro_queue<QUEUE>& que, int first, int n,
+                                  std::atomic<int>& done)
+{
+    for (int i = first; i < first + n; i++)
+        co_await que.async_push(i);
+
+    done++;
+}
+
+static detached_task coro_pop_one(coro_queue<mpmc_queue<std::string>>& que, std::string& ret)
+{
+    ret = co_await que.async_pop();
+}
+
+TEST(unittest, case24)
+{
+    // the consumers are resumed by push in the order they waited
+    coro_queue<mpmc_queue<std::string>> que(16);
+    std::vector<std::string> got(100);
+    std::string s;
+
+    for (int i = 0; i < 100; i++)
+        coro_pop_one(que, got[i]);
+
+    for (int i = 0; i < 100; i++)
+    {
+        EXPECT_TRUE(que.push(std::to_string(i)));
+        EXPECT_EQ(got[i], std::to_string(i));
+    }
+
+    // not suspended when there is something to pop
+    EXPECT_TRUE(que.push("x"));
+    coro_pop_one(que, s);
+    EXPECT_EQ(s, "x");
+
+    // the producer waits for room, pop resumes it
+    coro_queue<spsc_queue<int>> _q(4);
+    std::atomic<int> done(0);
+    int t;
+
+    coro_produce(_q, 0, 100, done);
+    EXPECT_TRUE(_q.queue().full());
+    for (int i = 0; i < 100; i++)
+    {
+        EXPECT_TRUE(_q.pop(t));
+        EXPECT_EQ(t, i);
+    }
+
+    EXPECT_FALSE(_q.pop(t));
+    EXPECT_EQ(done, 1);
+
+    // 1000 consumer and 4 producer coroutines on 4 threads
+    coro_queue<mpmc_queue<int>> q2(64);
+    std::vector<std::thread> threads;
+    std::atomic<long> sum(0);
+    std::atomic<int> consumers(0);
+    std::atomic<int> producers(0);
+
+    for (int i = 0; i < 1000; i++)
+        coro_consume(q2, 20, sum, consumers);
+
+    for (int p = 0; p < 4; p++)
+    {
+        threads.emplace_back([&q2, &producers, p]() {
+            coro_produce(q2, p * 5000, 5000, producers);
+        });
+    }
+
+    for (auto& th : threads)
+        th.join();
+
+    EXPECT_EQ(producers, 4);
+    EXPECT_EQ(consumers, 1000);
+    EXPECT_EQ(sum, 19999L * 20000 / 2);
+    EXPECT_FALSE(q2.pop(t));
+}
+#endif
+
+#ifdef QUEUE62_TRACE
+// one element of every QUEUE62_TRACE_SAMPLE positions is recorded
+static void check_latency(const queue_latency& lat, uint64_t count)
+{
+    uint64_t sum = 0;
+
+    EXPECT_EQ(lat.count, count);
+    EXPECT_LE(lat.p50, lat.p99);
+    EXPECT_LE(lat.p99, lat.p999);
+    EXPECT_LE(lat.p999, lat.max);
+
+    for (size_t i = 0; i < lat.buckets.size(); i++)
+    {
+        sum += lat.buckets[i].second;
+        if (i > 0)
+        {
+            EXPECT_LT(lat.buckets[i - 1].first, lat.buckets[i].first);
+        }
+    }
+
+    EXPECT_EQ(sum, count);
+    if (!lat.buckets.empty())
+    {
+        EXPECT_EQ(lat.buckets.back().first, lat.max);
+    }
+}
+
+// 4 producers and 4 consumers, batch and not, every position is sampled once
+template <typename T, typename MAKE>
+static void trace_mpmc(MAKE make)
+{
+    mpmc_queue<T> que(256);
+    std::vector<std::thread> threads;
+    std::atomic<int> popped(0);
+    int total = QUEUE62_TRACE_SAMPLE * 400;
+
+    for (int p = 0; p < 4; p++)
+    {
+        threads.emplace_back([&que, &make, total]() {
+            T arr[8];
+
+            for (int i = 0; i < total / 4; )
+            {
+                int n;
+
+                if (i % 16 == 0)
+                {
+                    for (int k = 0; k < 8; k++)
+                        arr[k] = make(i + k);
+
+                    n = que.push(arr, std::min(8, total / 4 - i));
+                }
+                else
+                    n = que.push(make(i)) ? 1 : 0;
+
+                if (n == 0)
+                    std::this_thread::yield();
+
+                i += n;
+            }
+        });
+    }
+
+    for (int c = 0; c < 4; c++)
+    {
+        threads.emplace_back([&que, &popped, total, c]() {
+            T arr[8];
+
+            while (popped < total)
+            {
+                int n = (c & 1) ? que.pop(arr, 8) : (que.pop(arr[0]) ? 1 : 0);
+
+                popped += n;
+                if (n == 0)
+                    std::this_thread::yield();
+            }
+        });
+    }
+
+    for (auto& th : threads)
+        th.join();
+
+    check_latency(que.latency(), total / QUEUE62_TRACE_SAMPLE);
+}
+
+TEST(unittest, case25)
+{
+    spsc_queue<int> que(1024);
+    std::vector<int> arr(QUEUE62_TRACE_SAMPLE * 4);
+    int t;
+
+    check_latency(que.latency(), 0);
+    for (int i = 0; i < QUEUE62_TRACE_SAMPLE * 100; i++)
+    {
+        EXPECT_TRUE(que.push(i));
+        EXPECT_TRUE(que.pop(t));
+    }
+
+    check_latency(que.latency(), 100);
+
+    // batch and zero-copy paths, position 6400 waits 20ms in the queue
+    EXPECT_EQ(que.push(arr.data(), QUEUE62_TRACE_SAMPLE * 4), QUEUE62_TRACE_SAMPLE * 4);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    ring_span<int> span = que.peek(QUEUE62_TRACE_SAMPLE * 4);
+    que.consume(span.size());
+    check_latency(que.latency(), 104);
+    EXPECT_GE(que.latency().max, 10e6);
+    EXPECT_LT(que.latency().p50, 10e6);
+
+    // both mpmc engines
+    trace_mpmc<int>([](int i) { return i; });
+    trace_mpmc<std::string>([](int i) { return std::to_string(i); });
+}
+#endif
+
+// every operator new of the test binary is counted
+static std::atomic<long> new_calls(0);
+
+static void *counted_new(size_t size)
+{
+    new_calls.fetch_add(1, std::memory_order_relaxed);
+    return malloc(size ? size : 1);
+}
+
+// not inlined, or gcc sees free() of a pointer from operator new
+__attribute__((noinline)) static void counted_delete(void *p)
+{
+    free(p);
+}
+
+void *operator new(size_t size)
+{
+    void *p = counted_new(size);
+
+    if (!p)
+        throw std::bad_alloc();
+
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    return counted_new(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    return counted_new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+    counted_delete(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    counted_delete(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    counted_delete(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+    counted_delete(p);
+}
+
+// not trivially copyable, so it is stored by holders of __holder_pool
+struct pool_item
+{
+    pool_item() { }
+    pool_item(const char *s) : str(s) { }
+    pool_item(const pool_item& other) : str(other.str) { }
+    pool_item& operator=(const pool_item& other) { str = other.str; return *this; }
+
+    std::string str;    // short, never allocates
+};
+
+// destroyed after the thread_local caches of the main thread
+static mpmc_queue<pool_item, 64> static_que;
+
+// a thread_local constructed before the cache, so destroyed after it
+struct pool_guard
+{
+    mpmc_queue<pool_item, 64> *que = NULL;
+    int popped = 0;
+
+    ~pool_guard()
+    {
+        pool_item item;
+
+        while (que->pop(item))
+            popped++;
+
+        // more than popped, so new holders are needed too
+        EXPECT_EQ(popped, 32);
+        for (int i = 0; i < 48; i++)
+            EXPECT_TRUE(que->push(pool_item("late")));
+    }
+};
+
+TEST(unittest, holder_pool)
+{
+    mpmc_queue<pool_item, 64> que;
+    pool_item item;
+    long calls = new_calls.load();
+
+    // counted, then after the first holders push/pop never reach malloc
+    std::string str(100, 'x');
+    EXPECT_GT(new_calls.load(), calls);
+    EXPECT_TRUE(que.push(pool_item("abc")));
+    EXPECT_TRUE(que.pop(item));
+
+    calls = new_calls.load();
+    for (int i = 0; i < 10000; i++)
+    {
+        int n = 1 + i % 60;
+
+        for (int k = 0; k < n; k++)
+            que.push(item);
+
+        for (int k = 0; k < n; k++)
+            que.pop(item);
+    }
+
+    EXPECT_EQ(new_calls.load(), calls);
+    EXPECT_TRUE(que.empty());
+
+    // holders freed and made after the cache of the thread is gone
+    std::thread th([&que]() {
+        static thread_local pool_guard guard;
+
+        guard.que = &que;
+        for (int i = 0; i < 32; i++)
+            EXPECT_TRUE(que.push(pool_item("abc")));
+    });
+
+    th.join();
+
+    // a new thread takes the magazines given back, never the live holders
+    std::thread th2([]() {
+        mpmc_queue<pool_item, 64> other;
+
+        for (int i = 0; i < 62; i++)
+            EXPECT_TRUE(other.push(pool_item("xyz")));
+    });
+
+    th2.join();
+    for (int i = 0; i < 48; i++)
+    {
+        EXPECT_TRUE(que.pop(item));
+        EXPECT_EQ(item.str, "late");
+    }
+
+    EXPECT_FALSE(que.pop(item));
+
+    // freed by the destructor of static_que, at exit
+    for (int i = 0; i < 32; i++)
+        static_que.push(pool_item("abc"));
+
+    EXPECT_FALSE(static_que.empty());
+}
+
+#ifdef QUEUE62_STATS
+// every successful push/pop call is exactly one successful CAS
+template <typename T, typename MAKE>
+void stats_mpmc(MAKE make, int capacity)
+{
+    mpmc_queue<T> que(capacity);
+    std::atomic<long> calls(0);
+    std::atomic<int> pusher(2);
+    std::vector<std::thread> threads;
+    T arr[8];
+    int cnt = 0;
+
+    while (que.push(make(cnt)))
+        cnt++;
+
+    mpmc_stats st = que.stats();
+    EXPECT_EQ(st.push_full, 1u);
+    EXPECT_EQ(st.pop_empty, 0u);
+    EXPECT_EQ(st.high_water, (unsigned int)cnt);
+    EXPECT_EQ(st.cas_attempts - st.cas_failures, (uint64_t)cnt);
+
+    EXPECT_EQ(que.pop(arr, 8), std::min(cnt, 8));
+    while (que.pop(arr[0]))
+        ;
+
+    st = que.stats();
+    EXPECT_EQ(st.pop_empty, 1u);
+    calls = st.cas_attempts - st.cas_failures;
+
+    for (int k = 0; k < 2; k++)
+    {
+        threads.emplace_back([&que, &calls, &pusher, &make]() {
+            T two[2];
+            for (int i = 0; i < 4096; i += 2)
+            {
+                two[0] = make(i);
+                two[1] = make(i + 1);
+                if (que.push(two[0]))
+                    ++calls;
+
+                if (que.push(two, 2) > 0)
+                    ++calls;
+            }
+            --pusher;
+        });
+        threads.emplace_back([&que, &calls, &pusher]() {
+            T res[2];
+            while (pusher > 0 || !que.empty())
+            {
+                if (que.pop(res[0]))
+                    ++calls;
+
+                if (que.pop(res, 2) > 0)
+                    ++calls;
+            }
+        });
+    }
+
+    for (auto& th : threads)
+        th.join();
+
+    st = que.stats();
+    EXPECT_EQ(st.cas_attempts - st.cas_failures, (uint64_t)calls.load());
+    EXPECT_LE(st.high_water, (unsigned int)cnt);
+    EXPECT_GT(st.push_full + st.pop_empty, 1u);
+}
+
+TEST(unittest, stats)
+{
+    // inline slots hold capacity elements, holders hold capacity - 2
+    stats_mpmc<int>([](int i) { return i; }, 16);
+    stats_mpmc<std::string>([](int i) { return std::to_string(i); }, 16);
+}
+#endif